@@ -0,0 +1,154 @@
+#include <cmath>
+#include <cstring>
+
+#include "replay.h"
+
+// Feeds raw readings from a simulated, miscalibrated sensor through
+//  read_accelerometer and the six-side calibration, and checks that
+//  calibrated readings come out at 1G.  Also checks that the battery's band
+//  gap reference is kept through turning off, and that only temperature
+//  points 0 and 1 can be calibrated.
+// usage: calibration_test.bin
+
+extern unsigned char eeprom_data[];
+extern unsigned char twi_data[];
+extern word battery_reference;
+extern int band_gap_reading;
+extern int battery_voltage;
+
+int failures = 0;
+
+void check(bool passed, string message) {
+  if(!passed) {
+    cout<<"FAIL: "<<message<<endl;
+    failures++;
+  }
+}
+
+// a sensor with per-axis gain (counts per G) and offset (counts)
+double sensor_gain[] = {22.4, 20.1, 21.0};
+double sensor_offset[] = {1.5, -2.0, 0.6};
+
+// what the sensor reads for an acceleration (in Gs), with a little noise
+void sense(double* g, int sample) {
+  for(int i=0; i<3; i++) {
+    double noise = ((sample*7+i*3)%5-2)*.2; // -.4 to .4 counts
+    int value = lround(g[i]*sensor_gain[i]+sensor_offset[i]+noise);
+    value = value<-32 ? -32 : value>31 ? 31 : value;
+    twi_data[i] = value & 0x3F;
+  }
+  twi_data[3] = 0; // tilt
+}
+
+int read(double* g, int sample) {
+  sense(g, sample);
+  hexbright::read_accelerometer();
+  return hexbright::magnitude(hexbright::vector(0));
+}
+
+// the average magnitude over each side, at rest
+double side_error() {
+  double worst = 0;
+  for(int side=0; side<6; side++) {
+    double g[3] = {0, 0, 0};
+    g[side/2] = side%2 ? -1 : 1;
+    double total = 0;
+    for(int i=0; i<20; i++)
+      total += read(g, i);
+    worst = max(worst, fabs(total/20-100));
+  }
+  return worst;
+}
+
+int main(int argc, char** argv) {
+  hexbright::load_accelerometer_calibration();
+  double before = side_error();
+  cout<<"uncalibrated: worst side is "<<before<<"/100 Gs off"<<endl;
+
+  hexbright::start_accelerometer_calibration();
+  unsigned char result = 0;
+  // the sides in an odd order, with motion (and a tilted hold) in between
+  int order[] = {2, 5, 0, 3, 4, 1};
+  int sample = 0;
+  for(int s=0; s<6; s++) {
+    int side = order[s];
+    double moving[3] = {.5, .5, .7};
+    for(int i=0; i<10; i++, sample++) {
+      sense(moving, sample);
+      hexbright::read_accelerometer();
+      result = hexbright::calibrate_accelerometer();
+    }
+    double g[3] = {0, 0, 0};
+    g[side/2] = side%2 ? -1 : 1;
+    for(int i=0; i<100; i++, sample++) {
+      sense(g, sample);
+      hexbright::read_accelerometer();
+      result = hexbright::calibrate_accelerometer();
+    }
+    if(s<5)
+      check(result==s+1, "side not captured");
+  }
+  check(result==CALIBRATION_SAVED, "calibration not saved");
+
+  double after = side_error();
+  cout<<"calibrated: worst side is "<<after<<"/100 Gs off"<<endl;
+  check(after<3, "calibrated readings are more than .03 Gs off");
+
+  // it survives a restart
+  hexbright::load_accelerometer_calibration();
+  check(side_error()==after, "calibration not loaded from EEPROM");
+  // and a corrupted block isn't used
+  eeprom_data[EEPROM_ACCEL_CALIBRATION+2]++;
+  hexbright::load_accelerometer_calibration();
+  check(side_error()==before, "corrupted calibration used");
+  hexbright::clear_accelerometer_calibration();
+  check(side_error()==before, "cleared calibration used");
+
+  // nominal values match the old floating point scaling
+  for(int raw=-32; raw<32; raw++) {
+    if((int)(raw*(100/21.3)) != (raw*601)/128) {
+      cout<<raw<<": "<<(int)(raw*(100/21.3))<<" != "<<(raw*601)/128<<endl;
+      check(false, "nominal scaling changed");
+    }
+  }
+
+  // a sensor that never gives a valid reading doesn't hold up the update
+  double level[3] = {0, 0, 1};
+  read(level, 0);
+  int before_errors = hexbright::get_accelerometer_errors();
+  int last = hexbright::vector(0)[2];
+  twi_data[0] = 0x40; // alert: updating while we read
+  hexbright::read_accelerometer();
+  check(hexbright::get_accelerometer_errors()==before_errors+1, "a failed read is counted");
+  check(hexbright::vector(0)[2]==last, "a failed read repeats the last vector");
+
+  // the battery reference, on a new unit and after turning off
+  memset(eeprom_data+EEPROM_BATTERY_REFERENCE, 0xFF, 3);
+  hexbright::load_battery_reference();
+  check(battery_reference==0xFFFF, "no battery reference on a new unit");
+  battery_reference = 64*340; // a band gap reading of 340 at the ceiling
+  hexbright::save_battery_reference();
+  battery_reference = 0xFFFF;
+  hexbright::load_battery_reference();
+  check(battery_reference==64*340, "battery reference after turning off");
+  // turned on again with a low battery, it doesn't read full
+  battery_voltage = 0;
+  band_gap_reading = 360;
+  for(int i=0; i<64; i++)
+    hexbright::estimate_battery();
+  check(battery_voltage>3100 && battery_voltage<3200, "low battery after turning off");
+
+  // there are only two temperature points
+  const int size = EEPROM_BATTERY_REFERENCE-EEPROM_TEMP_CALIBRATION;
+  unsigned char temperature[size];
+  memcpy(temperature, eeprom_data+EEPROM_TEMP_CALIBRATION, size);
+  check(!hexbright::calibrate_temperature(2, 250), "temperature point 2");
+  check(!memcmp(temperature, eeprom_data+EEPROM_TEMP_CALIBRATION, size), "temperature point 2 saved");
+
+  if(failures) {
+    cout<<failures<<" failures"<<endl;
+    return 1;
+  }
+  cout<<"all calibration tests passed"<<endl;
+  return 0;
+}
@@ -0,0 +1,51 @@
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+#include "capture_decode.h"
+
+using namespace std;
+
+// Reads an EEPROM dump (hex bytes, as printed by tests/accelerometer_capture)
+//  from stdin and prints it in the format the recordings in
+//  experiments/accelerometer_readings use:
+//   magnitude: x/y/z/recorded vector
+// usage: capture_decode.bin < dump > sample01
+
+int main(int argc, char** argv) {
+  vector<unsigned char> eeprom;
+  string word;
+  while(cin>>word) {
+    if(word=="DONE")
+      break;
+    eeprom.push_back(strtol(word.c_str(), NULL, 16));
+  }
+
+  capture c = decode_capture(eeprom);
+  if(!c.valid) {
+    cerr<<"not a capture (bad header)"<<endl;
+    return 1;
+  }
+  cerr<<"rate "<<c.rate<<" (ACC_RATE_*), "<<c.samples.size()<<" samples, "
+      <<c.pretrigger<<" before the trigger at update "<<c.trigger_tick
+      <<" (threshold "<<c.threshold<<")"<<endl;
+
+  int tilt = -1;
+  for(size_t i=0; i<c.samples.size(); i++) {
+    capture_sample& s = c.samples[i];
+    if(s.dropped)
+      cerr<<"sample "<<i<<": "<<s.dropped<<" samples dropped"<<endl;
+    if(s.tilt!=tilt) {
+      tilt = s.tilt;
+      printf("tilt: 0x%02X\n", tilt);
+    }
+    // the same scaling as read_accelerometer
+    int vec[3];
+    for(int j=0; j<3; j++)
+      vec[j] = s.raw[j]*(100/21.3);
+    double magnitude = sqrt((double)vec[0]*vec[0]+vec[1]*vec[1]+vec[2]*vec[2]);
+    printf("%.2f: %d/%d/%d/recorded vector\n", magnitude, vec[0], vec[1], vec[2]);
+  }
+  return 0;
+}
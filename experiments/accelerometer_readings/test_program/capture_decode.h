@@ -0,0 +1,105 @@
+// Decodes an accelerometer capture (see ACCEL_CAPTURE in hexbright.cpp for
+//  the format) back into raw 6-bit samples.
+#ifndef CAPTURE_DECODE_H
+#define CAPTURE_DECODE_H
+
+#include <vector>
+
+struct capture_sample {
+  int raw[3]; // 6-bit readings, -32 to 31 (21.3 = 1G)
+  int tilt;   // tilt register at this sample
+  int dropped; // samples dropped just before this one
+};
+
+struct capture {
+  bool valid;
+  int rate; // ACC_RATE_*
+  int pretrigger; // the first samples, up to and including the trigger
+  int trigger_tick; // update() count at the trigger
+  int threshold;
+  std::vector<capture_sample> samples;
+};
+
+class bit_reader {
+  const std::vector<unsigned char>& data;
+  size_t bit;
+public:
+  bit_reader(const std::vector<unsigned char>& data, size_t start) : data(data), bit(start*8) {}
+  bool done() { return bit>=data.size()*8; }
+  // reads past the end return 1s, like erased EEPROM
+  int read(int bits) {
+    int value = 0;
+    while(bits--) {
+      int b = bit<data.size()*8 ? (data[bit/8]>>(7-bit%8)) & 1 : 1;
+      value = (value<<1) | b;
+      bit++;
+    }
+    return value;
+  }
+};
+
+inline int sign_extend6(int value) {
+  return value & 0x20 ? value-64 : value;
+}
+
+inline capture decode_capture(const std::vector<unsigned char>& eeprom) {
+  capture result;
+  result.valid = eeprom.size()>=8 && eeprom[0]=='A' && eeprom[1]==1;
+  if(!result.valid)
+    return result;
+  result.rate = eeprom[2];
+  result.pretrigger = eeprom[3];
+  result.trigger_tick = eeprom[4] | (eeprom[5]<<8);
+  result.threshold = eeprom[6];
+
+  bit_reader bits(eeprom, 8);
+  int last[3] = {0, 0, 0};
+  int tilt = 0;
+  int dropped = 0;
+  while(!bits.done()) {
+    // escapes come first; a 1110 prefix is the start of the x value
+    int axis = 0;
+    int prefix = -1;
+    while(true) {
+      if(!bits.read(1)) { prefix = 0; break; }
+      if(!bits.read(1)) { prefix = 1; break; }
+      if(!bits.read(1)) { prefix = 2; break; }
+      if(!bits.read(1)) { prefix = 3; break; }
+      int escape = bits.read(2);
+      if(escape==0)
+        tilt = bits.read(8);
+      else if(escape==1)
+        dropped += bits.read(8);
+      else
+        return result; // end of the capture
+    }
+    capture_sample sample;
+    for(axis=0; axis<3; axis++) {
+      if(axis) { // read this axis' prefix (x's was read with the escapes)
+        prefix = 0;
+        while(prefix<3 && bits.read(1))
+          prefix++;
+        if(prefix==3)
+          bits.read(1); // the 0 ending 1110
+      }
+      if(prefix==0) {
+        // unchanged
+      } else if(prefix==1) {
+        last[axis] += bits.read(1) ? -1 : 1;
+      } else if(prefix==2) {
+        int n = bits.read(3);
+        last[axis] += n<4 ? n-5 : n-2;
+      } else {
+        last[axis] = sign_extend6(bits.read(6));
+      }
+      sample.raw[axis] = last[axis];
+    }
+    sample.tilt = tilt;
+    sample.dropped = dropped;
+    dropped = 0;
+    result.samples.push_back(sample);
+  }
+  return result;
+}
+
+#endif // CAPTURE_DECODE_H
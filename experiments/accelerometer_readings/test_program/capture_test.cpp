@@ -0,0 +1,116 @@
+#include <cmath>
+#include <cstring>
+
+#include "replay.h"
+#include "capture_decode.h"
+
+// Runs every recording through the EEPROM capture and the decoder, and checks
+//  that we get the same samples back.
+// usage: capture_test.bin corpus... (see corpus_convert)
+
+extern unsigned char eeprom_data[];
+#define E2END 511 // as in pc_stubs.h
+
+// threshold, in 100ths of a G
+#define TEST_THRESHOLD 30
+// bytes the EEPROM can take per update (a write takes 3.3 ms, an update 8.3)
+#define WRITES_PER_UPDATE 2
+
+int failures = 0;
+
+void check(bool passed, string name, string message) {
+  if(!passed) {
+    cout<<"FAIL: "<<name<<": "<<message<<endl;
+    failures++;
+  }
+}
+
+void test_file(const corpus& recordings, size_t r, int writes_per_update) {
+  string file = string(recordings.label(r))+"/"+recordings.name(r);
+  const corpus_sample* samples = recordings.sample(r);
+  size_t count = recordings.samples(r);
+  if(!count)
+    return;
+  hbtest hb(recordings, r);
+  memset(eeprom_data, 0xFF, E2END+1);
+  hb.start_capture(TEST_THRESHOLD);
+  size_t fed = 0, trigger = count;
+  for(; fed<count && hb.get_capture_state()!=CAPTURE_DONE; fed++) {
+    int vec[3];
+    char raw[3];
+    for(int i=0; i<3; i++) {
+      raw[i] = samples[fed].raw[i];
+      vec[i] = raw[i]*(100/21.3);
+    }
+    hb.fake_read_accelerometer(vec);
+    hb.capture_sample(raw, fed/10); // change the tilt register now and then
+    if(trigger==count && hb.get_capture_state()!=CAPTURE_ARMED)
+      trigger = fed;
+    for(int i=0; i<writes_per_update; i++)
+      hb.capture_write();
+  }
+  if(hb.get_capture_state()==CAPTURE_ARMED) {
+    cout<<file<<": never triggered"<<endl;
+    hb.stop_capture();
+    return;
+  }
+  hb.stop_capture();
+  for(int i=0; i<E2END+1 && hb.get_capture_state()!=CAPTURE_DONE; i++)
+    hb.capture_write();
+  check(hb.get_capture_state()==CAPTURE_DONE, file, "capture never finished writing");
+
+  capture c = decode_capture(vector<unsigned char>(eeprom_data, eeprom_data+E2END+1));
+  check(c.valid, file, "bad header");
+  if(!c.valid)
+    return;
+
+  // walk the decoded samples against the input, skipping any that were dropped
+  int dropped = 0;
+  size_t location = trigger+1-c.pretrigger;
+  for(size_t i=0; i<c.samples.size(); i++) {
+    location += c.samples[i].dropped;
+    dropped += c.samples[i].dropped;
+    if(location>=count) {
+      check(false, file, "decoded more samples than we recorded");
+      break;
+    }
+    bool same = true;
+    for(int j=0; j<3; j++)
+      same = same && c.samples[i].raw[j]==samples[location].raw[j];
+    if(!same) {
+      check(false, file, "sample mismatch");
+      break;
+    }
+    check(c.samples[i].tilt==(int)location/10, file, "tilt mismatch");
+    location++;
+  }
+  int size = 0;
+  for(int i=E2END; i>=0; i--)
+    if(eeprom_data[i]!=0xFF) {
+      size = i+1;
+      break;
+    }
+  cout<<file<<": "<<c.samples.size()<<" samples ("<<c.pretrigger<<" pretrigger, "
+      <<dropped<<" dropped) in "<<size<<" bytes"<<endl;
+}
+
+int main(int argc, char** argv) {
+  for(int i=1; i<argc; i++) {
+    corpus recordings;
+    if(!recordings.open(argv[i])) {
+      check(false, argv[i], "can't read the corpus");
+      continue;
+    }
+    for(size_t r=0; r<recordings.size(); r++) {
+      test_file(recordings, r, WRITES_PER_UPDATE);
+      // a slow EEPROM must drop samples, not corrupt them
+      test_file(recordings, r, 1);
+    }
+  }
+  if(failures) {
+    cout<<failures<<" failures"<<endl;
+    return 1;
+  }
+  cout<<"all capture tests passed"<<endl;
+  return 0;
+}
@@ -0,0 +1,76 @@
+#include "replay.h"
+
+// Runs the clock for a day of updates: seconds follow the real update
+//  length without drifting, and alarms go off once, at their time, one per
+//  update.
+// usage: clock_test.bin
+
+extern unsigned long stub_millis;
+
+#define UPDATES_PER_HOUR 432000L // 120 Hz
+
+int failures = 0;
+
+void check(bool passed, string message) {
+  if(!passed) {
+    cout<<"FAIL: "<<message<<endl;
+    failures++;
+  }
+}
+
+// updates until alarm goes off, or -1 after limit updates
+long updates_until(unsigned char alarm, long limit) {
+  for(long i=1; i<=limit; i++) {
+    hexbright::update_clock();
+    if(hexbright::get_alarm()==alarm)
+      return i;
+  }
+  return -1;
+}
+
+int main(int argc, char** argv) {
+  // update() doesn't run the clock until something uses it
+  stub_millis = 5500;
+  check(hexbright::get_clock()==5 && hexbright::get_clock_millis()==500, "starts from millis()");
+  hexbright::set_clock(0);
+  for(long i=0; i<24*UPDATES_PER_HOUR; i++)
+    hexbright::update_clock();
+  // 24*432000 updates of 8333 us
+  unsigned long long micros = 24ULL*UPDATES_PER_HOUR*8333;
+  check(hexbright::get_clock()==micros/1000000, "a day of updates");
+  check(hexbright::get_clock_millis()==(micros%1000000)/1000, "milliseconds into the second");
+
+  // relative: 10 seconds from a second boundary is 10 seconds of updates
+  hexbright::set_clock(100);
+  hexbright::set_alarm_in(0, 10);
+  check(hexbright::get_alarm_remaining(0)==10, "remaining");
+  long updates = updates_until(0, 2*UPDATES_PER_HOUR);
+  check(updates==(10*1000000L+8332)/8333, "relative alarm on time");
+  check(hexbright::get_alarm_remaining(0)==0, "nothing remaining after it goes off");
+  check(updates_until(0, 2*UPDATES_PER_HOUR)==-1, "an alarm goes off once");
+
+  // absolute, and two at once
+  hexbright::set_clock(0);
+  hexbright::set_alarm(0, 3600);
+  hexbright::set_alarm(1, 3600);
+  updates = updates_until(0, 2*UPDATES_PER_HOUR);
+  check(hexbright::get_clock()==3600, "absolute alarm on time");
+  hexbright::update_clock();
+  check(hexbright::get_alarm()==1, "the second alarm on the next update");
+  hexbright::update_clock();
+  check(hexbright::get_alarm()==ALARM_NONE, "then nothing");
+
+  hexbright::set_alarm_in(1, 0);
+  check(updates_until(1, 1)==1, "an alarm set for now goes off on the next update");
+
+  hexbright::set_alarm_in(1, 5);
+  hexbright::clear_alarm(1);
+  check(updates_until(1, 10*120)==-1, "a cleared alarm doesn't go off");
+
+  if(failures) {
+    cout<<failures<<" failures"<<endl;
+    return 1;
+  }
+  cout<<"all clock tests passed"<<endl;
+  return 0;
+}
@@ -0,0 +1,244 @@
+// The replay corpus: every accelerometer recording in one binary file, mapped
+//  by the host tests and replayed in place instead of parsing the text files.
+//  Build it with corpus_convert.bin (make corpus).
+//
+// Layout (little-endian, every section starts 4-byte aligned):
+//  header      corpus_header
+//  recordings  a corpus_recording for each recording
+//  labels      a string offset (4 bytes) for each label; labels are the
+//              directory names the recordings are sorted into
+//  strings     NUL-terminated, padded to a multiple of 4 bytes
+//  samples     a corpus_sample for each reading, recordings back to back
+// Samples are raw 6-bit counts.  The header's scale (counts per G, times 10)
+//  turns them back into the 1/100ths of a G the text recordings hold.
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CORPUS_VERSION 1
+// MMA7660 counts per G, times 10 (21.3 = 1G)
+#define CORPUS_SCALE 213
+// samples per second of the text recordings (ACC_RATE_120, one per update)
+#define CORPUS_TEXT_RATE 120
+// the tilt register's "unknown" value, for recordings without it
+#define CORPUS_NO_TILT 0
+
+struct corpus_header {
+  char magic[4]; // "HBRC"
+  uint8_t version;
+  uint8_t scale;
+  uint16_t labels;
+  uint32_t recordings;
+  uint32_t string_bytes;
+};
+
+struct corpus_recording {
+  uint32_t first; // index of the first sample
+  uint32_t samples;
+  uint32_t name; // string offset
+  uint16_t label;
+  uint16_t rate; // samples per second
+};
+
+struct corpus_sample {
+  int8_t raw[3]; // 6-bit readings, -32 to 31
+  uint8_t tilt; // tilt register
+};
+
+// a recording before it's written out
+struct corpus_entry {
+  std::string label;
+  std::string name;
+  int rate;
+  std::vector<corpus_sample> samples;
+};
+
+// in 1/100ths of a G, truncated like the text recordings
+inline int corpus_scaled(int raw, int scale) {
+  return raw*1000/scale;
+}
+
+// Reads a text recording ("x/y/z/recorded vector" lines, in 1/100ths of a G).
+//  Returns false if any reading isn't a whole count on this scale; those are
+//  rounded to the nearest count.
+inline bool read_text_recording(std::string file, std::vector<corpus_sample>& samples, int scale=CORPUS_SCALE) {
+  std::ifstream f(file.c_str());
+  std::string line;
+  bool exact = true;
+  while(getline(f, line)) {
+    size_t start = line.find(' ');
+    if(start==std::string::npos || line.find("recorded vector")==std::string::npos)
+      continue;
+    corpus_sample sample;
+    const char* p = line.c_str()+start;
+    for(int i=0; i<3; i++) {
+      char* end;
+      int value = strtol(p, &end, 10);
+      int raw = lround(value*scale/1000.0);
+      raw = raw<-32 ? -32 : raw>31 ? 31 : raw;
+      exact = exact && corpus_scaled(raw, scale)==value;
+      sample.raw[i] = raw;
+      p = *end ? end+1 : end; // past the '/'
+    }
+    sample.tilt = CORPUS_NO_TILT;
+    samples.push_back(sample);
+  }
+  return exact;
+}
+
+inline void corpus_pad(std::vector<char>& bytes) {
+  while(bytes.size()%4)
+    bytes.push_back(0);
+}
+
+// Writes the entries out, labels numbered in order of first use.  Returns
+//  false if the file can't be written.
+inline bool write_corpus(std::string file, const std::vector<corpus_entry>& entries, int scale=CORPUS_SCALE) {
+  std::vector<std::string> labels;
+  std::vector<corpus_recording> recordings;
+  std::vector<char> strings;
+  uint32_t first = 0;
+  for(size_t i=0; i<entries.size(); i++) {
+    corpus_recording r;
+    r.first = first;
+    r.samples = entries[i].samples.size();
+    r.name = strings.size();
+    strings.insert(strings.end(), entries[i].name.begin(), entries[i].name.end());
+    strings.push_back(0);
+    r.label = 0;
+    while(r.label<labels.size() && labels[r.label]!=entries[i].label)
+      r.label++;
+    if(r.label==labels.size())
+      labels.push_back(entries[i].label);
+    r.rate = entries[i].rate;
+    recordings.push_back(r);
+    first += r.samples;
+  }
+  std::vector<uint32_t> label_offsets;
+  for(size_t i=0; i<labels.size(); i++) {
+    label_offsets.push_back(strings.size());
+    strings.insert(strings.end(), labels[i].begin(), labels[i].end());
+    strings.push_back(0);
+  }
+  corpus_pad(strings);
+
+  corpus_header header;
+  memcpy(header.magic, "HBRC", 4);
+  header.version = CORPUS_VERSION;
+  header.scale = scale;
+  header.labels = labels.size();
+  header.recordings = recordings.size();
+  header.string_bytes = strings.size();
+
+  std::ofstream f(file.c_str(), std::ios::binary);
+  f.write((const char*)&header, sizeof(header));
+  if(!recordings.empty())
+    f.write((const char*)&recordings[0], recordings.size()*sizeof(corpus_recording));
+  if(!label_offsets.empty())
+    f.write((const char*)&label_offsets[0], label_offsets.size()*sizeof(uint32_t));
+  if(!strings.empty())
+    f.write(&strings[0], strings.size());
+  for(size_t i=0; i<entries.size(); i++) {
+    if(!entries[i].samples.empty())
+      f.write((const char*)&entries[i].samples[0], entries[i].samples.size()*sizeof(corpus_sample));
+  }
+  return f.good();
+}
+
+// A corpus file, mapped read-only.  Samples are used in place.
+class corpus {
+  const char* data;
+  size_t bytes;
+  const corpus_header* header;
+  const corpus_recording* recordings;
+  const uint32_t* label_offsets;
+  const char* strings;
+  const corpus_sample* sample_data;
+  // one mapping, one owner
+  corpus(const corpus&);
+  corpus& operator=(const corpus&);
+public:
+  corpus() : data(NULL), bytes(0) {}
+  ~corpus() { close(); }
+
+  // maps the file; returns false if it's missing, isn't a corpus, or is cut short
+  bool open(std::string file) {
+    close();
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if(fd<0)
+      return false;
+    struct stat st;
+    if(fstat(fd, &st)==0 && st.st_size>=(off_t)sizeof(corpus_header)) {
+      void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if(mapped!=MAP_FAILED) {
+        data = (const char*)mapped;
+        bytes = st.st_size;
+      }
+    }
+    ::close(fd);
+    if(!data)
+      return false;
+
+    header = (const corpus_header*)data;
+    uint64_t strings_at = sizeof(corpus_header)+(uint64_t)header->recordings*sizeof(corpus_recording)
+      +header->labels*sizeof(uint32_t);
+    uint64_t samples_at = strings_at+header->string_bytes;
+    if(memcmp(header->magic, "HBRC", 4) || header->version!=CORPUS_VERSION || !header->scale
+       || header->string_bytes%4 || samples_at>bytes) {
+      close();
+      return false;
+    }
+    recordings = (const corpus_recording*)(data+sizeof(corpus_header));
+    label_offsets = (const uint32_t*)(recordings+header->recordings);
+    strings = data+strings_at;
+    sample_data = (const corpus_sample*)(data+samples_at);
+
+    uint64_t total = (bytes-samples_at)/sizeof(corpus_sample);
+    if(header->string_bytes && strings[header->string_bytes-1]) {
+      close();
+      return false;
+    }
+    for(uint32_t i=0; i<header->labels; i++) {
+      if(label_offsets[i]>=header->string_bytes) {
+        close();
+        return false;
+      }
+    }
+    for(uint32_t i=0; i<header->recordings; i++) {
+      const corpus_recording& r = recordings[i];
+      if((uint64_t)r.first+r.samples>total || r.label>=header->labels || r.name>=header->string_bytes) {
+        close();
+        return false;
+      }
+    }
+    return true;
+  }
+  void close() {
+    if(data)
+      munmap((void*)data, bytes);
+    data = NULL;
+    bytes = 0;
+  }
+
+  // recordings in the corpus
+  size_t size() const { return data ? header->recordings : 0; }
+  int scale() const { return header->scale; }
+  const char* name(size_t recording) const { return strings+recordings[recording].name; }
+  const char* label(size_t recording) const { return strings+label_offsets[recordings[recording].label]; }
+  int rate(size_t recording) const { return recordings[recording].rate; }
+  size_t samples(size_t recording) const { return recordings[recording].samples; }
+  const corpus_sample* sample(size_t recording) const { return sample_data+recordings[recording].first; }
+};
+
+#endif // CORPUS_H
@@ -0,0 +1,66 @@
+#include <dirent.h>
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+#include "corpus.h"
+
+using namespace std;
+
+// Converts the text recordings (one directory per kind of motion, sample*
+//  files in each) into a replay corpus, labelled with the directory names.
+// usage: corpus_convert.bin output [path to accelerometer_readings]
+
+vector<string> sorted_entries(string directory) {
+  vector<string> names;
+  DIR* dir = opendir(directory.c_str());
+  if(!dir)
+    return names;
+  struct dirent* entry;
+  while((entry = readdir(dir)))
+    names.push_back(entry->d_name);
+  closedir(dir);
+  sort(names.begin(), names.end());
+  return names;
+}
+
+int main(int argc, char** argv) {
+  if(argc<2) {
+    cout<<" usage: "<<argv[0]<<" output [path to accelerometer_readings]"<<endl;
+    return 1;
+  }
+  string root = argc>2 ? argv[2] : "..";
+  vector<corpus_entry> entries;
+  size_t total = 0;
+  vector<string> labels = sorted_entries(root);
+  for(size_t l=0; l<labels.size(); l++) {
+    if(labels[l][0]=='.' || labels[l]=="test_program")
+      continue;
+    vector<string> names = sorted_entries(root+"/"+labels[l]);
+    for(size_t n=0; n<names.size(); n++) {
+      if(names[n].find("sample")!=0)
+        continue;
+      corpus_entry entry;
+      entry.label = labels[l];
+      entry.name = names[n];
+      entry.rate = CORPUS_TEXT_RATE;
+      string file = root+"/"+labels[l]+"/"+names[n];
+      if(!read_text_recording(file, entry.samples)) {
+        cerr<<file<<": readings aren't whole counts (21.3 = 1G)"<<endl;
+        return 1;
+      }
+      total += entry.samples.size();
+      entries.push_back(entry);
+    }
+  }
+  if(entries.empty()) {
+    cerr<<"no recordings found in "<<root<<endl;
+    return 1;
+  }
+  if(!write_corpus(argv[1], entries)) {
+    cerr<<"can't write "<<argv[1]<<endl;
+    return 1;
+  }
+  cout<<argv[1]<<": "<<entries.size()<<" recordings, "<<total<<" samples"<<endl;
+  return 0;
+}
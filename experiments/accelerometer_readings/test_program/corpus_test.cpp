@@ -0,0 +1,115 @@
+#include <cstdio>
+
+#include "replay.h"
+
+// Writes a small corpus, maps it back and replays it, checks that text
+//  recordings convert exactly, and that damaged files are refused.
+// usage: corpus_test.bin
+
+#define TEST_CORPUS "corpus_test.corpus"
+#define TEST_TEXT "corpus_test.txt"
+
+int failures = 0;
+
+void check(bool passed, string message) {
+  if(!passed) {
+    cout<<"FAIL: "<<message<<endl;
+    failures++;
+  }
+}
+
+corpus_entry entry(string label, string name, int samples) {
+  corpus_entry e;
+  e.label = label;
+  e.name = name;
+  e.rate = CORPUS_TEXT_RATE;
+  for(int i=0; i<samples; i++) {
+    corpus_sample s = {{(int8_t)(i-32), (int8_t)(31-i), (int8_t)(i%5)}, (uint8_t)i};
+    e.samples.push_back(s);
+  }
+  return e;
+}
+
+// a copy of the test corpus with its bytes cut or changed
+bool opens_damaged(size_t keep, size_t change) {
+  ifstream in(TEST_CORPUS, ios::binary);
+  string bytes((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+  if(keep<bytes.size())
+    bytes.resize(keep);
+  if(change<bytes.size())
+    bytes[change] ^= 0xFF;
+  ofstream(TEST_CORPUS ".bad", ios::binary)<<bytes;
+  corpus c;
+  bool opened = c.open(TEST_CORPUS ".bad");
+  remove(TEST_CORPUS ".bad");
+  return opened;
+}
+
+int main(int argc, char** argv) {
+  // readings are whole counts, truncated to 1/100ths of a G
+  check(corpus_scaled(31, CORPUS_SCALE)==145, "scale 31");
+  check(corpus_scaled(-30, CORPUS_SCALE)==-140, "scale -30");
+  check(corpus_scaled(21, CORPUS_SCALE)==98, "scale 1G");
+  ofstream(TEST_TEXT)<<"# a comment\n\n91.48: 23/-28/84/recorded vector\n145.00: 0/145/-140/recorded vector\n";
+  vector<corpus_sample> samples;
+  check(read_text_recording(TEST_TEXT, samples), "text readings are exact");
+  check(samples.size()==2, "two readings");
+  if(samples.size()==2) {
+    check(samples[0].raw[0]==5 && samples[0].raw[1]==-6 && samples[0].raw[2]==18, "first reading");
+    check(samples[1].raw[0]==0 && samples[1].raw[1]==31 && samples[1].raw[2]==-30, "second reading");
+    check(samples[0].tilt==CORPUS_NO_TILT, "no tilt in text");
+  }
+  ofstream(TEST_TEXT)<<"100.00: 0/0/100/recorded vector\n";
+  samples.clear();
+  check(!read_text_recording(TEST_TEXT, samples), "100 isn't a whole count");
+  remove(TEST_TEXT);
+
+  vector<corpus_entry> entries;
+  entries.push_back(entry("fall", "sample01", 10));
+  entries.push_back(entry("spin", "sample01", 0));
+  entries.push_back(entry("fall", "sample02", 64));
+  check(write_corpus(TEST_CORPUS, entries), "write");
+
+  {
+    corpus c;
+    check(c.open(TEST_CORPUS), "open");
+    check(c.size()==3, "recordings");
+    if(c.size()==3) {
+      check(string(c.label(0))=="fall" && string(c.label(1))=="spin" && string(c.label(2))=="fall", "labels");
+      check(string(c.name(2))=="sample02", "names");
+      check(c.rate(0)==CORPUS_TEXT_RATE, "rate");
+      check(c.samples(0)==10 && c.samples(1)==0 && c.samples(2)==64, "sample counts");
+      check(c.sample(2)[63].raw[0]==31 && c.sample(2)[63].raw[1]==-32 && c.sample(2)[63].tilt==63, "sample data");
+      check(c.sample(2)==c.sample(0)+10, "samples are back to back");
+
+      hbtest hb(c, 2);
+      int replayed = 0;
+      while(hb.data_exists()) {
+        hb.read_accelerometer();
+        replayed++;
+      }
+      check(replayed==64, "replay every sample");
+      hbtest empty(c, 1);
+      check(!empty.data_exists(), "an empty recording");
+    }
+  }
+
+  corpus c;
+  check(!c.open("no such corpus"), "a missing file");
+  check(c.size()==0, "nothing when closed");
+  check(opens_damaged(100000, 100000), "an undamaged copy opens");
+  check(!opens_damaged(100000, 0), "bad magic");
+  check(!opens_damaged(100000, 4), "bad version");
+  check(!opens_damaged(sizeof(corpus_header)+3*sizeof(corpus_recording), 100000), "cut in the index");
+  ifstream in(TEST_CORPUS, ios::binary | ios::ate);
+  size_t size = in.tellg();
+  check(!opens_damaged(size-1, size), "cut in the samples");
+  remove(TEST_CORPUS);
+
+  if(failures) {
+    cout<<failures<<" failures"<<endl;
+    return 1;
+  }
+  cout<<"all corpus tests passed"<<endl;
+  return 0;
+}
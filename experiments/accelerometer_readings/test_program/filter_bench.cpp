@@ -0,0 +1,162 @@
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+
+#include "replay.h"
+
+// Runs every recording through each reading filter and prints a comparison:
+//  rest jitter  RMS change between outputs while the light is still; this
+//               is what makes a resting light look like it's moving.
+//  motion error RMS difference from a centered 3-sample average of the raw
+//               readings while moving (the best a filter could hope for,
+//               without seeing the future).
+//  step 1G      samples until the output is within 10% of a 1G step.
+//  dead band    the largest offset from a constant input the filter never
+//               closes (integer filters round small corrections to 0).
+//  peak loss    how much of each recording's peak magnitude is filtered
+//               away, on average (impact detection wants this near 0).
+//  host ns      time per call on this machine, for relative cost only; see
+//               tests/filter_benchmark for AVR cycles.
+// All but host ns are in 1/100ths of a G.
+// usage: filter_bench.bin [corpus, see corpus_convert]
+
+struct filter_info {
+  unsigned char id;
+  const char* name;
+};
+
+filter_info filters[] = {
+  {FILTER_NONE,     "none"},
+  {FILTER_LOW_PASS, "low_pass_filter"},
+  {FILTER_STDEV,    "stdev_filter"},
+  {FILTER_STDEV2,   "stdev_filter2"},
+  {FILTER_STDEV3,   "stdev_filter3"},
+  {FILTER_STEP,     "step_filter"},
+};
+#define NUM_FILTERS (int)(sizeof(filters)/sizeof(filters[0]))
+
+// a still light: every axis within one raw step over +/- REST_WINDOW samples
+#define REST_WINDOW 4
+#define REST_RANGE 5
+
+typedef vector<vector<int> > recording;
+
+recording load(const corpus& recordings, size_t r) {
+  recording data(recordings.samples(r), vector<int>(3));
+  const corpus_sample* samples = recordings.sample(r);
+  for(size_t i=0; i<data.size(); i++)
+    for(int axis=0; axis<3; axis++)
+      data[i][axis] = corpus_scaled(samples[i].raw[axis], recordings.scale());
+  return data;
+}
+
+bool at_rest(const recording& data, size_t i) {
+  if(i<REST_WINDOW || i+REST_WINDOW>=data.size())
+    return false;
+  for(int axis=0; axis<3; axis++) {
+    int low = data[i][axis], high = low;
+    for(size_t j=i-REST_WINDOW; j<=i+REST_WINDOW; j++) {
+      low = min(low, data[j][axis]);
+      high = max(high, data[j][axis]);
+    }
+    if(high-low>REST_RANGE)
+      return false;
+  }
+  return true;
+}
+
+double magnitude(const vector<int>& v) {
+  return sqrt((double)v[0]*v[0]+v[1]*v[1]+v[2]*v[2]);
+}
+
+recording run(unsigned char filter, const recording& data) {
+  recording out(data.size(), vector<int>(3));
+  for(size_t i=0; i<data.size(); i++)
+    for(int axis=0; axis<3; axis++)
+      out[i][axis] = i ? hexbright::run_filter(filter, out[i-1][axis], data[i][axis]) : data[i][axis];
+  return out;
+}
+
+int step_samples(unsigned char filter, int size) {
+  int estimate = 0;
+  for(int i=1; i<100; i++) {
+    estimate = hexbright::run_filter(filter, estimate, size);
+    if(abs(estimate-size)<=size/10)
+      return i;
+  }
+  return 100;
+}
+
+int dead_band(unsigned char filter) {
+  int band = 0;
+  for(int size=-20; size<=20; size++) {
+    int estimate = 0;
+    for(int i=0; i<100; i++)
+      estimate = hexbright::run_filter(filter, estimate, size);
+    band = max(band, abs(estimate-size));
+  }
+  return band;
+}
+
+double host_ns(unsigned char filter, const vector<recording>& data) {
+  volatile int sink = 0;
+  long calls = 0;
+  clock_t start = clock();
+  for(int pass=0; pass<20; pass++)
+    for(size_t r=0; r<data.size(); r++)
+      for(size_t i=1; i<data[r].size(); i++, calls++)
+        sink += hexbright::run_filter(filter, data[r][i-1][0], data[r][i][0]);
+  return (clock()-start)*1e9/CLOCKS_PER_SEC/calls;
+}
+
+int main(int argc, char** argv) {
+  string file = argc>1 ? argv[1] : "recordings.corpus";
+  corpus recordings;
+  if(!recordings.open(file)) {
+    cout<<"can't read the corpus "<<file<<" (make corpus)"<<endl;
+    return 1;
+  }
+  vector<recording> data;
+  for(size_t r=0; r<recordings.size(); r++)
+    data.push_back(load(recordings, r));
+  if(data.empty()) {
+    cout<<"no recordings found in "<<file<<endl;
+    return 1;
+  }
+
+  printf("%d recordings\n\n", (int)data.size());
+  printf("| filter          | rest jitter | motion error | step 1G | dead band | peak loss | host ns |\n");
+  printf("|-----------------|-------------|--------------|---------|-----------|-----------|---------|\n");
+  for(int f=0; f<NUM_FILTERS; f++) {
+    double rest_sum = 0, motion_sum = 0, peak_loss = 0;
+    long rest_count = 0, motion_count = 0;
+    for(size_t r=0; r<data.size(); r++) {
+      const recording& raw = data[r];
+      recording out = run(filters[f].id, raw);
+      double raw_peak = 0, out_peak = 0;
+      for(size_t i=1; i+1<raw.size(); i++) {
+        raw_peak = max(raw_peak, magnitude(raw[i]));
+        out_peak = max(out_peak, magnitude(out[i]));
+        bool rest = at_rest(raw, i);
+        for(int axis=0; axis<3; axis++) {
+          if(rest) {
+            double d = out[i][axis]-out[i-1][axis];
+            rest_sum += d*d;
+            rest_count++;
+          } else {
+            double reference = (raw[i-1][axis]+raw[i][axis]+raw[i+1][axis])/3.0;
+            double d = out[i][axis]-reference;
+            motion_sum += d*d;
+            motion_count++;
+          }
+        }
+      }
+      peak_loss += raw_peak-out_peak;
+    }
+    printf("| %-15s | %11.2f | %12.2f | %7d | %9d | %9.1f | %7.1f |\n", filters[f].name,
+           sqrt(rest_sum/max(rest_count, 1L)), sqrt(motion_sum/max(motion_count, 1L)),
+           step_samples(filters[f].id, 100), dead_band(filters[f].id),
+           peak_loss/data.size(), host_ns(filters[f].id, data));
+  }
+  return 0;
+}
@@ -0,0 +1,70 @@
+#include "replay.h"
+
+// Runs the rear led layers through adjust_leds: the highest layer that's in
+//  use is shown, hidden layers keep counting, a layer that's waiting keeps
+//  its led dark, and a number being printed holds both leds.
+// usage: leds_test.bin
+
+extern unsigned char led_shown[2];
+extern unsigned char leds_lit;
+
+int failures = 0;
+
+void check(bool passed, string message) {
+  if(!passed) {
+    cout<<"FAIL: "<<message<<endl;
+    failures++;
+  }
+}
+
+void updates(int count) {
+  for(int i=0; i<count; i++) {
+    hexbright::adjust_leds();
+    hexbright::update_number();
+  }
+}
+
+BOOL lit(unsigned char led) {
+  return (leds_lit>>led)&1;
+}
+
+int main(int argc, char** argv) {
+  // 600 ms on, 600 ms off (72 updates each)
+  hexbright::set_led(GLED, 600, 600, 255, LED_STATUS);
+  updates(1);
+  check(led_shown[GLED]==LED_STATUS && lit(GLED), "the status layer alone");
+  check(led_shown[RLED]==LED_LAYERS && !lit(RLED), "nothing on the red led");
+
+  hexbright::set_led(GLED, 100, 100, 64);
+  updates(1);
+  check(led_shown[GLED]==LED_SKETCH && lit(GLED), "set_led is over the status layer");
+  updates(12);
+  check(led_shown[GLED]==LED_SKETCH && !lit(GLED), "waiting keeps the led dark");
+  updates(13);
+  check(led_shown[GLED]==LED_STATUS && lit(GLED), "back to the status layer");
+  check(hexbright::get_led_state(GLED)==LED_OFF, "the sketch layer is done");
+  updates(72-26);
+  check(led_shown[GLED]==LED_STATUS && !lit(GLED), "the status layer kept counting");
+  check(hexbright::get_led_state(GLED, LED_STATUS)==LED_WAIT, "the status layer's state");
+
+  // a number holds both leds, even between flashes
+  hexbright::set_led(GLED, 2000, 0, 255, LED_STATUS);
+  hexbright::set_led(RLED, 2000, 0, 255, LED_SKETCH);
+  hexbright::print_number(10);
+  updates(2); // update_number runs after adjust_leds, as in update()
+  check(led_shown[GLED]==LED_PRINT && lit(GLED), "first digit");
+  check(led_shown[RLED]==LED_PRINT && !lit(RLED), "the other led is held");
+  updates(50);
+  check(led_shown[GLED]==LED_PRINT && !lit(GLED), "between digits");
+  while(hexbright::printing_number())
+    updates(1);
+  updates(1);
+  check(led_shown[GLED]==LED_LAYERS && led_shown[RLED]==LED_LAYERS, "the layers below ran out while we printed");
+
+  if(failures) {
+    cout<<failures<<" failures"<<endl;
+    return 1;
+  }
+  cout<<"all led tests passed"<<endl;
+  return 0;
+}
@@ -0,0 +1,100 @@
+#include "replay.h"
+
+// Runs a small mode table through set_modes: the first matching transition
+//  wins, MODE_ANY and MODE_PREVIOUS work, handlers run in order (exit, level,
+//  enter), timeouts fire once per entry, and handlers can change modes.
+// usage: modes_test.bin
+
+extern unsigned long stub_millis;
+
+int failures = 0;
+
+void check(bool passed, string message) {
+  if(!passed) {
+    cout<<"FAIL: "<<message<<endl;
+    failures++;
+  }
+}
+
+#define MODE_OFF 0
+#define MODE_ON 1
+#define MODE_FLASH 2
+#define MODE_BOUNCE 3
+
+string calls;
+
+void on_enter() { calls += "enter on,"; }
+void on_exit() { calls += "exit on,"; }
+void flash_enter() { calls += "enter flash,"; }
+void bounce_enter() { hexbright::set_mode(MODE_ON); }
+
+const mode_state modes[] = {
+  // level        change time  timeout  flags  enter         tick  exit
+  {OFF_LEVEL,     NOW,         0,       0,     NULL,         NULL, NULL},    // MODE_OFF
+  {600,           NOW,         500,     0,     on_enter,     NULL, on_exit}, // MODE_ON
+  {CURRENT_LEVEL, NOW,         0,       0,     flash_enter,  NULL, NULL},    // MODE_FLASH
+  {CURRENT_LEVEL, NOW,         0,       0,     bounce_enter, NULL, NULL},    // MODE_BOUNCE
+};
+
+const mode_transition transitions[] = {
+  {MODE_OFF,   EVENT_CLICK,   MODE_ON},
+  {MODE_ON,    EVENT_CLICK,   MODE_ON}, // before the MODE_ANY below
+  {MODE_ON,    EVENT_TIMEOUT, MODE_OFF},
+  {MODE_ANY,   EVENT_HOLD,    MODE_FLASH},
+  {MODE_FLASH, EVENT_RELEASE, MODE_PREVIOUS},
+  {MODE_ANY,   EVENT_CLICK,   MODE_OFF},
+  {MODE_ANY,   EVENT_TWIST,   MODE_BOUNCE},
+  {MODE_END, EVENT_NONE, MODE_END}
+};
+
+// an update with no button or motion activity
+unsigned char idle_event() {
+  return hexbright::next_mode_event();
+}
+
+int main(int argc, char** argv) {
+  hexbright::set_modes(modes, transitions);
+  check(hexbright::get_mode()==MODE_OFF, "start in mode 0");
+  check(hexbright::get_light_level()!=OFF_LEVEL, "mode 0's level isn't applied at start");
+
+  hexbright::handle_mode_event(EVENT_CLICK);
+  check(hexbright::get_mode()==MODE_ON, "click from off");
+  check(hexbright::get_light_level()==600, "level on entry");
+  check(calls=="enter on,", "enter runs");
+
+  calls = "";
+  hexbright::handle_mode_event(EVENT_CLICK);
+  check(hexbright::get_mode()==MODE_ON, "first matching transition wins");
+  check(calls=="exit on,enter on,", "a self transition exits and enters");
+
+  hexbright::handle_mode_event(EVENT_HOLD);
+  check(hexbright::get_mode()==MODE_FLASH, "MODE_ANY matches");
+  check(hexbright::get_light_level()==600, "CURRENT_LEVEL leaves the light alone");
+  hexbright::handle_mode_event(EVENT_RELEASE);
+  check(hexbright::get_mode()==MODE_ON, "MODE_PREVIOUS");
+
+  hexbright::handle_mode_event(EVENT_DROP);
+  check(hexbright::get_mode()==MODE_ON, "an event without a transition");
+  check(hexbright::get_mode_event()==EVENT_DROP, "the event is visible to handlers");
+
+  // timeouts are measured from entry, and only fire once
+  stub_millis += 499;
+  check(idle_event()==EVENT_NONE, "no timeout early");
+  stub_millis += 1;
+  check(idle_event()==EVENT_TIMEOUT, "timeout");
+  check(idle_event()==EVENT_NONE, "timeout only once");
+  hexbright::set_mode(MODE_ON);
+  stub_millis += 500;
+  check(idle_event()==EVENT_TIMEOUT, "timeout again after entering again");
+  check(hexbright::get_mode_time()==500, "time in mode");
+
+  hexbright::handle_mode_event(EVENT_TWIST);
+  check(hexbright::get_mode()==MODE_ON, "enter can change modes");
+
+  if(failures) {
+    cout<<failures<<" failures"<<endl;
+    return 1;
+  }
+  cout<<"all modes tests passed"<<endl;
+  return 0;
+}
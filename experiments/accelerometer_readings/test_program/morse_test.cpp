@@ -0,0 +1,110 @@
+#include "replay.h"
+
+// Sends text through update_morse and reads the on/off timing back as
+//  morse: '.' and '-' for elements, a space between characters and " / "
+//  between words.
+// usage: morse_test.bin
+
+extern int led_on_time[LED_LAYERS][2];
+
+#define UPDATE_MS 8.3333333
+
+int failures = 0;
+
+void check(bool passed, string message) {
+  if(!passed) {
+    cout<<"FAIL: "<<message<<endl;
+    failures++;
+  }
+}
+
+// on and off runs, in dots, as morse
+string decode(const vector<bool>& on, int dot) {
+  string out;
+  size_t i = 0;
+  while(i<on.size()) {
+    size_t run = 1;
+    while(i+run<on.size() && on[i+run]==on[i])
+      run++;
+    if(on[i])
+      out += run==dot ? "." : run==3*dot ? "-" : "?";
+    else if(i+run<on.size()) // ignore the silence at the end
+      out += run==dot ? "" : run==3*dot ? " " : run==7*dot ? " / " : "?";
+    i += run;
+  }
+  return out;
+}
+
+// updates until we're done sending, or limit updates
+vector<bool> run(unsigned char output, long limit=100000) {
+  vector<bool> on;
+  int led_left = 0;
+  for(long i=0; i<limit && hexbright::printing_morse(); i++) {
+    hexbright::update_morse();
+    if(output==MORSE_LIGHT) {
+      on.push_back(hexbright::get_light_level()>0);
+    } else {
+      // what adjust_leds would do
+      if(led_on_time[LED_PRINT][output]>0) {
+        led_left = led_on_time[LED_PRINT][output];
+        led_on_time[LED_PRINT][output] = -1;
+      }
+      on.push_back(led_left-->0);
+    }
+  }
+  return on;
+}
+
+int dot(unsigned char wpm) {
+  return (int)(1200/UPDATE_MS/wpm);
+}
+
+void check_morse(const char* text, unsigned char output, string expected) {
+  hexbright::print_morse(text, output, 12);
+  string got = decode(run(output), dot(12));
+  check(got==expected, string(text)+": expected '"+expected+"', got '"+got+"'");
+}
+
+int main(int argc, char** argv) {
+  check_morse("SOS", MORSE_LIGHT, "... --- ...");
+  check_morse("sos", RLED, "... --- ...");
+  check_morse("Hi 73", GLED, ".... .. / --... ...--");
+  check_morse("A, b?", MORSE_LIGHT, ".- --..-- / -... ..--..");
+  // unknown characters are skipped
+  check_morse("E#T", MORSE_LIGHT, ". -");
+
+  // a 150 ms dot at 8 words per minute, repeated with a word between
+  hexbright::print_morse_P("SOS", MORSE_LIGHT, 8, MAX_LEVEL, 2);
+  vector<bool> on = run(MORSE_LIGHT);
+  check(dot(8)==18, "8 wpm");
+  check(decode(on, dot(8))=="... --- ... / ... --- ...", "repeated");
+
+  // slower than 4 wpm would overflow the word gap; 0 isn't a speed
+  hexbright::print_morse("E E", MORSE_LIGHT, 1);
+  check(decode(run(MORSE_LIGHT), dot(4))==". / .", "1 wpm is sent at 4");
+  hexbright::print_morse("E E", MORSE_LIGHT, 255);
+  check(decode(run(MORSE_LIGHT), 1)==". / .", "255 wpm is sent with a dot of one update");
+  hexbright::print_morse("E", MORSE_LIGHT, 0);
+  check(!hexbright::printing_morse(), "0 wpm sends nothing");
+
+  // position and stopping
+  hexbright::print_morse("ET", MORSE_LIGHT, 12, 500, 0);
+  hexbright::update_morse();
+  check(hexbright::get_light_level()==500, "level");
+  check(hexbright::get_morse_position()==0, "sending E");
+  for(int i=0; i<4*dot(12); i++)
+    hexbright::update_morse();
+  check(hexbright::get_morse_position()==1, "sending T");
+  run(MORSE_LIGHT, 1000);
+  check(hexbright::printing_morse(), "sends until stopped");
+  hexbright::stop_morse();
+  check(!hexbright::printing_morse() && hexbright::get_morse_position()==-1, "stopped");
+  check(hexbright::get_light_level()==0, "the light is off when stopped");
+
+  if(failures) {
+    cout<<failures<<" failures"<<endl;
+    return 1;
+  }
+  cout<<"all morse tests passed"<<endl;
+  return 0;
+}
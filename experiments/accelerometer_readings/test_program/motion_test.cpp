@@ -0,0 +1,175 @@
+#include <cmath>
+#include <algorithm>
+
+#include "replay.h"
+
+// Replays every recording through the rotation tracker and the drop, impact
+//  and twist detectors, in the same order update() runs them, and checks the
+//  events we get against what each directory is a recording of.
+// usage: motion_test.bin [corpus, see corpus_convert]
+
+// a landing should register at least 1.5 Gs
+#define IMPACT_TEST_MINIMUM 150
+// rotation without a twist (noise, a flick of the tail cap), in 1/256ths of a turn
+#define ROTATION_TEST_NOISE 4
+
+struct motion_counts {
+  int drops;
+  int impacts;
+  int twists;
+  int twist_degrees;
+  int peak;
+  int rotation; // 1/256ths of a turn
+};
+
+motion_counts replay_motion(const corpus& recordings, size_t recording) {
+  hbtest hb(recordings, recording);
+  motion_counts counts = {0, 0, 0, 0, 0, 0};
+  // the detectors keep state between recordings; let them settle on the
+  //  first reading before we start counting.
+  for(int i=0; i<30; i++) {
+    hb.hold_accelerometer();
+    hb.find_down();
+    hb.track_rotation();
+    hb.detect_motion();
+  }
+  hb.reset_rotation();
+  // each recording ends at rest; hold the last reading for a quarter
+  //  second so events that fire once we stop moving get reported.
+  int hold = 30;
+  while (hb.data_exists() || hold--) {
+    hb.read_accelerometer();
+    hb.find_down();
+    hb.track_rotation();
+    hb.detect_motion();
+    switch(hb.get_motion_event()) {
+    case ACCEL_DROP:
+      counts.drops++;
+      break;
+    case ACCEL_IMPACT:
+      counts.impacts++;
+      counts.peak = max(counts.peak, hb.get_motion_value());
+      break;
+    case ACCEL_TWIST:
+      counts.twists++;
+      counts.twist_degrees += hb.get_motion_value();
+      break;
+    }
+  }
+  counts.rotation = hb.get_rotation();
+  return counts;
+}
+
+int failures = 0;
+
+void check(bool passed, string name, string message) {
+  if(!passed) {
+    cout<<"FAIL: "<<name<<": "<<message<<endl;
+    failures++;
+  }
+}
+
+#define ANY 0
+#define EXPECT 1
+#define FORBID 2
+#define CLOCKWISE 3
+#define COUNTERCLOCKWISE 4
+
+// Not every recording is clean (a fall that was half caught, a spin fast
+//  enough to alias), so expected events only need to show up in most samples.
+//  Forbidden events must never show up.
+#define EXPECTED_PERCENT 70
+
+void check_count(int expectation, int found, int total, string name, string event) {
+  if(expectation==EXPECT)
+    check(found*100>=total*EXPECTED_PERCENT, name, event+" detected in too few samples");
+  else if(expectation==FORBID)
+    check(found==0, name, "false "+event);
+}
+
+// binary_atan2 against the real thing, over every vector we can read
+void test_binary_atan2() {
+  int worst = 0;
+  for(int x=-150; x<=150; x++) {
+    for(int y=-150; y<=150; y++) {
+      if(!x && !y)
+        continue;
+      double expected = atan2((double)y, (double)x)*128/M_PI;
+      int error = abs((char)(hexbright::binary_atan2(y, x)-(unsigned char)lround(expected)));
+      worst = max(worst, error);
+    }
+  }
+  cout<<"binary_atan2: worst error "<<worst<<"/256 of a turn"<<endl;
+  check(worst<=1, "binary_atan2", "more than 1/256 of a turn off");
+}
+
+void test_directory(const corpus& recordings, string name, int drop, int impact, int twist) {
+  vector<size_t> files;
+  for(size_t i=0; i<recordings.size(); i++) {
+    if(recordings.label(i)==name)
+      files.push_back(i);
+  }
+  check(!files.empty(), name, "no samples found");
+  int drops=0, impacts=0, twists=0, clockwise=0, counterclockwise=0;
+  int rotated=0, rotated_clockwise=0, rotated_counterclockwise=0;
+  for(size_t i=0; i<files.size(); i++) {
+    motion_counts counts = replay_motion(recordings, files[i]);
+    cout<<name<<"/"<<recordings.name(files[i])<<": drops "<<counts.drops<<", impacts "<<counts.impacts
+        <<" (peak "<<counts.peak<<"), twists "<<counts.twists
+        <<" ("<<counts.twist_degrees<<" degrees), rotation "<<counts.rotation*360/256<<" degrees"<<endl;
+    drops += counts.drops>0;
+    impacts += counts.impacts>0 && counts.peak>=IMPACT_TEST_MINIMUM;
+    twists += counts.twists>0;
+    clockwise += counts.twist_degrees>0;
+    counterclockwise += counts.twist_degrees<0;
+    rotated += abs(counts.rotation)>ROTATION_TEST_NOISE;
+    rotated_clockwise += counts.rotation>ROTATION_TEST_NOISE;
+    rotated_counterclockwise += counts.rotation<-ROTATION_TEST_NOISE;
+  }
+  check_count(drop, drops, files.size(), name, "drop");
+  check_count(impact, impacts, files.size(), name, "impact");
+  if(twist==CLOCKWISE) {
+    check_count(EXPECT, clockwise, files.size(), name, "clockwise twist");
+    check_count(EXPECT, rotated_clockwise, files.size(), name, "clockwise rotation");
+  } else if(twist==COUNTERCLOCKWISE) {
+    check_count(EXPECT, counterclockwise, files.size(), name, "counterclockwise twist");
+    check_count(EXPECT, rotated_counterclockwise, files.size(), name, "counterclockwise rotation");
+  } else {
+    check_count(twist, twists, files.size(), name, "twist");
+    if(twist==FORBID && drop==FORBID) // sitting still, the rotation should too
+      check_count(FORBID, rotated, files.size(), name, "rotation");
+  }
+}
+
+int main(int argc, char** argv) {
+  string file = argc>1 ? argv[1] : "recordings.corpus";
+  corpus recordings;
+  if(!recordings.open(file)) {
+    cout<<"can't read the corpus "<<file<<" (make corpus)"<<endl;
+    return 1;
+  }
+  test_binary_atan2();
+  //             corpus      label                                     drop    impact  twist
+  test_directory(recordings, "no spin 30 inch fall",                   EXPECT, EXPECT, ANY);
+  test_directory(recordings, "spinning counterclockwise 30 inch fall", EXPECT, EXPECT, ANY);
+  test_directory(recordings, "tail cap flick, noise",                  FORBID, FORBID, FORBID);
+  test_directory(recordings, "spin clockwise slow",                    FORBID, FORBID, CLOCKWISE);
+  // medium samples 03, 05 and 06 come out counterclockwise: 03 and 06 pass
+  //  vertical and come back 105 and 126 steps (of 256) away, which is closer
+  //  backwards, and 05 reads 1.6 Gs in the middle of the spin.
+  test_directory(recordings, "spin clockwise medium",                  FORBID, FORBID, CLOCKWISE);
+  // a flick saturates x and z (the angle sits at about 225) and then reads
+  //  its own deceleration, so 13 of the 20 samples end up counterclockwise;
+  //  all we can check is that it isn't a drop.
+  test_directory(recordings, "spin clockwise fast (flick)",            FORBID, FORBID, ANY);
+  test_directory(recordings, "90 degree swing to the right",           FORBID, FORBID, ANY);
+  // these were tossed and caught, so they are short drops
+  test_directory(recordings, "180 degree flips",                       EXPECT, ANY,    ANY);
+
+  if(failures) {
+    cout<<failures<<" failures"<<endl;
+    return 1;
+  }
+  cout<<"all motion tests passed"<<endl;
+  return 0;
+}
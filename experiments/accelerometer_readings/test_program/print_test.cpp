@@ -0,0 +1,101 @@
+#include "replay.h"
+
+// Plays numbers out through update_number and spells the flashes back as
+//  text: r/g for a short flash, R/G for a long one (a zero or the sign), and
+//  a space between digits.
+// usage: print_test.bin
+
+extern int led_on_time[LED_LAYERS][2];
+
+#define UPDATE_MS 8.3333333
+
+int failures = 0;
+
+void check(bool passed, string message) {
+  if(!passed) {
+    cout<<"FAIL: "<<message<<endl;
+    failures++;
+  }
+}
+
+// updates until the number is done, or limit updates
+string flashes(long limit=100000) {
+  string out;
+  long last = -1;
+  int long_flash = 400/UPDATE_MS;
+  for(long i=0; i<limit && hexbright::printing_number(); i++) {
+    hexbright::update_number();
+    for(int led=0; led<2; led++) {
+      if(led_on_time[LED_PRINT][led]>0) {
+        // more than a flash apart is a new digit
+        if(last>=0 && i-last>300/UPDATE_MS)
+          out += " ";
+        last = i;
+        char c = led==RLED ? 'r' : 'g';
+        out += led_on_time[LED_PRINT][led]>=long_flash ? c-'a'+'A' : c;
+        led_on_time[LED_PRINT][led] = -1;
+      }
+    }
+  }
+  return out;
+}
+
+string printed(long number, unsigned char base=10) {
+  hexbright::print_number(number, base);
+  return flashes();
+}
+
+void check_print(long number, unsigned char base, string expected) {
+  string got = printed(number, base);
+  ostringstream message;
+  message<<number<<" in base "<<(int)base<<": expected '"<<expected<<"', got '"<<got<<"'";
+  check(got==expected, message.str());
+}
+
+int main(int argc, char** argv) {
+  check_print(120, 10, "r gg R");
+  check_print(0, 10, "R");
+  check_print(-1, 10, "G r");
+  check_print(-101, 10, "G r G r");
+  check_print(1000000, 10, "r G R G R G R");
+  check_print(2147483647, 10, "gg r gggg rrrrrrr gggg rrrrrrrr ggg rrrrrr gggg rrrrrrr");
+  check_print(-2147483648L, 10, "R gg r gggg rrrrrrr gggg rrrrrrrr ggg rrrrrr gggg rrrrrrrr");
+  check_print(0x1F, 16, "g rrrrrrrrrrrrrrr");
+  check_print(-0x10, 16, "R g R");
+  check_print(5, 2, "r G r");
+  check_print(0, 2, "R");
+
+  // the sign is on longer than a zero: 500 and 400 ms
+  hexbright::print_number(-10);
+  check(led_on_time[LED_PRINT][RLED]>=(int)(480/UPDATE_MS), "the sign is longer than a zero");
+  check(flashes()=="R g R", "-10");
+
+  // repeats, with the pause between
+  hexbright::print_number(7, 10, 3);
+  check(flashes()=="rrrrrrr rrrrrrr rrrrrrr", "printed three times");
+  hexbright::print_number(7, 10, 0);
+  // about 8 times through
+  check(flashes(5000).size()>=6*8, "printed until reset");
+  check(hexbright::printing_number(), "still printing");
+  hexbright::reset_print_number();
+  check(flashes()=="", "reset stops it");
+
+  // faster timing takes fewer updates and prints the same thing
+  hexbright::set_print_timing(150, 300, 1000);
+  hexbright::print_number(-120);
+  long updates = 0;
+  while(hexbright::printing_number()) {
+    hexbright::update_number();
+    updates++;
+  }
+  // sign, 1, 2 (two flashes), zero, then the pause
+  check(updates<=(300+300+150+300+300+1000)/UPDATE_MS+5, "faster timing");
+  hexbright::set_print_timing(300, 600, 2500);
+
+  if(failures) {
+    cout<<failures<<" failures"<<endl;
+    return 1;
+  }
+  cout<<"all print tests passed"<<endl;
+  return 0;
+}
@@ -0,0 +1,70 @@
+// Replays recorded accelerometer samples through the hexbright library.
+//  Shared by the programs in this directory.
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <cstdlib>
+
+#include "../../../libraries/hexbright/hexbright.h"
+#include "corpus.h"
+
+using namespace std;
+
+
+class hbtest : public hexbright {
+private:
+  std::vector<corpus_sample> loaded; // a text recording's samples
+  const corpus_sample* samples;
+  size_t count;
+  int scale;
+  size_t accelerometer_location;
+
+  void feed(size_t location) {
+    int data[3];
+    for(int i=0; i<3; i++)
+      data[i] = corpus_scaled(samples[location].raw[i], scale);
+    hexbright::fake_read_accelerometer(data);
+  }
+  void start() {
+    accelerometer_location = 0;
+    // pre-load accelerometer buffers
+    if(count) {
+      for(int i=0; i<4; i++)
+        feed(0);
+    }
+  }
+public:
+  // replays a text recording
+  hbtest(string file) : scale(CORPUS_SCALE) {
+    if(!read_text_recording(file, loaded))
+      cerr<<file<<": readings aren't whole counts, replaying them rounded"<<endl;
+    samples = loaded.empty() ? NULL : &loaded[0];
+    count = loaded.size();
+    start();
+  }
+  // replays a recording from a mapped corpus, in place
+  hbtest(const corpus& recordings, size_t recording)
+    : samples(recordings.sample(recording)), count(recordings.samples(recording)), scale(recordings.scale()) {
+    start();
+  }
+  // feed the current reading without advancing, as if the light were held still
+  void hold_accelerometer() {
+    if(count)
+      feed(accelerometer_location<count ? accelerometer_location : count-1);
+  }
+  // once we run out of data, the last reading is repeated
+  void read_accelerometer() {
+    hold_accelerometer();
+    accelerometer_location++;
+  }
+  bool data_exists() {
+    return accelerometer_location<count;
+  }
+};
+
+#endif // REPLAY_H
@@ -0,0 +1,155 @@
+#include <cstring>
+
+#include "replay.h"
+
+// Exercises the settings ring: values survive a reboot, writes are spread
+//  over the ring, and losing power part way through a write leaves us with
+//  either the old or the new value.  The charge counter is kept there too.
+// usage: settings_test.bin
+
+#define E2END 511 // as in pc_stubs.h
+#define SLOTS ((EEPROM_SETTINGS_END-EEPROM_SETTINGS-1)/4)
+extern unsigned char eeprom_data[];
+extern unsigned long eeprom_writes[];
+extern word settings_dirty;
+extern unsigned char settings_head;
+extern unsigned char setting_slots[];
+extern unsigned long charge_used;
+extern unsigned long charge_used_check;
+extern unsigned char settings_job;
+
+int failures = 0;
+
+void check(bool passed, string message) {
+  if(!passed) {
+    cout<<"FAIL: "<<message<<endl;
+    failures++;
+  }
+}
+
+// RAM is cleared, EEPROM isn't
+void reboot() {
+  settings_dirty = 0;
+  settings_job = 0xFF;
+  hexbright::load_settings();
+}
+
+void save() {
+  while(!hexbright::settings_saved())
+    hexbright::write_settings();
+}
+
+int main(int argc, char** argv) {
+  // left over sketch data
+  memset(eeprom_data, 0, E2END+1);
+  reboot();
+  check(hexbright::get_setting(0, 150)==150, "default on a fresh ring");
+
+  hexbright::set_setting(0, 600);
+  hexbright::set_setting(1, -1);
+  hexbright::set_setting(7, 1000);
+  check(hexbright::get_setting(0, 150)==600, "value before it's saved");
+  save();
+  reboot();
+  check(hexbright::get_setting(0, 150)==600, "value after a reboot");
+  check(hexbright::get_setting(1, 0)==-1, "negative value after a reboot");
+  check(hexbright::get_setting(7, 0)==1000, "last id after a reboot");
+  check(hexbright::get_setting(2, 42)==42, "unset id after a reboot");
+
+  // a level saved on every click, for a long time
+  memset(eeprom_writes, 0, sizeof(unsigned long)*(E2END+1));
+  const int saves = 10000;
+  for(int i=0; i<saves; i++) {
+    hexbright::set_setting(0, i%1000);
+    save();
+    if(i%97==0) {
+      reboot();
+      check(hexbright::get_setting(0, -1)==i%1000, "level after many saves");
+      check(hexbright::get_setting(1, 0)==-1 && hexbright::get_setting(7, 0)==1000,
+            "other settings after many saves");
+    }
+  }
+  unsigned long worst = 0;
+  for(int i=EEPROM_SETTINGS; i<EEPROM_SETTINGS_END; i++)
+    worst = max(worst, eeprom_writes[i]);
+  cout<<saves<<" saves: at most "<<worst<<" writes to one byte"<<endl;
+  // 31 slots, 3 of them in use and 2 empty; the id byte is written twice a
+  //  pass (emptied, then written), and the other settings get copied forward
+  check(worst*10<(unsigned long)saves, "writes aren't spread over the ring");
+  for(int i=0; i<E2END+1; i++)
+    check(!eeprom_writes[i] || (i>=EEPROM_SETTINGS && i<EEPROM_SETTINGS_END),
+          "wrote outside the ring");
+
+  // lose power after each step of a write
+  for(int steps=0; steps<6; steps++) {
+    int before = hexbright::get_setting(0, -1);
+    hexbright::set_setting(0, before+1);
+    for(int i=0; i<steps; i++)
+      hexbright::write_settings();
+    reboot();
+    int after = hexbright::get_setting(0, -1);
+    check(after==before || after==before+1, "a torn write gave us something new");
+    check(steps<5 || after==before+1, "a finished write was lost");
+    check(hexbright::get_setting(1, 0)==-1 && hexbright::get_setting(7, 0)==1000,
+          "a torn write lost another setting");
+  }
+
+  // lose power after each step of copying another setting forward, before
+  //  its only record is emptied
+  hexbright::set_setting(5, 1234);
+  save();
+  for(int steps=0; steps<6; steps++) {
+    while(setting_slots[5]!=(settings_head+2)%SLOTS) {
+      hexbright::set_setting(0, hexbright::get_setting(0, 0)+1);
+      save();
+    }
+    int before = hexbright::get_setting(0, -1);
+    hexbright::set_setting(0, before+1);
+    for(int i=0; i<steps; i++)
+      hexbright::write_settings();
+    reboot();
+    check(hexbright::get_setting(5, -1)==1234, "a torn copy lost the setting");
+    check(hexbright::get_setting(0, -1)==before, "a torn copy wrote the wrong setting");
+    check(hexbright::get_setting(1, 0)==-1 && hexbright::get_setting(7, 0)==1000,
+          "a torn copy lost another setting");
+  }
+
+  // ids past SETTING_IDS aren't kept
+  hexbright::set_setting(SETTING_IDS, 99);
+  check(hexbright::get_setting(SETTING_IDS, 7)==7, "an id out of range");
+
+  // every id in use still fits
+  for(int id=0; id<SETTING_IDS; id++)
+    hexbright::set_setting(id, id*100);
+  save();
+  for(int i=0; i<200; i++) {
+    hexbright::set_setting(3, i);
+    save();
+  }
+  reboot();
+  for(int id=0; id<SETTING_IDS; id++)
+    check(hexbright::get_setting(id, -1)==(id==3 ? 199 : id*100), "a full set of ids after wrapping");
+
+  // the charge used, saved every time we turn off
+  memset(eeprom_writes, 0, sizeof(unsigned long)*(E2END+1));
+  for(int i=0; i<1000; i++) {
+    charge_used = 256L*i+37; // 1/256ths of a mAh
+    hexbright::save_charge_used();
+    save();
+  }
+  charge_used_check = 0; // a power cut
+  reboot();
+  hexbright::load_charge_used();
+  check(charge_used==256L*999+32, "charge used after a power cut, to 1/16th of a mAh");
+  check(hexbright::get_setting(3, -1)==199, "the charge used took a sketch's id");
+  for(int i=0; i<E2END+1; i++)
+    check(!eeprom_writes[i] || (i>=EEPROM_SETTINGS && i<EEPROM_SETTINGS_END),
+          "saved the charge used outside the ring");
+
+  if(failures) {
+    cout<<failures<<" failures"<<endl;
+    return 1;
+  }
+  cout<<"all settings tests passed"<<endl;
+  return 0;
+}
@@ -0,0 +1,59 @@
+#include <cstdio>
+#include <iostream>
+#include <iterator>
+
+#include "telemetry_decode.h"
+
+using namespace std;
+
+// Reads a DEBUG_TELEMETRY capture (raw bytes from the serial port) from
+//  stdin and prints it as csv, a row per update.  Columns are the fields in
+//  the first frame; updates missing between frames (dropped when the buffer
+//  was full) are reported on stderr.
+// usage: telemetry_decode.bin < telemetry.bin > telemetry.csv
+
+int main(int argc, char** argv) {
+  cin>>noskipws;
+  vector<unsigned char> data((istream_iterator<unsigned char>(cin)), istream_iterator<unsigned char>());
+  telemetry_stream stream = decode_telemetry(data);
+  if(stream.records.empty()) {
+    cerr<<"no telemetry frames found"<<endl;
+    return 1;
+  }
+  if(stream.skipped)
+    cerr<<stream.skipped<<" bytes outside of frames skipped"<<endl;
+
+  int fields = stream.records[0].fields;
+  bool first = true;
+  for(int i=0; i<TELEMETRY_DECODE_FIELDS; i++) {
+    if(fields&(1<<i)) {
+      printf("%s%s", first ? "" : ",", telemetry_field_names[i]);
+      first = false;
+    }
+  }
+  printf("\n");
+
+  int dropped = 0;
+  for(size_t i=0; i<stream.records.size(); i++) {
+    telemetry_record& r = stream.records[i];
+    if(r.fields!=fields)
+      continue; // set_telemetry changed mid-capture; keep to the first columns
+    if(i && (fields&0x01))
+      dropped += ((r.tick-stream.records[i-1].tick)&0xFFFF)-1;
+    int values[] = {r.tick, r.level, r.max_level, r.temperature, r.band_gap, r.charge, r.accel[0], r.button};
+    first = true;
+    for(int j=0; j<TELEMETRY_DECODE_FIELDS; j++) {
+      if(!(fields&(1<<j)))
+        continue;
+      if(j==6)
+        printf("%s%d,%d,%d", first ? "" : ",", r.accel[0], r.accel[1], r.accel[2]);
+      else
+        printf("%s%d", first ? "" : ",", values[j]);
+      first = false;
+    }
+    printf("\n");
+  }
+  if(dropped)
+    cerr<<dropped<<" updates dropped"<<endl;
+  return 0;
+}
@@ -0,0 +1,90 @@
+// Decodes a DEBUG_TELEMETRY stream (see TELEMETRY in hexbright.h for the
+//  frame format) into records.  Bytes that aren't part of a good frame (a
+//  capture started mid-frame, line noise) are skipped.
+#ifndef TELEMETRY_DECODE_H
+#define TELEMETRY_DECODE_H
+
+#include <vector>
+
+#define TELEMETRY_DECODE_SYNC 0xA5
+#define TELEMETRY_DECODE_FIELDS 8
+
+// in frame order: the field's bit is 1<<index
+static const char* const telemetry_field_names[TELEMETRY_DECODE_FIELDS] = {
+  "tick", "level", "max_level", "temperature", "band_gap", "charge", "accel_x,accel_y,accel_z", "button"};
+static const int telemetry_field_sizes[TELEMETRY_DECODE_FIELDS] = {2, 2, 2, 2, 2, 1, 6, 1};
+
+struct telemetry_record {
+  int fields; // TELEMETRY_* bits present
+  int tick;
+  int level;
+  int max_level;
+  int temperature;
+  int band_gap;
+  int charge;
+  int accel[3];
+  int button;
+};
+
+struct telemetry_stream {
+  std::vector<telemetry_record> records;
+  int skipped; // bytes outside of good frames
+};
+
+inline int telemetry_frame_length(int fields) {
+  int length = 3; // sync, fields, checksum
+  for(int i=0; i<TELEMETRY_DECODE_FIELDS; i++) {
+    if(fields&(1<<i))
+      length += telemetry_field_sizes[i];
+  }
+  return length;
+}
+
+inline int telemetry_int(const unsigned char* bytes) {
+  return (short)(bytes[0] | (bytes[1]<<8));
+}
+
+inline telemetry_stream decode_telemetry(const std::vector<unsigned char>& data) {
+  telemetry_stream result;
+  result.skipped = 0;
+  size_t i = 0;
+  while(i<data.size()) {
+    if(data[i]!=TELEMETRY_DECODE_SYNC || i+1>=data.size()) {
+      result.skipped++;
+      i++;
+      continue;
+    }
+    int fields = data[i+1];
+    size_t length = telemetry_frame_length(fields);
+    if(i+length>data.size()) { // cut off at the end
+      result.skipped += data.size()-i;
+      break;
+    }
+    unsigned char sum = 0;
+    for(size_t j=1; j<length-1; j++)
+      sum += data[i+j];
+    if(sum!=data[i+length-1]) { // not a frame after all; look for the next sync
+      result.skipped++;
+      i++;
+      continue;
+    }
+    telemetry_record r = {fields, 0, 0, 0, 0, 0, 0, {0, 0, 0}, 0};
+    const unsigned char* p = &data[i+2];
+    if(fields&0x01) { r.tick = telemetry_int(p) & 0xFFFF; p += 2; }
+    if(fields&0x02) { r.level = telemetry_int(p); p += 2; }
+    if(fields&0x04) { r.max_level = telemetry_int(p); p += 2; }
+    if(fields&0x08) { r.temperature = telemetry_int(p); p += 2; }
+    if(fields&0x10) { r.band_gap = telemetry_int(p); p += 2; }
+    if(fields&0x20) { r.charge = *p++; }
+    if(fields&0x40) {
+      for(int axis=0; axis<3; axis++, p += 2)
+        r.accel[axis] = telemetry_int(p);
+    }
+    if(fields&0x80) { r.button = *p++; }
+    result.records.push_back(r);
+    i += length;
+  }
+  return result;
+}
+
+#endif // TELEMETRY_DECODE_H
@@ -0,0 +1,80 @@
+#include "replay.h"
+#include "telemetry_decode.h"
+
+// Builds frames with the library's telemetry_frame and checks the decoder
+//  gets the readings back: all fields, a few, and a stream with noise and a
+//  damaged frame in it.
+// usage: telemetry_test.bin
+
+extern word loopCount;
+
+int failures = 0;
+
+void check(bool passed, string message) {
+  if(!passed) {
+    cout<<"FAIL: "<<message<<endl;
+    failures++;
+  }
+}
+
+void add_frame(vector<unsigned char>& stream) {
+  unsigned char frame[TELEMETRY_FRAME_MAX];
+  unsigned char length = hexbright::telemetry_frame(frame);
+  check(length<=TELEMETRY_FRAME_MAX, "frame fits TELEMETRY_FRAME_MAX");
+  check(length==telemetry_frame_length(frame[1]), "frame length");
+  stream.insert(stream.end(), frame, frame+length);
+}
+
+int main(int argc, char** argv) {
+  int reading[3] = {-150, 20, 99};
+  for(int i=0; i<20; i++) // through the filter
+    hexbright::fake_read_accelerometer(reading);
+  hexbright::set_light(0, 750, NOW);
+  loopCount = 65534;
+
+  vector<unsigned char> stream;
+  add_frame(stream);
+  telemetry_stream decoded = decode_telemetry(stream);
+  check(decoded.records.size()==1 && !decoded.skipped, "one frame");
+  telemetry_record r = decoded.records[0];
+  check(r.fields==TELEMETRY_ALL, "all fields");
+  check(r.tick==65534, "tick");
+  check(r.level==750, "level");
+  check(r.max_level==MAX_LEVEL, "max level");
+  check(r.temperature==hexbright::get_thermal_sensor(), "temperature");
+  check(r.charge==hexbright::get_charge_state(), "charge");
+  int* v = hexbright::vector(0);
+  check(r.accel[0]==v[0] && r.accel[1]==v[1] && r.accel[2]==v[2], "accelerometer");
+
+  // a few fields, the tick wrapping
+  hexbright::set_telemetry(TELEMETRY_TICK|TELEMETRY_LEVEL);
+  stream.clear();
+  for(int i=0; i<3; i++) {
+    add_frame(stream);
+    loopCount++;
+  }
+  check(stream.size()==3*7, "small frames");
+  decoded = decode_telemetry(stream);
+  check(decoded.records.size()==3, "three frames");
+  check(decoded.records[1].tick==65535 && decoded.records[2].tick==0, "tick wraps");
+
+  // noise before, a damaged frame, a sync byte in the noise
+  vector<unsigned char> noisy;
+  noisy.push_back(0x12);
+  noisy.push_back(TELEMETRY_SYNC);
+  noisy.push_back(0x34);
+  noisy.insert(noisy.end(), stream.begin(), stream.end());
+  noisy[3+7+3]++; // the second frame's level
+  decoded = decode_telemetry(noisy);
+  check(decoded.records.size()==2, "the damaged frame is dropped");
+  check(decoded.records.size()==2 && decoded.records[1].tick==0, "and we find the next one");
+  check(decoded.skipped==3+7, "skipped bytes");
+  hexbright::set_telemetry(TELEMETRY_ALL);
+
+  if(failures) {
+    cout<<failures<<" failures"<<endl;
+    return 1;
+  }
+  cout<<"all telemetry tests passed"<<endl;
+  return 0;
+}
@@ -1,81 +1,6 @@
-#include <iostream>
-#include <fstream>
-#include <string>
-#include <sstream>
-#include <vector>
-#include <cstdlib>
+#include <cstdio>
 
-#include "../../../libraries/hexbright/hexbright.h"
-
-using namespace std;
-
-
-std::vector<std::string> &split(const std::string &s, char delim, std::vector<std::string> &elems) {
-    std::stringstream ss(s);
-    std::string item;
-    while(std::getline(ss, item, delim)) {
-        elems.push_back(item);
-    }
-    return elems;
-}
-
-
-std::vector<std::string> split(const std::string &s, char delim) {
-    std::vector<std::string> elems;
-    return split(s, delim, elems);
-}
-
-class hbtest : public hexbright {
-private:
-  std::vector<std::vector<int> > accelerometer_data;
-  int accelerometer_location;
-public:
-  hbtest(string file) {
-    accelerometer_data = std::vector<std::vector<int> >();
-    accelerometer_location = 0;
-
-    // read accelerometer_data from file
-    ifstream f;
-    string line;
-    f.open(file.c_str());
-    while(!f.eof()) {
-      getline(f, line);
-      if(line.find("recorded vector")==string::npos) {
-        continue;
-      } else {
-        std::vector<string> tmp;
-        tmp = split(line, ' ');
-        tmp = split(tmp[1], '/');
-        std::vector<int> vec;
-        
-        for(int i=0; i<3; i++) {
-          vec.push_back(atoi(tmp[i].c_str()));
-        }
-        accelerometer_data.push_back(vec);
-      }
-    }
-
-    // reset accelerometer_location
-    accelerometer_location = 0;
-
-    // pre-load accelerometer buffers
-    int * data = &(accelerometer_data[accelerometer_location])[0];
-    hexbright::fake_read_accelerometer(data);
-    hexbright::fake_read_accelerometer(data);
-    hexbright::fake_read_accelerometer(data);
-    hexbright::fake_read_accelerometer(data);
-  }
-  void read_accelerometer() {
-    int * data = &(accelerometer_data[accelerometer_location])[0];
-    hexbright::fake_read_accelerometer(data);
-    accelerometer_location++;
-  }
-  bool data_exists() {
-    if(accelerometer_location<accelerometer_data.size())
-      return true;
-    return false;
-  }
-};
+#include "replay.h"
 
 
 void test_accelerometer(string file) {
@@ -89,6 +14,7 @@ void test_accelerometer(string file) {
     string vec0 = vector_buffer;
     sprintf(vector_buffer, "\t    %4d %4d %4d", hb.down()[0], hb.down()[1], hb.down()[2]);
     string down = vector_buffer;
+    hb.track_rotation();
     cout<<(int)hb.get_spin()<<"\t"<<(int)hb.magnitude(hb.vector(0))<<vec0<<down<<endl;
     //cout<<(int)hb.magnitude(hb.vector(0))<<endl;
     spinned += hb.get_spin();
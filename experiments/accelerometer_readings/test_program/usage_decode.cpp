@@ -0,0 +1,49 @@
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "usage_decode.h"
+
+using namespace std;
+
+// Reads a usage dump (print_usage() in a DEBUG build: "USAGE", hex
+//  bytes, then "DONE") from stdin and prints the counters and the event log.
+// usage: usage_decode.bin < dump
+
+int main(int argc, char** argv) {
+  vector<unsigned char> data;
+  string word;
+  while(cin>>word && word!="USAGE")
+    ; // anything else the light printed
+  while(cin>>word) {
+    if(word=="DONE")
+      break;
+    data.push_back(strtol(word.c_str(), NULL, 16));
+  }
+
+  usage_stats stats = decode_usage(data);
+  if(!stats.valid) {
+    cerr<<"no usage statistics (bad checksums)"<<endl;
+    return 1;
+  }
+  printf("boots: %d\n", stats.boots);
+  unsigned long total = 0;
+  for(int i=0; i<USAGE_DECODE_LEVELS; i++)
+    total += stats.seconds[i];
+  for(int i=0; i<USAGE_DECODE_LEVELS; i++) {
+    printf("levels %4d-%4d: %7.1f hours (%.0f%%)\n", i*250, i*250+249+(i==USAGE_DECODE_LEVELS-1),
+           stats.seconds[i]/3600.0, total ? stats.seconds[i]*100.0/total : 0);
+  }
+  printf("overheats: %d\n", stats.overheats);
+  printf("low battery: %d\n", stats.low_battery);
+  printf("charges: %d\n", stats.charges);
+  printf("max temperature: %d C\n", stats.max_celsius);
+  const char* names[] = {"", "overheat", "low battery", "charged"};
+  const char* units[] = {"", "C", "level/4", "mAh/16"};
+  for(size_t i=0; i<stats.log.size(); i++) {
+    usage_event& e = stats.log[i];
+    printf("boot %5d: %s (%d %s)\n", e.boot, names[e.type], e.value, units[e.type]);
+  }
+  return 0;
+}
@@ -0,0 +1,78 @@
+// Decodes the usage statistics (see USAGE_STATS in hexbright.cpp for the
+//  format) from the bytes at EEPROM_USAGE up to EEPROM_SETTINGS.
+#ifndef USAGE_DECODE_H
+#define USAGE_DECODE_H
+
+#include <vector>
+
+#define USAGE_DECODE_LEVELS 4
+#define USAGE_DECODE_SIZE 28
+#define USAGE_DECODE_LOG_SIZE 10
+
+struct usage_event {
+  int type; // 1: overheat, 2: low battery, 3: charged
+  int value; // celsius, light level/4, mAh used/16
+  int boot;
+};
+
+struct usage_stats {
+  bool valid;
+  int copy; // the newer good copy
+  int sequence;
+  int boots;
+  unsigned long seconds[USAGE_DECODE_LEVELS]; // with the light on, by quarter of MAX_LEVEL
+  int overheats;
+  int low_battery;
+  int charges;
+  int max_celsius;
+  std::vector<usage_event> log; // oldest first
+};
+
+inline int usage_word(const std::vector<unsigned char>& data, int address) {
+  return data[address] | (data[address+1]<<8);
+}
+
+// the same as hexbright::eeprom_checksum
+inline bool usage_copy_valid(const std::vector<unsigned char>& data, int address) {
+  unsigned char checksum = 0x5A;
+  for(int i=0; i<USAGE_DECODE_SIZE-1; i++)
+    checksum += data[address+i];
+  return (unsigned char)(checksum^0xA5)==data[address+USAGE_DECODE_SIZE-1];
+}
+
+inline usage_stats decode_usage(const std::vector<unsigned char>& data) {
+  usage_stats result;
+  result.valid = false;
+  if(data.size()<2*USAGE_DECODE_SIZE+USAGE_DECODE_LOG_SIZE*4)
+    return result;
+  for(int copy=0; copy<2; copy++) {
+    int address = copy*USAGE_DECODE_SIZE;
+    if(!usage_copy_valid(data, address))
+      continue;
+    if(result.valid && (signed char)(data[address]-result.sequence)<=0)
+      continue;
+    result.valid = true;
+    result.copy = copy;
+    result.sequence = data[address];
+    result.boots = usage_word(data, address+1);
+    for(int i=0; i<USAGE_DECODE_LEVELS; i++)
+      result.seconds[i] = usage_word(data, address+3+i*4) | ((unsigned long)usage_word(data, address+5+i*4)<<16);
+    result.overheats = usage_word(data, address+19);
+    result.low_battery = usage_word(data, address+21);
+    result.charges = usage_word(data, address+23);
+    result.max_celsius = (signed char)data[address+25];
+  }
+  if(!result.valid)
+    return result;
+  // from the next entry to write (the oldest) around to the newest
+  int head = data[result.copy*USAGE_DECODE_SIZE+26];
+  for(int i=0; i<USAGE_DECODE_LOG_SIZE; i++) {
+    int address = 2*USAGE_DECODE_SIZE+((head+i)%USAGE_DECODE_LOG_SIZE)*4;
+    usage_event event = {data[address], data[address+1], usage_word(data, address+2)};
+    if(event.type>=1 && event.type<=3)
+      result.log.push_back(event);
+  }
+  return result;
+}
+
+#endif // USAGE_DECODE_H
@@ -0,0 +1,162 @@
+#include <cstring>
+
+#include "replay.h"
+#include "usage_decode.h"
+
+// Runs the usage statistics through a few sessions: time and events are
+//  counted, survive a reboot, come back out of the decoder, losing power
+//  part way through a write keeps the last copy, and a busy light doesn't
+//  write any more often.
+// usage: usage_test.bin
+
+#define E2END 511 // as in pc_stubs.h
+extern unsigned char eeprom_data[];
+extern unsigned long eeprom_writes[];
+extern int overheat_reading;
+extern int thermal_filtered;
+extern unsigned char battery_remaining;
+extern unsigned char charge_state;
+// RAM state, cleared by a reboot
+extern unsigned char usage_queued;
+extern unsigned char usage_flags;
+extern unsigned char usage_copy;
+extern int usage_step;
+extern unsigned long usage_timer;
+extern word usage_ticks[];
+
+#define UPDATES_PER_MINUTE (120*60)
+#define WRITES_PER_UPDATE 2 // bytes the EEPROM can take per update
+
+int failures = 0;
+
+void check(bool passed, string message) {
+  if(!passed) {
+    cout<<"FAIL: "<<message<<endl;
+    failures++;
+  }
+}
+
+// RAM is cleared, EEPROM isn't
+void reboot() {
+  usage_queued = 0;
+  usage_flags = 0;
+  usage_copy = 1;
+  usage_step = -1;
+  usage_timer = 0;
+  for(int i=0; i<4; i++)
+    usage_ticks[i] = 0;
+  hexbright::load_usage();
+}
+
+usage_stats decode() {
+  vector<unsigned char> data(eeprom_data+EEPROM_USAGE, eeprom_data+EEPROM_SETTINGS);
+  return decode_usage(data);
+}
+
+void run(int updates) {
+  for(int i=0; i<updates; i++) {
+    hexbright::update_usage();
+    for(int j=0; j<WRITES_PER_UPDATE; j++)
+      hexbright::write_usage();
+  }
+}
+
+unsigned long writes() {
+  unsigned long total = 0;
+  for(int i=0; i<=E2END; i++)
+    total += eeprom_writes[i];
+  return total;
+}
+
+int main(int argc, char** argv) {
+  memset(eeprom_data, 0xFF, E2END+1);
+  hexbright::load_temperature_calibration(); // the defaults
+  overheat_reading = 30000; // never
+  thermal_filtered = (153+3*40)<<3; // about 40C with the default calibration
+  charge_state = 0x77; // BATTERY
+
+  reboot();
+  hexbright::set_light(600, 600, NOW);
+  run(UPDATES_PER_MINUTE);
+  hexbright::flush_usage();
+  usage_stats stats = decode();
+  check(stats.valid, "no copy after the first session");
+  check(stats.boots==1, "boots after the first session");
+  check(stats.seconds[2]==60 && !stats.seconds[0] && !stats.seconds[1] && !stats.seconds[3],
+        "a minute at level 600");
+  check(stats.max_celsius>=35 && stats.max_celsius<=45, "max temperature");
+
+  reboot();
+  check(decode().boots==1, "a boot is written before we turn off");
+  hexbright::set_light(100, 100, NOW);
+  run(UPDATES_PER_MINUTE);
+  // overheat, cool down, overheat again: two events
+  for(int i=0; i<2; i++) {
+    overheat_reading = 0;
+    run(10);
+    overheat_reading = 30000;
+    run(10);
+  }
+  battery_remaining = 0;
+  run(10);
+  battery_remaining = 255; // above any reserve
+  charge_state = 0x11; // CHARGING
+  run(10);
+  charge_state = 0x33; // CHARGED
+  run(10);
+  charge_state = 0x77;
+  hexbright::flush_usage();
+  stats = decode();
+  check(stats.boots==2, "boots after a reboot");
+  check(stats.seconds[0]==60 && stats.seconds[2]==60, "time after a reboot");
+  check(stats.overheats==2 && stats.low_battery==1 && stats.charges==1, "event counts");
+  check(stats.log.size()==4, "log entries");
+  int types[] = {1, 1, 2, 3};
+  for(size_t i=0; i<stats.log.size() && i<4; i++)
+    check(stats.log[i].type==types[i] && stats.log[i].boot==2, "log entry order");
+
+  // an hour, overheating every other second: a write every 10 minutes
+  reboot();
+  hexbright::set_light(1000, 1000, NOW);
+  unsigned long before = writes();
+  int overheats = stats.overheats;
+  for(int i=0; i<1800; i++) {
+    overheat_reading = 0;
+    run(120);
+    overheat_reading = 30000;
+    run(120);
+  }
+  unsigned long written = writes()-before;
+  cout<<"an hour of overheats: "<<written<<" bytes written"<<endl;
+  // 6 intervals: a copy (28 bytes) and 4 log entries (4 bytes) each
+  check(written<=6*(28+4*4), "writes aren't bounded");
+  hexbright::flush_usage();
+  stats = decode();
+  check(stats.overheats==overheats+1800, "overheats counted past the log");
+  check(stats.seconds[3]==3600, "an hour at level 1000");
+  check(stats.log.size()==10, "a full log");
+
+  // lose power after each byte of a write
+  for(int steps=0; steps<2*USAGE_DECODE_SIZE; steps++) {
+    reboot();
+    int boots = decode().boots;
+    run(UPDATES_PER_MINUTE);
+    usage_timer = 72000; // the interval is up
+    hexbright::update_usage();
+    for(int i=0; i<steps; i++)
+      hexbright::write_usage();
+    stats = decode();
+    check(stats.valid, "a torn write lost both copies");
+    check(stats.boots==boots || stats.boots==boots+1, "a torn write gave us something new");
+  }
+
+  for(int i=0; i<=E2END; i++)
+    check(!eeprom_writes[i] || (i>=EEPROM_USAGE && i<EEPROM_SETTINGS), "wrote outside the usage block");
+
+  if(failures) {
+    cout<<failures<<" failures"<<endl;
+    return 1;
+  }
+  cout<<"all usage tests passed"<<endl;
+  return 0;
+}
@@ -0,0 +1,182 @@
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include <iostream>
+
+using namespace std;
+
+// Fits the thermal model in hexbright.cpp (THERMAL_MODEL) to logs from
+//  tests/thermal_log, and prints the #defines to paste back in.
+// usage: fit_thermal.bin thermal-*.log
+//
+// The model: the sensor's rise above ambient is a first order lag of the
+//  light level, with time constant 2^TAU_SHIFT updates and a steady state
+//  rise of RISE at MAX_LEVEL.  For a given time constant the predicted
+//  reading is linear in the rise and in each log's ambient reading, so we
+//  solve those by least squares and try every time constant.
+
+#define UPDATE_MS 8.333
+#define MAX_LEVEL 1000
+#define LOOKAHEAD 600 // THERMAL_MODEL_LOOKAHEAD, in updates
+#define MIN_TAU_SHIFT 8
+#define MAX_TAU_SHIFT 18
+
+struct sample {
+  long ms;
+  int level; // averaged since the previous sample
+  int filtered; // 1/8ths of a reading
+};
+
+vector<vector<sample> > logs;
+
+void read_log(const char* name) {
+  FILE* file = fopen(name, "r");
+  if(!file) {
+    cerr<<"can't open "<<name<<endl;
+    return;
+  }
+  vector<sample> samples;
+  char line[128];
+  while(fgets(line, sizeof(line), file)) {
+    sample s;
+    int predicted;
+    // headers, DONE, terminal program noise...
+    if(sscanf(line, "%ld, %d, %d, %d", &s.ms, &s.level, &s.filtered, &predicted)<3)
+      continue;
+    if(!samples.empty() && s.ms<=samples.back().ms) {
+      // the light was reset; start a new run
+      logs.push_back(samples);
+      samples.clear();
+    }
+    samples.push_back(s);
+  }
+  fclose(file);
+  if(!samples.empty())
+    logs.push_back(samples);
+}
+
+// the model's response to the levels of one run, for a rise of 1 at MAX_LEVEL
+vector<double> response(const vector<sample>& samples, int tau_shift) {
+  vector<double> model(samples.size());
+  double state = 0; // each run starts at ambient
+  double tau = 1<<tau_shift;
+  for(size_t i=0; i<samples.size(); i++) {
+    if(i) {
+      double updates = (samples[i].ms-samples[i-1].ms)/UPDATE_MS;
+      double target = samples[i].level/(double)MAX_LEVEL;
+      state = target+(state-target)*pow(1-1/tau, updates);
+    }
+    model[i] = state;
+  }
+  return model;
+}
+
+struct fit {
+  double rise;
+  double rms; // in 1/8ths of a reading
+};
+
+fit fit_rise(int tau_shift) {
+  // center each run on its own mean, which takes care of its ambient
+  double sum_my = 0, sum_mm = 0;
+  vector<vector<double> > models;
+  for(size_t r=0; r<logs.size(); r++) {
+    vector<double> model = response(logs[r], tau_shift);
+    double mean_m = 0, mean_y = 0;
+    for(size_t i=0; i<model.size(); i++) {
+      mean_m += model[i];
+      mean_y += logs[r][i].filtered;
+    }
+    mean_m /= model.size();
+    mean_y /= model.size();
+    for(size_t i=0; i<model.size(); i++) {
+      sum_my += (model[i]-mean_m)*(logs[r][i].filtered-mean_y);
+      sum_mm += (model[i]-mean_m)*(model[i]-mean_m);
+    }
+    models.push_back(model);
+  }
+  fit result = {sum_mm>0 ? sum_my/sum_mm : 0, 0};
+  double error = 0;
+  int count = 0;
+  for(size_t r=0; r<logs.size(); r++) {
+    double ambient = 0;
+    for(size_t i=0; i<models[r].size(); i++)
+      ambient += logs[r][i].filtered-result.rise*models[r][i];
+    ambient /= models[r].size();
+    for(size_t i=0; i<models[r].size(); i++) {
+      double e = logs[r][i].filtered-(ambient+result.rise*models[r][i]);
+      error += e*e;
+      count++;
+    }
+  }
+  result.rms = count ? sqrt(error/count) : 0;
+  return result;
+}
+
+// how well do we know the reading LOOKAHEAD updates from now, with and
+//  without the model?  Runs the model the way the library does.
+void check_lookahead(long rise, int tau_shift) {
+  double plain = 0, predicted = 0;
+  int count = 0;
+  for(size_t r=0; r<logs.size(); r++) {
+    const vector<sample>& samples = logs[r];
+    long model = 0;
+    vector<int> pending(samples.size());
+    for(size_t i=0; i<samples.size(); i++) {
+      if(i) {
+        long updates = lround((samples[i].ms-samples[i-1].ms)/UPDATE_MS);
+        long target = (long)samples[i].level*rise/MAX_LEVEL;
+        for(long u=0; u<updates; u++)
+          model += ((target<<16)-model)>>tau_shift;
+        pending[i] = ((target-(model>>16))*LOOKAHEAD)>>tau_shift;
+      }
+    }
+    size_t ahead = 0;
+    for(size_t i=0; i<samples.size(); i++) {
+      while(ahead<samples.size() && (samples[ahead].ms-samples[i].ms)<LOOKAHEAD*UPDATE_MS)
+        ahead++;
+      if(ahead==samples.size())
+        break;
+      double e = samples[ahead].filtered-samples[i].filtered;
+      plain += e*e;
+      e -= pending[i];
+      predicted += e*e;
+      count++;
+    }
+  }
+  if(!count)
+    return;
+  printf("reading %.1f seconds ahead, rms error in 1/8ths of a reading:\n", LOOKAHEAD*UPDATE_MS/1000);
+  printf("  current reading: %.2f\n", sqrt(plain/count));
+  printf("  with the model:  %.2f\n", sqrt(predicted/count));
+}
+
+int main(int argc, char** argv) {
+  for(int i=1; i<argc; i++)
+    read_log(argv[i]);
+  size_t count = 0;
+  for(size_t r=0; r<logs.size(); r++)
+    count += logs[r].size();
+  if(count<2) {
+    cerr<<"usage: fit_thermal.bin thermal-*.log (logs from tests/thermal_log)"<<endl;
+    return 1;
+  }
+  printf("%d runs, %d samples\n", (int)logs.size(), (int)count);
+  printf("tau shift, seconds, rise, rms error\n");
+  int best_shift = MIN_TAU_SHIFT;
+  fit best = fit_rise(best_shift);
+  for(int shift=MIN_TAU_SHIFT; shift<=MAX_TAU_SHIFT; shift++) {
+    fit f = fit_rise(shift);
+    printf("%9d, %7.0f, %4.0f, %.2f\n", shift, (1<<shift)*UPDATE_MS/1000, f.rise, f.rms);
+    if(f.rms<best.rms) {
+      best = f;
+      best_shift = shift;
+    }
+  }
+  long rise = lround(best.rise);
+  printf("\n");
+  check_lookahead(rise, best_shift);
+  printf("\n#define THERMAL_MODEL_RISE %ld\n", rise);
+  printf("#define THERMAL_MODEL_TAU_SHIFT %d\n", best_shift);
+  return 0;
+}
@@ -0,0 +1,401 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "../../libraries/hexbright/hexbright.h"
+
+using namespace std;
+
+// Reads the discharge logs in one pass (memory doesn't grow with the logs),
+//  prints statistics for each state of the R/N/F cycle (see README.md), and
+//  writes the sag resistance and discharge curve the BATTERY section of
+//  hexbright.cpp uses.
+// usage: discharge_analyze.bin [-o battery_tables.h] discharge-*.log
+//
+// Every log runs until the light dies; after that the N and F windows read
+//  the same (the cell recovers a little with no load).  So each reading has
+//  a known amount of charge left after it: the charge the light used from
+//  that reading until its last live cycle.  The current at each level comes
+//  from hexbright::light_current (experiments/power_draw).
+
+#define WINDOWS 5 // N F N F N, after each R
+#define WINDOW_SECONDS .25
+#define CYCLE_SECONDS 15
+#define MIN_WINDOW_SAMPLES 20 // of 30; fewer, and the cycle was cut short
+#define CYCLE_LEVEL 500 // the light runs at this between windows, and in windows 0 and 4
+
+// the light is alive if the N windows sag this much below the F windows,
+//  averaged over ALIVE_CYCLES cycles
+#define ALIVE_SAG 4 // mV
+#define ALIVE_CYCLES 5
+// the regulator holds the avr at its ceiling until the battery falls below
+//  it; sag is only measured when F is this far below the highest F so far
+#define CLIP_MARGIN 25 // mV
+
+// window averages are binned by level and voltage (single readings are too
+//  noisy), and only shifted to the voltage at rest once we know the
+//  resistance
+#define MIN_MV 2000
+#define MAX_MV 3600
+#define BIN_MV 5
+#define BINS ((MAX_MV-MIN_MV)/BIN_MV)
+#define MAX_SLOTS 8 // distinct levels over all logs
+
+// the generated curve
+#define CURVE_STEP 25 // mV
+// The curve stops this far below the regulator's ceiling.  The library
+//  measures voltage relative to the ceiling, so this covers the noise in a
+//  block of readings plus the ceiling's spread between units.
+#define CEILING_MARGIN 25 // mV
+#define MIN_POINT_SAMPLES 150 // readings, five windows
+#define MAX_POINTS 64
+
+struct running {
+  long n;
+  double mean, m2;
+  double low, high;
+  void add(double x) {
+    if(!n || x<low) low = x;
+    if(!n || x>high) high = x;
+    n++;
+    double delta = x-mean;
+    mean += delta/n;
+    m2 += delta*(x-mean);
+  }
+  double stdev() const {
+    return n>1 ? sqrt(m2/(n-1)) : 0;
+  }
+  void print(const char* name, const char* units) const {
+    if(!n)
+      printf("  %-22s no data\n", name);
+    else
+      printf("  %-22s mean %7.1f, stdev %5.1f, min %5.0f, max %5.0f %s (%ld)\n",
+             name, mean, stdev(), low, high, units, n);
+  }
+};
+
+// charge used at each raw reading, waiting for the light to prove it was
+//  still alive
+struct bins {
+  long count[MAX_SLOTS][BINS]; // readings
+  double used[MAX_SLOTS][BINS]; // sum of the charge used so far at each reading, mAh
+  double current_sag, current_squared; // for the resistance
+  void clear() {
+    memset(this, 0, sizeof(*this));
+  }
+  void add(const bins& other) {
+    for(int s=0; s<MAX_SLOTS; s++) {
+      for(int b=0; b<BINS; b++) {
+        count[s][b] += other.count[s][b];
+        used[s][b] += other.used[s][b];
+      }
+    }
+    current_sag += other.current_sag;
+    current_squared += other.current_squared;
+  }
+};
+
+int slot_levels[MAX_SLOTS];
+int slots = 0;
+
+int slot(int level) {
+  for(int s=0; s<slots; s++)
+    if(slot_levels[s]==level)
+      return s;
+  if(slots==MAX_SLOTS) {
+    cerr<<"too many light levels"<<endl;
+    exit(1);
+  }
+  slot_levels[slots] = level;
+  return slots++;
+}
+
+double milliamps(int level) {
+  return hexbright::light_current(level)/10.0;
+}
+
+// over every log
+bins all;
+long histogram[MAX_MV]; // F window averages, for the regulator's ceiling
+
+// within a log
+bins committed, pending;
+double used, used_at_death; // mAh
+
+void analyze(const char* name) {
+  FILE* file = fopen(name, "r");
+  if(!file) {
+    cerr<<"can't open "<<name<<endl;
+    return;
+  }
+  // discharge-VOLTAGE_TRIGGER-BRIGHTNESS_LEVEL.log
+  const char* base = strrchr(name, '/') ? strrchr(name, '/')+1 : name;
+  const char* last_dash = strrchr(base, '-');
+  int brightness = last_dash ? atoi(last_dash+1) : 0;
+  if(brightness<=0 || brightness>MAX_LEVEL) {
+    cerr<<name<<": can't find the brightness level in the name"<<endl;
+    fclose(file);
+    return;
+  }
+  int levels[WINDOWS] = {CYCLE_LEVEL, 0, brightness, 0, CYCLE_LEVEL};
+
+  committed.clear();
+  pending.clear();
+  used = used_at_death = 0;
+  running windows[WINDOWS] = {};
+  running sag_cycle = {}, sag_brightness = {}, drift = {};
+  running cycle[WINDOWS] = {}; // this cycle only
+  double sags[ALIVE_CYCLES] = {};
+  int cycles = 0, live_cycles = 0;
+  int window = -1; // -1 before the first R
+  double last_rest = 0;
+  double highest = 0; // the highest F window, near the regulator's ceiling
+  double used_at_window[WINDOWS] = {};
+
+  char line[64];
+  for(;;) {
+    bool more = fgets(line, sizeof(line), file);
+    // skip the terminal program's noise
+    char* c = line;
+    while(more && *c && !isalnum((unsigned char)*c))
+      c++;
+    if(!more || *c=='R') {
+      // the end of a cycle
+      bool complete = window==WINDOWS-1;
+      for(int w=0; w<WINDOWS; w++)
+        complete = complete && cycle[w].n>=MIN_WINDOW_SAMPLES;
+      if(complete) {
+        cycles++;
+        double rest = (cycle[1].mean+cycle[3].mean)/2;
+        double sag = 0;
+        highest = rest>highest ? rest : highest;
+        for(int w=0; w<WINDOWS; w++) {
+          int reading = lround(cycle[w].mean);
+          if(reading<MIN_MV || reading>=MAX_MV)
+            continue;
+          if(levels[w]==0)
+            histogram[reading] += cycle[w].n;
+          int s = slot(levels[w]);
+          int b = (reading-MIN_MV)/BIN_MV;
+          pending.count[s][b] += cycle[w].n;
+          pending.used[s][b] += cycle[w].n*used_at_window[w];
+        }
+        for(int w=0; w<WINDOWS; w+=2) {
+          double s = rest-cycle[w].mean;
+          sag += s/3;
+          if(rest<highest-CLIP_MARGIN) {
+            double current = milliamps(levels[w])-milliamps(0);
+            pending.current_sag += current*s;
+            pending.current_squared += current*current;
+          }
+        }
+        sag_cycle.add(rest-(cycle[0].mean+cycle[4].mean)/2);
+        sag_brightness.add(rest-cycle[2].mean);
+        if(last_rest)
+          drift.add(rest-last_rest);
+        last_rest = rest;
+
+        double average = 0;
+        sags[cycles%ALIVE_CYCLES] = sag;
+        for(int i=0; i<ALIVE_CYCLES; i++)
+          average += sags[i]/ALIVE_CYCLES;
+        if(average>ALIVE_SAG) {
+          // everything up to here was read while the light was alive
+          committed.add(pending);
+          pending.clear();
+          used_at_death = used;
+          live_cycles = cycles;
+        }
+      }
+      if(!more)
+        break;
+      for(int w=0; w<WINDOWS; w++)
+        cycle[w] = running();
+      if(window>=0 && window<WINDOWS)
+        used += milliamps(levels[window])*WINDOW_SECONDS/3600;
+      used += milliamps(CYCLE_LEVEL)*(CYCLE_SECONDS-WINDOWS*WINDOW_SECONDS)/3600;
+      window = 0;
+      used_at_window[0] = used;
+      continue;
+    }
+    if(window<0)
+      continue; // before the first R
+    if(*c=='N' || *c=='F') {
+      if(!cycle[0].n && *c=='N' && window==0)
+        continue; // the first N of the cycle
+      if(window<WINDOWS)
+        used += milliamps(levels[window])*WINDOW_SECONDS/3600;
+      if(++window<WINDOWS)
+        used_at_window[window] = used;
+      continue;
+    }
+    if(!isdigit((unsigned char)*c))
+      continue;
+    if(window>=WINDOWS)
+      continue;
+    int reading = atoi(c);
+    cycle[window].add(reading);
+    windows[window].add(reading);
+  }
+  fclose(file);
+
+  // readings left in pending were taken after the light died
+  for(int s=0; s<MAX_SLOTS; s++) {
+    for(int b=0; b<BINS; b++) {
+      // we store charge used until the light died, for now
+      all.count[s][b] += committed.count[s][b];
+      all.used[s][b] += committed.count[s][b]*used_at_death-committed.used[s][b];
+    }
+  }
+  all.current_sag += committed.current_sag;
+  all.current_squared += committed.current_squared;
+
+  printf("%s: level %d, %d cycles, alive for %d (%.0f minutes, %.0f mAh)\n",
+         name, brightness, cycles, live_cycles, live_cycles*CYCLE_SECONDS/60.0, used_at_death);
+  const char* names[WINDOWS] = {"N (500)", "F", "N (level)", "F", "N (500)"};
+  for(int w=0; w<WINDOWS; w++) {
+    char label[32];
+    snprintf(label, sizeof(label), "window %d, %s:", w, names[w]);
+    windows[w].print(label, "mV");
+  }
+  sag_cycle.print("sag at 500:", "mV");
+  sag_brightness.print("sag at level:", "mV");
+  drift.print("F drift per cycle:", "mV");
+}
+
+// pool adjacent violators, so charge left never goes down as voltage goes up
+void make_increasing(vector<double>& value, vector<double> weight) {
+  vector<size_t> start;
+  vector<double> pooled, pooled_weight;
+  for(size_t i=0; i<value.size(); i++) {
+    if(!weight[i])
+      continue;
+    start.push_back(i);
+    pooled.push_back(value[i]);
+    pooled_weight.push_back(weight[i]);
+    while(pooled.size()>1 && pooled[pooled.size()-2]>pooled.back()) {
+      size_t n = pooled.size();
+      double w = pooled_weight[n-2]+pooled_weight[n-1];
+      pooled[n-2] = (pooled[n-2]*pooled_weight[n-2]+pooled[n-1]*pooled_weight[n-1])/w;
+      pooled_weight[n-2] = w;
+      pooled.pop_back();
+      pooled_weight.pop_back();
+      start.pop_back();
+    }
+  }
+  for(size_t p=0; p<pooled.size(); p++) {
+    size_t end = p+1<start.size() ? start[p+1] : value.size();
+    for(size_t i=start[p]; i<end; i++)
+      if(weight[i])
+        value[i] = pooled[p];
+  }
+}
+
+int main(int argc, char** argv) {
+  const char* output = NULL;
+  vector<const char*> files;
+  for(int i=1; i<argc; i++) {
+    if(!strcmp(argv[i], "-o") && i+1<argc)
+      output = argv[++i];
+    else
+      files.push_back(argv[i]);
+  }
+  if(files.empty()) {
+    cerr<<"usage: discharge_analyze.bin [-o battery_tables.h] discharge-*.log"<<endl;
+    return 1;
+  }
+  for(size_t i=0; i<files.size(); i++)
+    analyze(files[i]);
+
+  if(!all.current_squared) {
+    cerr<<"no sag below the regulator's ceiling; can't fit"<<endl;
+    return 1;
+  }
+  double resistance = all.current_sag/all.current_squared; // mV/mA, ohms
+  int ceiling = 0;
+  for(int mv=0; mv<MAX_MV; mv++)
+    if(histogram[mv]>histogram[ceiling])
+      ceiling = mv;
+  int top = (ceiling-CEILING_MARGIN)/CURVE_STEP*CURVE_STEP;
+
+  // shift each bin to the voltage at rest.  Readings at the ceiling tell us
+  //  nothing.
+  int ceiling_bin = (ceiling-CEILING_MARGIN-MIN_MV)/BIN_MV;
+  int bottom = top;
+  for(int s=0; s<slots; s++) {
+    for(int b=0; b<ceiling_bin; b++) {
+      int rest = MIN_MV+b*BIN_MV+BIN_MV/2+lround(milliamps(slot_levels[s])*resistance);
+      if(all.count[s][b] && rest<bottom)
+        bottom = rest/CURVE_STEP*CURVE_STEP;
+    }
+  }
+  int points = (top-bottom)/CURVE_STEP+1;
+  if(points>MAX_POINTS) {
+    bottom = top-(MAX_POINTS-1)*CURVE_STEP;
+    points = MAX_POINTS;
+  }
+  vector<double> left(points), weight(points);
+  for(int s=0; s<slots; s++) {
+    for(int b=0; b<ceiling_bin; b++) {
+      double rest = MIN_MV+b*BIN_MV+BIN_MV/2.0+milliamps(slot_levels[s])*resistance;
+      int p = lround((rest-bottom)/CURVE_STEP);
+      if(!all.count[s][b] || p<0 || p>=points)
+        continue;
+      left[p] += all.used[s][b];
+      weight[p] += all.count[s][b];
+    }
+  }
+  for(int p=0; p<points; p++) {
+    if(weight[p]<MIN_POINT_SAMPLES)
+      weight[p] = 0;
+    else
+      left[p] /= weight[p];
+  }
+  make_increasing(left, weight);
+  // fill in the points we have no readings for
+  int previous = -1;
+  for(int p=0; p<points; p++) {
+    if(!weight[p])
+      continue;
+    for(int q=previous+1; q<p; q++)
+      left[q] = previous<0 ? left[p] : left[previous]+(left[p]-left[previous])*(q-previous)/(p-previous);
+    previous = p;
+  }
+  for(int q=previous+1; q<points; q++)
+    left[q] = previous<0 ? 0 : left[previous];
+
+  printf("\nsag resistance: %.0f milliohms\n", resistance*1000);
+  printf("regulator ceiling: %d mV\n", ceiling);
+  printf("mV at rest, mAh left, readings\n");
+  for(int p=0; p<points; p++)
+    printf("%4d, %5.1f, %6.0f\n", bottom+p*CURVE_STEP, left[p], weight[p]);
+
+  if(!output)
+    return 0;
+  FILE* header = fopen(output, "w");
+  if(!header) {
+    cerr<<"can't write "<<output<<endl;
+    return 1;
+  }
+  fprintf(header, "// Generated by experiments/voltage_readings/discharge_analyze from\n");
+  fprintf(header, "//  %d discharge logs.  Don't edit; run `make tables` there instead.\n", (int)files.size());
+  fprintf(header, "#define BATTERY_CEILING %d // mV, the regulator's output\n", ceiling);
+  fprintf(header, "#define BATTERY_RESISTANCE %ld // milliohms, cell and wiring\n", lround(resistance*1000));
+  fprintf(header, "#define BATTERY_CURVE_BOTTOM %d // mV, after correcting for sag\n", bottom);
+  fprintf(header, "#define BATTERY_CURVE_STEP %d // mV\n", CURVE_STEP);
+  fprintf(header, "// charge left at each step of the curve, in mAh\n");
+  fprintf(header, "const unsigned char battery_curve[] PROGMEM = {");
+  for(int p=0; p<points; p++) {
+    long value = lround(left[p]);
+    fprintf(header, "%s%ld", p ? ", " : "", value>255 ? 255 : value);
+  }
+  fprintf(header, "};\n");
+  fprintf(header, "#define BATTERY_RESERVE %ld // mAh, the last point of the curve\n", lround(left[points-1]));
+  fclose(header);
+  return 0;
+}
@@ -70,6 +70,9 @@
  *                  Default: 5
  * BAUD_RATE        Serial interface baud rate.
  *                  Default: 19200
+ * FAST_PAGES       Write flash pages in the background while the next
+ *                  page is received, and skip pages that are unchanged.
+ *                  Default: not defined
  */
 
 #ifndef F_CPU
@@ -213,7 +216,9 @@ typedef uintptr_t pgmptr_t;
 /* function prototypes */
 static void load_address(address_t *address);
 static void universal_command(void);
+#ifndef FAST_PAGES
 static void prog_buffer(uintptr_t *, uint8_t *, uint16_t);
+#endif
 static void error(void);
 static char check_sync(void);
 static void putch(char);
@@ -283,6 +288,33 @@ do {								\
 # define STORE_TMP_TO_SPM_CREG	"out	%[creg],%[tmp]"
 #endif
 
+#ifdef FAST_PAGES
+/* A flash page is loaded into the SPM page buffer and erased, and the
+ * write is started from getch() as soon as the erase is done, so the
+ * RWW section is busy while the next page is coming in over the UART.
+ * The state lives in GPIOR1, which is cleared at reset even with NO_BSS.
+ */
+#include <avr/boot.h>
+
+#if !(defined(__AVR_ATmega168__) || defined(__AVR_ATmega168P__) || defined(__AVR_ATmega328P__))
+# error "FAST_PAGES is only implemented for ATmega168/328"
+#endif
+
+#define page_state	(*(uint8_t*)&GPIOR1)
+#define PAGE_IDLE	0
+#define PAGE_ERASING	1
+#define PAGE_WRITING	2
+
+static uint16_t page_address __attribute__((section(".noinit")));
+
+static void page_poll(void);
+static void page_sync(void);
+static void page_start(uint16_t, uint8_t *, uint8_t);
+#else
+# define page_poll()
+# define page_sync()
+#endif
+
 /* some variables */
 static prog_char signature_response[] = {
 	Resp_STK_INSYNC,
@@ -633,6 +665,7 @@ int noreturn main(void)
 
 	/* Leave programming mode  */
 	else if(ch == Cmnd_STK_LEAVE_PROGMODE) {
+		page_sync();
 		nothing_response();
 #ifdef WATCHDOG_MODS
 		// autoreset via watchdog (sneaky!)
@@ -671,10 +704,10 @@ int noreturn main(void)
 
 		rled_on();
 		if (memtype == 'E') {		                //Write to EEPROM one byte at a time
-			while (length.word) {
+			page_sync();				//EEPROM can't be written during SPM
+			for (w = 0; w < length.word; w++) {
 				eeprom_write_byte((void *)address.word,buff[w]);
 				address.word++;
-				length.word--;
 			}
 		} else {
 			//Write to FLASH one page at a time
@@ -683,7 +716,15 @@ int noreturn main(void)
 #endif
 			if ((length.byte[0] & 0x01)) length.word++;	//Even up an odd number of bytes
 			eeprom_busy_wait();			//Wait for previous EEPROM writes to complete
+#ifdef FAST_PAGES
+			for (w = 0; w < length.word; w += SPM_PAGESIZE) {
+				uint16_t left = length.word - w;
+				page_start(address.word + w, buff + w,
+					   left < SPM_PAGESIZE ? left : SPM_PAGESIZE);
+			}
+#else
 			prog_buffer(&address.word, buff, length.word);
+#endif
 			/* Should really add a wait for RWW section to be enabled, don't actually need it since we never */
 			/* exit the bootloader without a power cycle anyhow */
 		}
@@ -704,6 +745,7 @@ int noreturn main(void)
 		if (check_sync())
 			continue;
 
+		page_sync();				//Flash can't be read while the RWW section is busy
 		putch(Resp_STK_INSYNC);
 		led_on();
 		while (length.word) {
@@ -897,6 +939,7 @@ static void universal_command(void)
 	byte2 = getch();
 	byte3 = getch();
 	byte4 = getch();
+	page_sync();
 	if (byte1 == 0x30 && byte2 == 0x00) {
 		// Read Signature Byte
 #define sig_fn(ptr)	byte_response(read_pgmptr(ptr + byte3))
@@ -935,6 +978,7 @@ static void universal_command(void)
 	}
 }
 
+#ifndef FAST_PAGES
 static void prog_buffer(uintptr_t *address, uint8_t *buffer, uint16_t length)
 {
 	uint8_t page_word_count = 0;
@@ -1056,6 +1100,7 @@ static void prog_buffer(uintptr_t *address, uint8_t *buffer, uint16_t length)
 		: "r0"
 	);
 }
+#endif	/* FAST_PAGES */
 
 static void error(void) {
 #ifdef GPIOR0
@@ -1064,9 +1109,55 @@ static void error(void) {
 	static uint8_t error_count;
 #endif
 
-	if (++error_count == MAX_ERROR_COUNT)
+	if (++error_count == MAX_ERROR_COUNT) {
+		page_sync();
 		app_start();
+	}
+}
+
+#ifdef FAST_PAGES
+/* advance a background page write, without waiting */
+static void page_poll(void)
+{
+	if (page_state == PAGE_IDLE || boot_spm_busy())
+		return;
+	if (page_state == PAGE_ERASING) {
+		boot_page_write(page_address);
+		page_state = PAGE_WRITING;
+	} else {
+		boot_rww_enable();
+		page_state = PAGE_IDLE;
+	}
+}
+
+/* finish a background page write, and make the RWW section readable */
+static void page_sync(void)
+{
+	while (page_state != PAGE_IDLE)
+		page_poll();
+	boot_spm_busy_wait();
+}
+
+/* start writing one page in the background, unless flash already has it */
+static void page_start(uint16_t address, uint8_t *buffer, uint8_t length)
+{
+	uint8_t i;
+
+	page_sync();
+	for (i = 0; i < length; i++)
+		if (pgm_read_byte_near(address + i) != buffer[i])
+			break;
+	if (i == length)
+		return;
+
+	/* the page buffer survives a page erase, so fill it first */
+	for (i = 0; i < length; i += 2)
+		boot_page_fill(address + i, buffer[i] | (buffer[i+1] << 8));
+	boot_page_erase(address);
+	page_address = address;
+	page_state = PAGE_ERASING;
 }
+#endif	/* FAST_PAGES */
 
 static char check_sync(void)
 {
@@ -1131,6 +1222,7 @@ static __attribute__((noinline)) char getch(void)
 	while(!(UCSR0A & _BV(RXC0))){
 		/* 20060803 DojoCorp:: Addon coming from the previous Bootloader*/               
 		/* HACKME:: here is a good place to count times*/
+		page_poll();
 		count += timeout_on_getch;
 		if (count > MAX_TIME_COUNT)
 			app_start();
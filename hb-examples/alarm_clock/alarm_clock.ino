@@ -1,5 +1,4 @@
 #include <hexbright.h>
-#include <TimeLib.h>
 
 hexbright hb;
 
@@ -20,6 +19,8 @@ char place = 0;
 unsigned int duration = 0; // HHMM
 int wake_light_level = 0;
 
+#define WAKE_ALARM 0
+
 
 
 void loop() {
@@ -48,20 +49,20 @@ void loop() {
       mode = SLEEP_MODE;
       wake_light_level = hb.get_light_level(); // save the current light level for our wake level
       hb.set_light(wake_light_level/2, 0, 180000);  // turn off over 3 minutes
-      // set alarm, so to speak
-      setTime(0); // reset the time, for easy comparison
+      // set alarm
+      hb.set_alarm_in(WAKE_ALARM, (duration/100)*3600L + (duration%100)*60L);
     }
     break;
   case SLEEP_MODE:
     
-    if(duration_remaining(duration) == 0) {
+    if(hb.get_alarm() == WAKE_ALARM) {
       hb.set_light(1, wake_light_level, 180000);
       mode = WAKE_MODE;
     } else {
       // display our current wait time...
       if(!hb.printing_number()) {
         // print hours, and minutes remaining
-        hb.print_number(duration_remaining(duration));
+        hb.print_number(duration_remaining());
       } 
     }
     break;
@@ -71,12 +72,7 @@ void loop() {
   }
 }
 
-int duration_remaining(int duration) {
-  char minutes_remaining = duration%100 - minute();
-  int hours_remaining = duration/100 - hour();
-  if(minutes_remaining<0) {
-    hours_remaining--;
-    minutes_remaining+=60;
-  }
-  return hours_remaining*100+minutes_remaining;
+int duration_remaining() { // in HHMM, rounded up to the minute
+  unsigned long minutes = (hb.get_alarm_remaining(WAKE_ALARM)+59)/60;
+  return (minutes/60)*100 + minutes%60;
 }
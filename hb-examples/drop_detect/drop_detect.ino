@@ -0,0 +1,43 @@
+#include <hexbright.h>
+
+hexbright hb;
+
+void setup() {
+  hb.init_hardware();
+}
+
+// short click: turn on (or off)
+// while on, the light is cut as soon as we start falling, and comes back on
+//  at the same level once we stop falling.  The impact is printed in 1/100ths of Gs.
+// a twist of more than 45 degrees changes the level.
+
+int level = 0;
+
+void loop() {
+  hb.update();
+  if(hb.button_just_released()) {
+    level = level ? 0 : 200;
+    hb.set_light(CURRENT_LEVEL, level ? level : OFF_LEVEL, NOW);
+  }
+
+  if(level) {
+    if(hb.falling()) {
+      hb.set_light(CURRENT_LEVEL, 0, NOW);
+    } else if(hb.get_light_level()==0) {
+      // we landed (or were caught)
+      hb.set_light(CURRENT_LEVEL, level, 300);
+    }
+    switch(hb.get_motion_event()) {
+    case ACCEL_IMPACT:
+      hb.print_number(hb.get_motion_value());
+      break;
+    case ACCEL_TWIST:
+      level += hb.get_motion_value();
+      level = level>1000 ? 1000 : level;
+      level = level<1 ? 1 : level;
+      hb.set_light(CURRENT_LEVEL, level, 100);
+      break;
+    }
+  }
+  hb.print_power();
+}
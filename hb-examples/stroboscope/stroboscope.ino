@@ -46,13 +46,13 @@ void loop() {
       hb.set_strobe_fpm(buffer);
     }
     
+    // spin is in 1/256ths of a turn per update
     char spin = hb.get_spin();
-    if(abs(spin)-10>0) {  // probably not noise
+    if(abs(spin)>13) {  // probably not noise (about 6 turns a second)
       if(spin>0)
-        fpm *= 1+spin/200.0;
+        fpm *= 1+spin/256.0;
       else
-        fpm /= 1+spin/200.0; 
-      //Serial.println(avg_spin);
+        fpm /= 1-spin/256.0;
       hb.set_strobe_fpm(fpm);
     }
     
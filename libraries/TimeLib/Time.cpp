@@ -25,6 +25,9 @@
                      examples, add error checking and messages to RTC examples,
                      add examples to DS1307RTC library.
   1.4  5  Sep 2014 - compatibility with Arduino 1.5.7
+       hexbright   - now() catches up in one step instead of a second at a
+                     time, millisecond() and nowElements() added, setTime()
+                     no longer clobbers the element cache
 */
 
 #if ARDUINO >= 100
@@ -46,6 +49,11 @@ void refreshCache(time_t t) {
   }
 }
 
+const tmElements_t &nowElements() { // all of the elements now, broken down once a second
+  refreshCache(now());
+  return tm;
+}
+
 int hour() { // the hour now 
   return hour(now()); 
 }
@@ -143,20 +151,23 @@ int year(time_t t) { // the year for the given time
 /* functions to convert to and from system time */
 /* These are for interfacing with time services and are not normally needed in a sketch */
 
-// leap year calculator expects year argument as years offset from 1970
-#define LEAP_YEAR(Y)     ( ((1970+(Y))>0) && !((1970+(Y))%4) && ( ((1970+(Y))%100) || !((1970+(Y))%400) ) )
-
-static  const uint8_t monthDays[]={31,28,31,30,31,30,31,31,30,31,30,31}; // API starts months from 1, this array starts from 0
+// Dates are converted to and from days without walking the years or months
+// (after Howard Hinnant's days_from_civil/civil_from_days).  Years are counted
+// from March 1st, so a leap day is the last day of its year, and the month
+// lengths from March on repeat every five months (153 days).  Everything is
+// unsigned integer math; time_t covers 1970 to 2106, which stays in range.
+#define DAYS_TO_1970 719468UL   // 0000-03-01 to 1970-01-01
+#define DAYS_PER_ERA 146097UL   // 400 years, which repeat exactly
  
 void breakTime(time_t timeInput, tmElements_t &tm){
 // break the given time_t into time components
 // this is a more compact version of the C library localtime function
 // note that year is offset from 1970 !!!
 
-  uint8_t year;
-  uint8_t month, monthLength;
   uint32_t time;
-  unsigned long days;
+  uint8_t era, marchMonth;
+  uint16_t yearOfEra, dayOfYear;
+  uint32_t dayOfEra;
 
   time = (uint32_t)timeInput;
   tm.Second = time % 60;
@@ -167,38 +178,16 @@ void breakTime(time_t timeInput, tmElements_t &tm){
   time /= 24; // now it is days
   tm.Wday = ((time + 4) % 7) + 1;  // Sunday is day 1 
   
-  year = 0;  
-  days = 0;
-  while((unsigned)(days += (LEAP_YEAR(year) ? 366 : 365)) <= time) {
-    year++;
-  }
-  tm.Year = year; // year is offset from 1970 
-  
-  days -= LEAP_YEAR(year) ? 366 : 365;
-  time  -= days; // now it is days in this year, starting at 0
-  
-  days=0;
-  month=0;
-  monthLength=0;
-  for (month=0; month<12; month++) {
-    if (month==1) { // february
-      if (LEAP_YEAR(year)) {
-        monthLength=29;
-      } else {
-        monthLength=28;
-      }
-    } else {
-      monthLength = monthDays[month];
-    }
-    
-    if (time >= monthLength) {
-      time -= monthLength;
-    } else {
-        break;
-    }
-  }
-  tm.Month = month + 1;  // jan is month 1  
-  tm.Day = time + 1;     // day of month
+  time += DAYS_TO_1970; // now it is days since 0000-03-01
+  era = time / DAYS_PER_ERA;
+  dayOfEra = time - era * DAYS_PER_ERA;
+  // take out a day for each leap day before this one in the era
+  yearOfEra = (dayOfEra - dayOfEra/1460 + dayOfEra/36524 - dayOfEra/146096) / 365;
+  dayOfYear = dayOfEra - (365UL*yearOfEra + yearOfEra/4 - yearOfEra/100);
+  marchMonth = (5*dayOfYear + 2) / 153; // 0 is March
+  tm.Day = dayOfYear - (153*marchMonth + 2)/5 + 1;     // day of month
+  tm.Month = marchMonth < 10 ? marchMonth + 3 : marchMonth - 9;  // jan is month 1  
+  tm.Year = era*400 + yearOfEra + (tm.Month <= 2) - 1970; // year is offset from 1970 
 }
 
 time_t makeTime(const tmElements_t &tm){   
@@ -206,30 +195,18 @@ time_t makeTime(const tmElements_t &tm){
 // note year argument is offset from 1970 (see macros in time.h to convert to other formats)
 // previous version used full four digit year (or digits since 2000),i.e. 2009 was 2009 or 9
   
-  int i;
-  uint32_t seconds;
-
-  // seconds from 1970 till 1 jan 00:00:00 of the given year
-  seconds= tm.Year*(SECS_PER_DAY * 365);
-  for (i = 0; i < tm.Year; i++) {
-    if (LEAP_YEAR(i)) {
-      seconds += SECS_PER_DAY;   // add extra days for leap years
-    }
-  }
-  
-  // add days for this year, months start from 1
-  for (i = 1; i < tm.Month; i++) {
-    if ( (i == 2) && LEAP_YEAR(tm.Year)) { 
-      seconds += SECS_PER_DAY * 29;
-    } else {
-      seconds += SECS_PER_DAY * monthDays[i-1];  //monthDay array starts from 0
-    }
-  }
-  seconds+= (tm.Day-1) * SECS_PER_DAY;
-  seconds+= tm.Hour * SECS_PER_HOUR;
-  seconds+= tm.Minute * SECS_PER_MIN;
-  seconds+= tm.Second;
-  return (time_t)seconds; 
+  uint16_t year, yearOfEra, dayOfYear;
+  uint8_t era;
+  uint32_t days;
+
+  // the year starts in March, so January and February belong to the one before
+  year = tmYearToCalendar(tm.Year) - (tm.Month <= 2);
+  era = year / 400;
+  yearOfEra = year - era * 400;
+  dayOfYear = (153*(tm.Month > 2 ? tm.Month - 3 : tm.Month + 9) + 2)/5 + tm.Day - 1;
+  days = era * DAYS_PER_ERA + 365UL*yearOfEra + yearOfEra/4 - yearOfEra/100 + dayOfYear - DAYS_TO_1970;
+
+  return (time_t)(days * SECS_PER_DAY + tm.Hour * SECS_PER_HOUR + tm.Minute * SECS_PER_MIN + tm.Second);
 }
 /*=====================================================*/	
 /* Low level system time functions  */
@@ -249,12 +226,15 @@ time_t sysUnsyncedTime = 0; // the time sysTime unadjusted by sync
 
 time_t now() {
 	// calculate number of seconds passed since last call to now()
-  while (millis() - prevMillis >= 1000) {
-		// millis() and prevMillis are both unsigned ints thus the subtraction will always be the absolute value of the difference
-    sysTime++;
-    prevMillis += 1000;	
+  // millis() and prevMillis are both unsigned ints thus the subtraction will always be the absolute value of the difference
+  uint32_t elapsed = millis() - prevMillis;
+  if (elapsed >= 1000) {
+    // one divide, however long it's been (hours, after a long sleep)
+    uint32_t seconds = elapsed / 1000;
+    sysTime += seconds;
+    prevMillis += seconds * 1000;
 #ifdef TIME_DRIFT_INFO
-    sysUnsyncedTime++; // this can be compared to the synced time to measure long term drift     
+    sysUnsyncedTime += seconds; // this can be compared to the synced time to measure long term drift     
 #endif
   }
   if (nextSyncTime <= sysTime) {
@@ -271,6 +251,12 @@ time_t now() {
   return (time_t)sysTime;
 }
 
+uint16_t millisecond() { // milliseconds into the current second (0-999)
+  now(); // so this second is the one now() returns
+  // millis() may have passed another second since now() read it
+  return (millis() - prevMillis) % 1000;
+}
+
 void setTime(time_t t) { 
 #ifdef TIME_DRIFT_INFO
  if(sysUnsyncedTime == 0) 
@@ -286,17 +272,18 @@ void setTime(time_t t) {
 void setTime(int hr,int min,int sec,int dy, int mnth, int yr){
  // year can be given as full four digit year or two digts (2010 or 10 for 2010);  
  //it is converted to years since 1970
+  tmElements_t set; // not the cache, which belongs to cacheTime
   if( yr > 99)
       yr = yr - 1970;
   else
       yr += 30;  
-  tm.Year = yr;
-  tm.Month = mnth;
-  tm.Day = dy;
-  tm.Hour = hr;
-  tm.Minute = min;
-  tm.Second = sec;
-  setTime(makeTime(tm));
+  set.Year = yr;
+  set.Month = mnth;
+  set.Day = dy;
+  set.Hour = hr;
+  set.Minute = min;
+  set.Second = sec;
+  setTime(makeTime(set));
 }
 
 void adjustTime(long adjustment) {
@@ -116,8 +116,10 @@ int     month();           // the month now  (Jan is month 1)
 int     month(time_t t);   // the month for the given time
 int     year();            // the full four digit year: (2009, 2010 etc) 
 int     year(time_t t);    // the year for the given time
+const tmElements_t &nowElements(); // all of the above now; only recomputed when the second changes
 
 time_t now();              // return the current time as seconds since Jan 1 1970 
+uint16_t millisecond();    // milliseconds into the current second (0-999)
 void    setTime(time_t t);
 void    setTime(int hr,int min,int sec,int day, int month, int yr);
 void    adjustTime(long adjustment);
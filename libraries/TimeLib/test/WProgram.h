@@ -0,0 +1,2 @@
+// Time.cpp includes the Arduino core for millis(); the tests provide it.
+unsigned long millis();
@@ -0,0 +1,9 @@
+// Generated by experiments/voltage_readings/discharge_analyze from
+//  4 discharge logs.  Don't edit; run `make tables` there instead.
+#define BATTERY_CEILING 3329 // mV, the regulator's output
+#define BATTERY_RESISTANCE 179 // milliohms, cell and wiring
+#define BATTERY_CURVE_BOTTOM 2925 // mV, after correcting for sag
+#define BATTERY_CURVE_STEP 25 // mV
+// charge left at each step of the curve, in mAh
+const unsigned char battery_curve[] PROGMEM = {3, 3, 3, 4, 4, 8, 10, 10, 16, 19, 20, 29, 31, 38, 38, 38};
+#define BATTERY_RESERVE 38 // mAh, the last point of the curve
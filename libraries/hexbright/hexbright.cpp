@@ -36,6 +36,14 @@ either expressed or implied, of the FreeBSD Project.
 #else
 #include "read_adc.h"
 #include "../digitalWriteFast/digitalWriteFast.h"
+#include <avr/eeprom.h>
+#endif
+#include "battery_tables.h" // generated from experiments/voltage_readings
+
+#ifdef __AVR
+#define NOINIT __attribute__ ((section (".noinit"))) // not cleared by a reset
+#else
+#define NOINIT
 #endif
 
 // Pin assignments
@@ -54,6 +62,7 @@ either expressed or implied, of the FreeBSD Project.
 ///////////////////////////////////////////////
 
 const float update_delay = 8.3333333; // in lock-step with the accelerometer
+#define UPDATE_MICROS ((int)(1000*update_delay)) // what an update really takes
 unsigned long continue_time;
 
 #ifdef STROBE
@@ -65,6 +74,13 @@ int strobe_duration = 100;
 hexbright::hexbright() {
 }
 
+unsigned char hexbright::eeprom_checksum(int address, unsigned char length) {
+  unsigned char checksum = 0x5A;
+  while(length--)
+    checksum += eeprom_read_byte((uint8_t*)(size_t)address++);
+  return checksum ^ 0xA5;
+}
+
 #ifdef FLASH_CHECKSUM
 int hexbright::flash_checksum() {
   int checksum = 0;
@@ -87,14 +103,17 @@ void hexbright::init_hardware() {
   digitalWriteFast(DPIN_DRV_MODE, LOW);
   digitalWriteFast(DPIN_DRV_EN, LOW);
   
-#if (DEBUG!=DEBUG_OFF)
+#ifdef DEBUG_SERIAL
   // Initialize serial busses
   Serial.begin(9600);
   twi_init(); // for accelerometer
   Serial.println("DEBUG MODE ON");
+#elif (DEBUG==DEBUG_TELEMETRY)
+  init_telemetry();
+  twi_init(); // for accelerometer
 #endif
 
-#if (DEBUG!=DEBUG_OFF && DEBUG!=DEBUG_PRINT)
+#if (defined(DEBUG_SERIAL) && DEBUG!=DEBUG_PRINT)
 #ifdef FREE_RAM
   Serial.print("Ram available: ");
   Serial.print(freeRam());
@@ -104,9 +123,21 @@ void hexbright::init_hardware() {
   Serial.print("Flash checksum: ");
   Serial.println(flash_checksum());
 #endif
-#endif //(DEBUG!=DEBUG_OFF && DEBUG!=DEBUG_PRINT)
+#endif //(defined(DEBUG_SERIAL) && DEBUG!=DEBUG_PRINT)
   
+  load_temperature_calibration();
+  load_battery_reference();
+#ifdef SETTINGS
+  load_settings(); // before the charge used, which may be kept there
+#endif
+#ifdef CHARGE_COUNTER
+  load_charge_used();
+#endif
+#ifdef USAGE_STATS
+  load_usage();
+#endif
 #ifdef ACCELEROMETER
+  load_accelerometer_calibration();
   enable_accelerometer();
 #endif
   
@@ -118,6 +149,22 @@ void hexbright::init_hardware() {
   continue_time = micros();
 }
 
+#ifdef MODES
+// update() only gets to the modes through this, so sketches that don't call
+//  set_modes don't carry the code
+void (*modes_update)() = NULL;
+#endif
+// The same goes for these: each is set the first time a sketch uses the feature.
+#ifdef ACCEL_EVENTS
+void (*motion_update)() = NULL; // get_motion_event, falling or set_modes
+#endif
+#ifdef MORSE
+void (*morse_update)() = NULL; // print_morse
+#endif
+#ifdef CLOCK
+void (*clock_update)() = NULL; // the clock or an alarm (see start_clock)
+#endif
+
 word loopCount;
 void hexbright::update() {
   unsigned long now;
@@ -154,11 +201,20 @@ void hexbright::update() {
 #else
     do {
       now = micros();
+#ifdef ACCEL_CAPTURE
+      capture_write(); // use our spare time to keep up with the capture
+#endif
+#ifdef SETTINGS
+      write_settings();
+#endif
+#ifdef USAGE_STATS
+      write_usage();
+#endif
     } while ((signed long)(continue_time - now) > 0); // not ready for update
 #endif  
 
   // if we're in debug mode, let us know if our loops are too large
-#if (DEBUG!=DEBUG_OFF && DEBUG!=DEBUG_PRINT)
+#if (defined(DEBUG_SERIAL) && DEBUG!=DEBUG_PRINT)
   static int i=0;
 #if (DEBUG==DEBUG_LOOP)
   static unsigned long last_time = 0;
@@ -204,20 +260,51 @@ void hexbright::update() {
   read_avr_voltage();
 
 #ifdef ACCELEROMETER
-  read_accelerometer();
-  find_down();
+  if(accelerometer_sample_due()) {
+    read_accelerometer();
+    find_down();
+    track_rotation();
+#ifdef ACCEL_EVENTS
+    if(motion_update)
+      motion_update();
+#endif
+  }
 #endif
   detect_overheating();
   detect_low_battery();
   apply_max_light_level();
+#ifdef MORSE
+  if(morse_update)
+    morse_update(); // before adjust_light, so the light changes this update
+#endif
   
   // change light levels as requested
   adjust_light();
+#ifdef USAGE_STATS
+  update_usage(); // before count_charge, which starts over when we're charged
+#ifdef DEBUG_SERIAL
+  send_usage();
+#endif
+#endif
+#ifdef CHARGE_COUNTER
+  count_charge();
+#endif
+#ifdef CLOCK
+  if(clock_update)
+    clock_update();
+#endif
+#ifdef MODES
+  if(modes_update)
+    modes_update(); // last, so the modes see this update's readings
+#endif
+#if (DEBUG==DEBUG_TELEMETRY)
+  send_telemetry(); // after everything has had its say
+#endif
 
   // advance time at the same rate as values are changed in the accelerometer.
   //  advance continue_time here, so the first run through short-circuits, 
   //  meaning we will read hardware immediately after power on.
-  continue_time = continue_time+(int)(1000*update_delay);
+  continue_time = continue_time+UPDATE_MICROS;
 }
 
 #ifdef FREE_RAM
@@ -225,7 +312,7 @@ void hexbright::update() {
 int hexbright::freeRam () {
   extern int __heap_start, *__brkval;
   int v;
-  return (int) &v - (__brkval == 0 ? (int) &__heap_start : (int) __brkval);
+  return (int)((size_t) &v - (__brkval == 0 ? (size_t) &__heap_start : (size_t) __brkval));
 }
 #endif
 
@@ -281,6 +368,36 @@ inline int hexbright::stdev_filter3(int last_estimate, int current_reading) {
   return (probability*last_estimate + (100-probability)*current_reading)/100;
 }
 
+inline int hexbright::step_filter(int last_estimate, int current_reading) {
+  // Like stdev_filter3, small differences are mostly noise and large ones
+  //  are motion, but the weights are powers of two (shifts, not divides).
+  //  One raw step is 4-5 (100/21.3), so noise of a step moves us 1/4 of the
+  //  way, two steps 1/2, and anything more is taken as is.
+  int diff = current_reading-last_estimate;
+  int magnitude = diff<0 ? -diff : diff;
+  if(magnitude>10)
+    return current_reading;
+  if(magnitude>5)
+    return last_estimate + diff/2;
+  return last_estimate + diff/4;
+}
+
+int hexbright::run_filter(unsigned char filter, int last_estimate, int current_reading) {
+  switch(filter) {
+  case FILTER_LOW_PASS:
+    return low_pass_filter(last_estimate, current_reading);
+  case FILTER_STDEV:
+    return stdev_filter(last_estimate, current_reading);
+  case FILTER_STDEV2:
+    return stdev_filter2(last_estimate, current_reading);
+  case FILTER_STDEV3:
+    return stdev_filter3(last_estimate, current_reading);
+  case FILTER_STEP:
+    return step_filter(last_estimate, current_reading);
+  }
+  return current_reading;
+}
+
 #endif // ACCELEROMETER
 
 ///////////////////////////////////////////////
@@ -360,7 +477,17 @@ void hexbright::set_light_level(unsigned long level) {
     // lowest possible power, but cpu still running (DPIN_PWR still high)
     digitalWriteFast(DPIN_DRV_MODE, LOW);
     analogWrite(DPIN_DRV_EN, 0);
-  } else if(level == OFF_LEVEL) {
+  } else if(level == (unsigned long)OFF_LEVEL) {
+    save_battery_reference(); // while we still have power
+#ifdef CHARGE_COUNTER
+    save_charge_used(); // while we still have power
+#endif
+#ifdef SETTINGS
+    flush_settings();
+#endif
+#ifdef USAGE_STATS
+    flush_usage();
+#endif
     // power off (DPIN_PWR LOW)
     digitalWriteFast(DPIN_PWR, LOW);
     digitalWriteFast(DPIN_DRV_MODE, LOW);
@@ -394,7 +521,7 @@ void hexbright::apply_max_light_level() {
   // the second test guarantees that we won't turn on if we are
   //  overheating and just shut down
   if(max_light_level < MAX_LEVEL && get_light_level()>MIN_OVERHEAT_LEVEL) {
-#if (DEBUG!=DEBUG_OFF && DEBUG!=DEBUG_PRINT)
+#if (defined(DEBUG_SERIAL) && DEBUG!=DEBUG_PRINT)
     Serial.print("Max light level: ");
     Serial.println(max_light_level);
 #endif
@@ -437,38 +564,42 @@ unsigned int hexbright::get_strobe_error() {
 
 #ifdef LED
 
+// Each layer keeps its own countdowns, whether it is shown or not.
 // >0 = countdown, 0 = change state, -1 = state changed
-int led_wait_time[2] = {-1, -1};
-int led_on_time[2] = {-1, -1};
-unsigned char led_brightness[2] = {0, 0};
+int led_wait_time[LED_LAYERS][2] = {{-1, -1}, {-1, -1}, {-1, -1}};
+int led_on_time[LED_LAYERS][2] = {{-1, -1}, {-1, -1}, {-1, -1}};
+unsigned char led_brightness[LED_LAYERS][2];
+unsigned char led_shown[2] = {LED_LAYERS, LED_LAYERS}; // the layer shown on each led, LED_LAYERS for none
+unsigned char leds_lit = 0; // bits
 byte rledMap[4] = {0b0001, 0b0101, 0b0111, 0b1111};
 
-void hexbright::set_led(unsigned char led, int on_time, int wait_time, unsigned char brightness) {
+void hexbright::set_led(unsigned char led, int on_time, int wait_time, unsigned char brightness, unsigned char layer) {
 #if (DEBUG==DEBUG_LED)
-  Serial.println("activate led");
+  Serial.print("activate led, layer ");
+  Serial.println((int)layer);
 #endif
-  led_on_time[led] = on_time/update_delay;
-  led_wait_time[led] = wait_time/update_delay;
-  led_brightness[led] = brightness;
+  led_on_time[layer][led] = on_time/update_delay;
+  led_wait_time[layer][led] = wait_time/update_delay;
+  led_brightness[layer][led] = brightness;
 }
 
 
-unsigned char hexbright::get_led_state(unsigned char led) {
+unsigned char hexbright::get_led_state(unsigned char led, unsigned char layer) {
   //returns true if the LED is on
-  if(led_on_time[led]>=0) {
+  if(led_on_time[layer][led]>=0) {
     return LED_ON;
-  } else if(led_wait_time[led]>0) {
+  } else if(led_wait_time[layer][led]>0) {
     return LED_WAIT;
   } else {
     return LED_OFF;
   }
 }
 
-inline void hexbright::_led_on(unsigned char led) {
+inline void hexbright::_led_on(unsigned char led, unsigned char brightness) {
   if(led == RLED) { // DPIN_RLED_SW
     pinModeFast(DPIN_RLED_SW, OUTPUT);
 
-    byte l = rledMap[led_brightness[RLED]>>6];
+    byte l = rledMap[brightness>>6];
     byte r = 1<<(loopCount & 0b11);
     if(l & r) {
       digitalWriteFast(DPIN_RLED_SW, HIGH);
@@ -476,7 +607,7 @@ inline void hexbright::_led_on(unsigned char led) {
       digitalWriteFast(DPIN_RLED_SW, LOW);
     }
   } else { // DPIN_GLED
-    analogWrite(DPIN_GLED, led_brightness[GLED]);
+    analogWrite(DPIN_GLED, brightness);
   }
 }
 
@@ -492,35 +623,43 @@ inline void hexbright::_led_off(unsigned char led) {
   }
 }
 
-inline void hexbright::adjust_leds() {
-  // turn off led if it's expired
-#if (DEBUG==DEBUG_LED)
-  if(led_on_time[GLED]>=0) {
-    Serial.print("green on countdown: ");
-    Serial.println(led_on_time[GLED]*update_delay);
-  } else if (led_on_time[GLED]<0 && led_wait_time[GLED]>=0) {
-    Serial.print("green wait countdown: ");
-    Serial.println((led_wait_time[GLED])*update_delay);
-  }
-  if(led_on_time[RLED]>=0) {
-    Serial.print("red on countdown: ");
-    Serial.println(led_on_time[RLED]*update_delay);
-  } else if (led_on_time[RLED]<0 && led_wait_time[RLED]>=0) {
-    Serial.print("red wait countdown: ");
-    Serial.println((led_wait_time[RLED])*update_delay);
-  }
+void hexbright::adjust_leds() {
+  // a number being printed holds both leds, so the pauses between digits
+  //  aren't filled in by the layers below
+  BOOL printing = false;
+#ifdef PRINT_NUMBER
+  printing = printing_number();
 #endif
-
-  int i=0;
+  unsigned char i, layer;
   for(i=0; i<2; i++) {
-    if(led_on_time[i]>0) {
-      _led_on(i);
-      led_on_time[i]--;
-    } else if(led_on_time[i]==0) {
+    unsigned char shown = LED_LAYERS;
+    BOOL on = false;
+    for(layer=0; layer<LED_LAYERS; layer++) {
+      int* on_time = &led_on_time[layer][i];
+      // the highest layer that isn't LED_OFF wins
+      if(*on_time>=0 || led_wait_time[layer][i]>0 || (layer==LED_PRINT && printing)) {
+        shown = layer;
+        on = *on_time>0;
+      }
+      if(*on_time>=0)
+        (*on_time)--;
+      else if(led_wait_time[layer][i]>=0)
+        led_wait_time[layer][i]--;
+    }
+#if (DEBUG==DEBUG_LED)
+    if(shown!=led_shown[i]) {
+      Serial.print(i==RLED ? "red" : "green");
+      Serial.print(" led shows layer ");
+      Serial.println((int)shown);
+    }
+#endif
+    led_shown[i] = shown;
+    if(on) {
+      _led_on(i, led_brightness[shown][i]);
+      BIT_SET(leds_lit, i);
+    } else if(BIT_CHECK(leds_lit, i)) {
       _led_off(i);
-      led_on_time[i]--;
-    } else if (led_wait_time[i]>=0) {
-      led_wait_time[i]--;
+      BIT_CLEAR(leds_lit, i);
     }
   }
 }
@@ -641,7 +780,7 @@ char hexbright::click_count() {
     break;
   case CLICK_ACTIVE:   
     if(button_just_released()) {
-      if(button_pressed_time() > max_click_time) {
+      if((word)button_pressed_time() > max_click_time) {
 	// button held to long
 	//Serial.println("Click held too long");
 	clickState = CLICK_OFF;
@@ -655,7 +794,7 @@ char hexbright::click_count() {
     break;
   case CLICK_WAIT:
     // button is released for long enough, we're done clicking
-    if(button_released_time() > max_click_time) {
+    if((word)button_released_time() > max_click_time) {
       clickState = CLICK_OFF;
       //Serial.print("Click finished: "); Serial.println((int)clickCount);
       return clickCount;
@@ -674,15 +813,6 @@ char hexbright::click_count() {
 
 #ifdef ACCELEROMETER
 
-// return degrees of movement?
-// Possible things to work with:
-//MOVE_TYPE, value returned from a successful detect_movement
-#define ACCEL_NONE   0 // nothing
-#define ACCEL_TWIST  1 // return degrees - light axis remains constant
-#define ACCEL_TURN   2 // return degrees - light axis changes
-#define ACCEL_DROP   3 // return change of velocity - period of no acceleration before impact?
-#define ACCEL_TAP    4 // return change of velocity - acceleration before impact
-
 // I considered operating with bytes to save space, but the savings were
 //  offset by still needing to do /some/ things as ints.  I've not completely
 //  tested which is more compact, but preliminary work suggests difficulty
@@ -697,40 +827,239 @@ int down_vector[] = {0,0,0};
 
 /// SETUP/MANAGEMENT
 
+/// SENSOR POWER MANAGEMENT
+
+// The sensor's rates don't divide evenly into our 120 Hz update, so we read
+//  at the closest rate we can (64 Hz is read at 60 Hz).  Missing an
+//  occasional sample is better than reading the same one twice.
+const unsigned char accel_rate_ticks[] = {1, 2, 4, 8, 15, 30, 60, 120};
+#define ACC_SLEEP_TICKS 15 // auto-wake samples at 8 Hz
+#define ACC_SR_AWSR_8 0x10 // Bxxx10xxx, 8 samples/second while asleep
+#define ACC_MODE_ACTIVE 0x01
+#define ACC_MODE_AWE 0x08 // auto-wake
+#define ACC_MODE_ASE 0x10 // auto-sleep
+#define ACC_INTS_SHAKE_TAP 0xE4
+#define ACC_INTS_PL 0x02 // orientation changes also count as activity
+
+unsigned char accel_rate = ACC_RATE_120;
+unsigned char accel_sleep_count = 0;
+unsigned char accel_idle = 0;
+unsigned char accel_countdown = 0;
+
+void hexbright::set_accelerometer_rate(unsigned char rate) {
+  accel_rate = rate;
+  enable_accelerometer();
+}
+
+unsigned char hexbright::get_accelerometer_rate() {
+  return accel_rate;
+}
+
+void hexbright::set_accelerometer_sleep(unsigned char samples) {
+  accel_sleep_count = samples;
+  accel_idle = 0;
+  enable_accelerometer();
+}
+
+BOOL hexbright::accelerometer_sleeping() {
+  return accel_sleep_count && accel_idle>=accel_sleep_count;
+}
+
+unsigned char hexbright::accelerometer_ticks() {
+  return accelerometer_sleeping() ? ACC_SLEEP_TICKS : accel_rate_ticks[accel_rate];
+}
+
+unsigned char hexbright::samples_at_rate(unsigned char samples) {
+  unsigned char ticks = accelerometer_ticks();
+  return ticks<samples ? samples/ticks : 1;
+}
+
+BOOL hexbright::accelerometer_sample_due() {
+  if(accel_countdown) {
+    accel_countdown--;
+    return false;
+  }
+  accel_countdown = accelerometer_ticks()-1;
+  return true;
+}
+
+void hexbright::track_accelerometer_sleep() {
+  // The sensor counts samples without a shake, tap or orientation change.  We
+  //  can't read its count, so we keep our own, treating a non-stationary
+  //  reading as activity.  This may wake us a sample or two before the sensor.
+  if(!accel_sleep_count)
+    return;
+  if((tilt & 0xA0) || !stationary()) { // shake or tap flags, or movement
+    accel_idle = 0;
+  } else if(accel_idle<255) {
+    accel_idle++;
+  }
+}
+
 void hexbright::enable_accelerometer() {
-  // Configure accelerometer
+  // Registers can only be written in standby mode, so get there first; any
+  //  other register in the same write would be ignored while active.
+  byte standby[] = {ACC_REG_MODE, 0x00};  // Mode: standby
+  twi_writeTo(ACC_ADDRESS, standby, sizeof(standby), true /*wait*/, true /*send stop*/);
   byte config[] = {
-    ACC_REG_INTS,  // First register (see next line)
-    0xE4,  // Interrupts: shakes, taps
-    0x00,  // Mode: not enabled yet
-    0x00,  // Sample rate: 120 Hz (see datasheet page 19)
+    ACC_REG_SPCNT, // First register (see next line)
+    accel_sleep_count, // Sleep count: samples without activity before auto-sleep
+    (byte)(ACC_INTS_SHAKE_TAP | (accel_sleep_count ? ACC_INTS_PL : 0)) // Interrupts: shakes, taps
+  };
+  twi_writeTo(ACC_ADDRESS, config, sizeof(config), true /*wait*/, true /*send stop*/);
+  byte rates[] = {
+    ACC_REG_SR,    // First register (see next line)
+    (byte)(accel_rate | ACC_SR_AWSR_8),  // Sample rate (see datasheet page 19)
     0x0F,  // Tap threshold
     0x05   // Tap debounce samples
   };
-  twi_writeTo(ACC_ADDRESS, config, sizeof(config), true /*wait*/, true /*send stop*/);
+  twi_writeTo(ACC_ADDRESS, rates, sizeof(rates), true /*wait*/, true /*send stop*/);
   
   // Enable accelerometer
-  byte enable[] = {ACC_REG_MODE, 0x01};  // Mode: active!
+  byte enable[] = {ACC_REG_MODE, (byte)(ACC_MODE_ACTIVE | (accel_sleep_count ? ACC_MODE_AWE | ACC_MODE_ASE : 0))};  // Mode: active!
   twi_writeTo(ACC_ADDRESS, enable, sizeof(enable), true /*wait*/, true /*send stop*/);
+  accel_countdown = 0;
   
   // pinModeFast(DPIN_ACC_INT,  INPUT);
   // digitalWriteFast(DPIN_ACC_INT,  HIGH);
 }
 
+/// CALIBRATION
+// vector = (raw*gain - bias)/128, where bias = offset*gain/16.
+//  Offsets are in 1/16ths of a count, gains in 1/128ths of 1/100ths of a G
+//  per count.  The nominal gain is 100/21.3 G/count.
+#define ACC_GAIN_NOMINAL 601
+#define ACC_CALIBRATION_VERSION 1
+#define ACC_CALIBRATION_SAMPLES 64 // about half a second still, on each side
+#define ACC_CALIBRATION_MIN 16 // counts; .75 G along the axis we're capturing
+#define ACC_CALIBRATION_OFF_AXIS 6 // counts; the other two axes must be below this
+
+int accel_gain[] = {ACC_GAIN_NOMINAL, ACC_GAIN_NOMINAL, ACC_GAIN_NOMINAL};
+int accel_bias[] = {0, 0, 0};
+char accel_raw[3]; // the last reading, in counts
+word accel_raw_tick = 0; // loopCount when accel_raw was read
+#define ACC_READ_ATTEMPTS 4 // per sample, before we give up on it
+unsigned char accel_read_errors = 0; // samples we gave up on, up to 255
+
+void hexbright::load_accelerometer_calibration() {
+  int address = EEPROM_ACCEL_CALIBRATION;
+  BOOL valid = eeprom_read_byte((uint8_t*)(size_t)address)==ACC_CALIBRATION_VERSION &&
+    eeprom_checksum(address, 7)==eeprom_read_byte((uint8_t*)(size_t)(address+7));
+  for(int i=0; i<3; i++) {
+    char offset = 0, gain = 0;
+    if(valid) {
+      offset = eeprom_read_byte((uint8_t*)(size_t)(address+1+i));
+      gain = eeprom_read_byte((uint8_t*)(size_t)(address+4+i));
+    }
+    accel_gain[i] = ACC_GAIN_NOMINAL+gain;
+    accel_bias[i] = (offset*accel_gain[i])/16;
+  }
+}
+
+void hexbright::clear_accelerometer_calibration() {
+  eeprom_write_byte((uint8_t*)EEPROM_ACCEL_CALIBRATION, 0xFF);
+  load_accelerometer_calibration();
+}
+
+// one sum per side: +x, -x, +y, -y, +z, -z
+int calibration_sums[6];
+unsigned char calibration_sides = 0; // bit mask of sides captured
+unsigned char calibration_side = 255; // the side we're capturing
+unsigned char calibration_count = 0;
+int calibration_sum = 0;
+char calibration_start[3]; // the first reading of this capture
+unsigned char calibration_result = 0;
+
+void hexbright::start_accelerometer_calibration() {
+  calibration_sides = 0;
+  calibration_side = 255;
+  calibration_result = 0;
+}
+
+unsigned char hexbright::calibrate_accelerometer() {
+  if(!calibration_result && accel_raw_tick==loopCount) { // a new reading
+    // which side are we on?
+    unsigned char side = 255;
+    for(int i=0; i<3; i++) {
+      if(abs(accel_raw[i])>=ACC_CALIBRATION_MIN &&
+         abs(accel_raw[(i+1)%3])<ACC_CALIBRATION_OFF_AXIS &&
+         abs(accel_raw[(i+2)%3])<ACC_CALIBRATION_OFF_AXIS)
+        side = i*2 + (accel_raw[i]<0);
+    }
+    // start over if we moved more than a count
+    BOOL still = side==calibration_side;
+    for(int i=0; i<3; i++)
+      still = still && abs(accel_raw[i]-calibration_start[i])<=1;
+    if(!still) {
+      calibration_side = side;
+      calibration_count = 0;
+      calibration_sum = 0;
+      for(int i=0; i<3; i++)
+        calibration_start[i] = accel_raw[i];
+    }
+    if(side!=255 && !(calibration_sides & (1<<side))) {
+      calibration_sum += accel_raw[side/2];
+      if(++calibration_count==ACC_CALIBRATION_SAMPLES) {
+        calibration_sums[side] = calibration_sum;
+        calibration_sides |= 1<<side;
+        if(calibration_sides==0x3F)
+          calibration_result = save_accelerometer_calibration();
+      }
+    }
+  }
+  if(calibration_result)
+    return calibration_result;
+  unsigned char count = 0;
+  for(int i=0; i<6; i++)
+    count += (calibration_sides>>i) & 1;
+  return count;
+}
+
+unsigned char hexbright::save_accelerometer_calibration() {
+  char values[6];
+  for(int i=0; i<3; i++) {
+    // the sums are of ACC_CALIBRATION_SAMPLES readings at +1G and -1G
+    int span = calibration_sums[i*2]-calibration_sums[i*2+1];
+    int offset = (calibration_sums[i*2]+calibration_sums[i*2+1])/(ACC_CALIBRATION_SAMPLES/8);
+    int gain = span>0 ? (200L*128*ACC_CALIBRATION_SAMPLES)/span-ACC_GAIN_NOMINAL : 1000;
+    if(offset<-127 || offset>127 || gain<-127 || gain>127)
+      return CALIBRATION_FAILED;
+    values[i] = offset;
+    values[i+3] = gain;
+  }
+  int address = EEPROM_ACCEL_CALIBRATION;
+  eeprom_write_byte((uint8_t*)(size_t)address, ACC_CALIBRATION_VERSION);
+  for(int i=0; i<6; i++)
+    eeprom_write_byte((uint8_t*)(size_t)(address+1+i), values[i]);
+  eeprom_write_byte((uint8_t*)(size_t)(address+7), eeprom_checksum(address, 7));
+  load_accelerometer_calibration();
+  return CALIBRATION_SAVED;
+}
+
 void hexbright::read_accelerometer() {
   /*unsigned long time = 0;
     if((millis()-init_time)>*/
   // advance which vector is considered the first
   next_vector();
   char read=0;
+  unsigned char attempts = 0;
   while(read!=4) {
-    byte reg = ACC_REG_XOUT;
-    twi_writeTo(ACC_ADDRESS, &reg, sizeof(reg), true /*wait*/, true /*send stop*/);
-	byte acc_data[4];
-	twi_readFrom(ACC_ADDRESS, acc_data, sizeof(acc_data), true /*send stop*/);
+    if(attempts++==ACC_READ_ATTEMPTS) {
+      // not answering, or always mid-update; repeat the last vector rather
+      //  than hold up the update (and the button and overheat protection)
+      for(int i=0; i<3; i++)
+        vectors[current_vector+i] = vector(1)[i];
+      if(accel_read_errors<255)
+        accel_read_errors++;
+      return;
+    }
+    byte acc_data[4];
+    // one transaction: write the register, repeated start, read
+    if(twi_readRegisters(ACC_ADDRESS, ACC_REG_XOUT, acc_data, sizeof(acc_data))!=sizeof(acc_data))
+      continue; // the bus timed out and was reset; try again
     read = 0;
     int i = 0;
-    for(i; i<4; i++) {
+    for(; i<4; i++) {
       char tmp = acc_data[i];
 	  if (tmp & 0x40) { // Bx1xxxxxx,
 		// invalid data, re-read per data sheet page 14
@@ -741,18 +1070,34 @@ void hexbright::read_accelerometer() {
       } else { // read vector
         if(tmp & 0x20) // Bxx1xxxxx, it's negative
           tmp |= 0xC0; // extend to B111xxxxx
-		vectors[current_vector+i] = stdev_filter3(vector(1)[i], tmp*(100/21.3));
+        accel_raw[i] = tmp;
+		vectors[current_vector+i] = filter_reading(vector(1)[i], (tmp*accel_gain[i]-accel_bias[i])/128);
       }
 	  read++; // successfully read.
     }
   }
+  accel_raw_tick = loopCount;
+  track_accelerometer_sleep();
+#ifdef ACCEL_CAPTURE
+  capture_sample(accel_raw, tilt);
+#endif
+}
+
+unsigned char hexbright::get_accelerometer_errors() {
+  return accel_read_errors;
+}
+
+inline int hexbright::filter_reading(int last_estimate, int current_reading) {
+  // readings at 32 Hz and below are too far apart to filter
+  if(accel_rate>ACC_RATE_64 || accelerometer_sleeping())
+    return current_reading;
+  return stdev_filter3(last_estimate, current_reading);
 }
 
 unsigned char hexbright::read_accelerometer(unsigned char acc_reg) {
   if (!digitalReadFast(DPIN_ACC_INT)) {
-    byte acc_data;
-    twi_writeTo(ACC_ADDRESS, &acc_reg, sizeof(acc_reg), true /*wait*/, true /*send stop*/);
-    twi_readFrom(ACC_ADDRESS, &acc_data, sizeof(acc_data), true /*send stop*/);
+    byte acc_data = 0;
+    twi_readRegisters(ACC_ADDRESS, acc_reg, &acc_data, sizeof(acc_data));
     return acc_data;
   }
   return 0;
@@ -765,9 +1110,12 @@ inline void hexbright::find_down() {
   //  (assuming we're not dropped).  Heuristics to only find down
   //  under specific circumstances have been tried, but they only
   //  tell us when down is less certain, not where it is...
+  // At lower sample rates four vectors span too much time, so we use fewer.
+  unsigned char ticks = accelerometer_ticks();
+  unsigned char window = ticks>=15 ? 1 : (ticks>=4 ? 2 : num_vectors);
   copy_vector(down_vector, vector(0)); // copy first vector to down
   double magnitudes = magnitude(vector(0));
-  for(int i=1; i<num_vectors; i++) { // go through, summing everything up
+  for(int i=1; i<window; i++) { // go through, summing everything up
     int* vtmp = vector(i);
     sum_vectors(down_vector, down_vector, vtmp);
     magnitudes+=magnitude(vtmp);
@@ -868,20 +1216,195 @@ BOOL hexbright::moved(int tolerance) {
   return abs(magnitude(vector(0))-100)>tolerance;
 }
 
+/// ROTATION
+// Rotation around the light axis, from the x/z projection of each new vector.
+//  Angles are in 1/256ths of a turn, so they wrap like an unsigned char, and
+//  the difference of two angles (as a char) is the shortest rotation between
+//  them: unwrapping is free.
+// Rotation is only tracked if at least .5 Gs are perpendicular to the light axis.
+//  Pointing straight up or down (or falling), the angle is mostly noise.
+#define ROTATION_MIN_PROJECTION 50
+#define ROTATION_MAX_GAP 6 // 50 ms; after a longer gap we don't know how far we turned
+
+unsigned char rotation_angle = 0;
+unsigned char rotation_gap = 255; // samples since the last good angle
+char rotation_step = 0; // rotation during the last sample
+word rotation_tick = 0; // loopCount at the last sample
+int rotation_total = 0;
+int rotation_rate = 0; // 1/16ths of a step, averaged over about 8 samples
+
+unsigned char hexbright::binary_atan2(int y, int x) {
+  // atan(t) ~= pi/4*t + .273*t*(1-t) in the first octant, max error .3 degrees
+  int ax = abs(x), ay = abs(y);
+  if(!ax && !ay)
+    return 0;
+  unsigned char ratio = ay<=ax ? ((long)ay*64)/ax : ((long)ax*64)/ay; // 0-64
+  unsigned char angle = (ratio*32 + ((ratio*(64-ratio))*11)/64 + 32)/64; // 0-32
+  if(ay>ax)
+    angle = 64-angle;
+  if(x<0)
+    angle = 128-angle;
+  if(y<0)
+    angle = -angle;
+  return angle;
+}
+
+void hexbright::track_rotation() {
+  int* vec = vector(0);
+  int ax = abs(vec[0]), az = abs(vec[2]);
+  // max + min/2 overestimates the magnitude by at most 12%
+  int projection = ax>az ? ax+az/2 : az+ax/2;
+  rotation_step = 0;
+  rotation_tick = loopCount;
+  if(projection>=ROTATION_MIN_PROJECTION) {
+    unsigned char angle = binary_atan2(vec[2], vec[0]); // clockwise is positive
+    // if we briefly lost the angle (swinging past vertical), measure
+    //  from the last angle we had.
+    if(rotation_gap<=samples_at_rate(ROTATION_MAX_GAP)) {
+      rotation_step = angle-rotation_angle;
+      rotation_total += rotation_step;
+    }
+    rotation_angle = angle;
+    rotation_gap = 0;
+  } else if(rotation_gap<255) {
+    rotation_gap++;
+  }
+  rotation_rate += rotation_step*2 - rotation_rate/8;
+}
+
 char hexbright::get_spin() {
-  // quick formula:
-  //(atan2(vector(1)[0], vector(1)[2]) - atan2(vector(0)[0], vector(0)[2]))*32;
-  // we cache the last position, because it takes up less space.
-  static char last_spin = 0;
-  // 2*PI*32 = 200
-  return atan2(down()[0], down()[2])*32 - atan2(vector(0)[0], vector(0)[2])*32;
-  char spin = atan2(vector(0)[0], vector(0)[2])*32;
-  if(abs(last_spin)-10<0) {
+  // only report a step on the update it happened
+  return rotation_tick==loopCount ? rotation_step : 0;
+}
+
+int hexbright::get_rotation() {
+  return rotation_total;
+}
+
+void hexbright::reset_rotation() {
+  rotation_total = 0;
+}
+
+int hexbright::get_rotation_rate() {
+  // 1/16ths of a step per sample to degrees per second:
+  //  *120/ticks samples per second, *360/256 degrees per step, /16
+  return ((long)rotation_rate*675)/(64*accelerometer_ticks());
+}
+
+unsigned char hexbright::get_rotation_angle() {
+  return rotation_angle;
+}
+
+BOOL hexbright::rotation_tracking() {
+  return !rotation_gap;
+}
+
+#ifdef ACCEL_EVENTS
+/// MOTION EVENTS
+// All of these run once per new vector, with a handful of bytes of state.
+//  Magnitudes are compared squared, so we only take a square root when
+//  reporting an impact.
+
+// Free-fall reads close to 0 Gs, but a spinning fall still shows
+//  .15-.25 Gs of centripetal acceleration (see 'spinning counterclockwise 30 inch fall').
+#define FREEFALL_MAGNITUDE 35
+#define FREEFALL_SAMPLES 6 // 50 ms of free-fall before we call it a drop
+// Landings in 'no spin 30 inch fall' peak at 2-2.5 Gs.
+#define IMPACT_MAGNITUDE 150
+#define IMPACT_WINDOW 60 // the impact must start within 500 ms of the free-fall ending
+// Twists are built from the rotation tracker's steps (1/256ths of a turn).
+#define TWIST_MIN_STEP 2 // steps per sample (3 degrees); smaller changes are noise
+#define TWIST_IDLE_SAMPLES 12 // 100 ms without rotation ends a twist
+#define TWIST_MIN_STEPS 32 // 45 degrees
+
+unsigned char motion_event = ACCEL_NONE;
+int motion_value = 0;
+unsigned char freefall_samples = 0;
+unsigned char impact_window = 0;
+long impact_peak = 0; // squared
+int twist_steps = 0;
+unsigned char twist_idle = 0;
+
+unsigned char hexbright::get_motion_event() {
+  motion_update = detect_motion;
+  return motion_event;
+}
 
+int hexbright::get_motion_value() {
+  return motion_value;
+}
+
+BOOL hexbright::falling() {
+  motion_update = detect_motion;
+  return freefall_samples>=samples_at_rate(FREEFALL_SAMPLES);
+}
+
+void hexbright::detect_motion() {
+  int* vec = vector(0);
+  // squared magnitudes can exceed an int (see dot_product)
+  long magnitude = (long)vec[0]*vec[0] + (long)vec[1]*vec[1] + (long)vec[2]*vec[2];
+  // our thresholds are in samples at 120 Hz
+  unsigned char freefall_min = samples_at_rate(FREEFALL_SAMPLES);
+  unsigned char twist_idle_max = samples_at_rate(TWIST_IDLE_SAMPLES);
+  motion_event = ACCEL_NONE;
+  motion_value = 0;
+
+  /// drop
+  if(magnitude < FREEFALL_MAGNITUDE*FREEFALL_MAGNITUDE) {
+    if(freefall_samples<255)
+      freefall_samples++;
+    if(freefall_samples>=freefall_min) {
+      if(freefall_samples==freefall_min)
+        motion_event = ACCEL_DROP;
+      impact_window = samples_at_rate(IMPACT_WINDOW);
+      impact_peak = 0;
+    }
+  } else {
+    freefall_samples = 0;
   }
-  
-  return spin;
+
+  /// impact (only after a drop)
+  if(impact_window) {
+    if(magnitude > (long)IMPACT_MAGNITUDE*IMPACT_MAGNITUDE) {
+      if(magnitude > impact_peak)
+        impact_peak = magnitude;
+    } else if(impact_peak) {
+      // the spike is over, report it
+      motion_event = ACCEL_IMPACT;
+      motion_value = sqrt(impact_peak);
+      impact_peak = 0;
+      impact_window = 0;
+    } else if(!freefall_samples) {
+      impact_window--;
+    }
+  }
+
+  /// twist (see track_rotation)
+  char step = freefall_samples ? 0 : rotation_step;
+  if(abs(step)>=TWIST_MIN_STEP) {
+    twist_steps += step;
+    twist_idle = 0;
+  } else if(twist_idle<twist_idle_max) {
+    twist_idle++;
+  } else {
+    // we've stopped
+    if(abs(twist_steps)>=TWIST_MIN_STEPS && motion_event==ACCEL_NONE) {
+      motion_event = ACCEL_TWIST;
+      motion_value = ((long)twist_steps*45)/32; // degrees
+    }
+    twist_steps = 0;
+  }
+
+#if (DEBUG==DEBUG_ACCEL)
+  if(motion_event!=ACCEL_NONE) {
+    Serial.print("motion event: ");
+    Serial.print((int)motion_event);
+    Serial.print(", value: ");
+    Serial.println(motion_value);
+  }
+#endif
 }
+#endif // ACCEL_EVENTS
 
 /// VECTOR TOOLS
 int* hexbright::vector(unsigned char back) {
@@ -928,12 +1451,12 @@ int hexbright::dot_product(int* vector1, int* vector2) {
 void hexbright::cross_product(int * axes_rotation,
                               int* in_vector1,
                               int* in_vector2,
-                              double angle_difference) {
+                              double /*angle_difference*/) {
   for(int i=0; i<3; i++) {
     axes_rotation[i] = (in_vector1[(i+1)%3]*in_vector2[(i+2)%3]         \
                         - in_vector1[(i+2)%3]*in_vector2[(i+1)%3]);
     //axes_rotation[i] /= magnitude(in_vector1)*magnitude(in_vector2);
-    //axes_rotation[i] /= asin(angle_difference*3.14159);
+    //axes_rotation[i] /= asin(angle_difference*3.14159); // (unused for now)
   }
 }
 
@@ -975,72 +1498,331 @@ void hexbright::copy_vector(int* out_vector, int* in_vector) {
 }
 
 void hexbright::print_vector(int* vector, const char* label) {
-#if (DEBUG!=DEBUG_OFF)
+#ifdef DEBUG_SERIAL
   for(int i=0; i<3; i++) {
     Serial.print(vector[i]);
     Serial.print("/");
   }
   Serial.println(label);
+#else
+  (void)vector; (void)label; // nowhere to print them
 #endif
 }
 
 #endif
 
+#ifdef ACCEL_CAPTURE
+///////////////////////////////////////////////
+/////////////ACCELEROMETER CAPTURE/////////////
+///////////////////////////////////////////////
+
+// EEPROM layout:
+//  0: 'A', format version, sample rate (ACC_RATE_*), samples up to the trigger,
+//     update count at the trigger (2 bytes, little endian), threshold, 0
+//  8: the bit stream, most significant bit first.
+// Each sample starts with any number of escapes, followed by x, y and z:
+//  0               same as the last value
+//  10s             +1 (s=0) or -1 (s=1)
+//  110nnn          -5..-2 (n=0..3) or 2..5 (n=4..7)
+//  1110vvvvvv      the raw 6-bit value
+// escapes:
+//  111100tttttttt  the tilt register changed
+//  111101nnnnnnnn  n samples were dropped (EEPROM couldn't keep up)
+//  111111          end of the capture (erased EEPROM reads as this, too)
+#define CAPTURE_VERSION 1
+#define CAPTURE_HEADER 8
+#define CAPTURE_RING 12 // samples: 100 ms at 120 Hz
+#define CAPTURE_SLOT 5 // x, y, z, tilt, samples dropped before this one
+#define CAPTURE_QUEUE 16
+#define CAPTURE_MAX_SAMPLE 8 // bytes: two escapes and three raw values is 58 bits
+#define CAPTURE_NO_TILT 0xFF // the alert bit is never set in a valid reading
+#if defined(USAGE_STATS)
+#define CAPTURE_END EEPROM_USAGE
+#elif defined(SETTINGS)
+#define CAPTURE_END EEPROM_SETTINGS
+#else
+#define CAPTURE_END EEPROM_CALIBRATION
+#endif
+
+unsigned char capture_state = CAPTURE_OFF;
+BOOL capture_stopping = false; // end once the ring is empty
+BOOL capture_ending = false; // the end is queued, waiting on EEPROM
+unsigned char capture_threshold;
+// Before the trigger, the ring holds the last 100 ms.  After, it holds
+//  samples until there's room for them in the queue.
+char capture_ring[CAPTURE_RING*CAPTURE_SLOT];
+unsigned char capture_ring_first = 0;
+unsigned char capture_ring_count = 0;
+char capture_last[3];
+unsigned char capture_last_tilt;
+unsigned char capture_dropped;
+unsigned char capture_queue[CAPTURE_QUEUE];
+unsigned char capture_queue_start;
+unsigned char capture_queue_count;
+unsigned char capture_byte;
+unsigned char capture_bit_count;
+int capture_address; // next EEPROM address to be written
+int capture_queued_address; // EEPROM address of the next byte we queue
+
+void hexbright::start_capture(unsigned char threshold) {
+  capture_threshold = threshold;
+  capture_ring_first = 0;
+  capture_ring_count = 0;
+  capture_queue_count = 0;
+  capture_dropped = 0;
+  capture_stopping = false;
+  capture_ending = false;
+  capture_state = CAPTURE_ARMED;
+}
+
+void hexbright::stop_capture() {
+  if(capture_state==CAPTURE_RECORDING)
+    capture_stopping = true;
+  else if(capture_state==CAPTURE_ARMED)
+    capture_state = CAPTURE_OFF;
+}
+
+unsigned char hexbright::get_capture_state() {
+  return capture_state;
+}
+
+void hexbright::capture_write() {
+  if(capture_queue_count && eeprom_is_ready()) {
+    eeprom_write_byte((uint8_t*)(size_t)capture_address++, capture_queue[capture_queue_start]);
+    capture_queue_start = (capture_queue_start+1)%CAPTURE_QUEUE;
+    capture_queue_count--;
+  }
+  if(capture_state==CAPTURE_RECORDING) {
+    capture_drain();
+    if(capture_ending && !capture_queue_count) {
+      capture_ending = false;
+      capture_state = CAPTURE_DONE;
+    }
+  }
+}
+
+static void capture_queue_byte(unsigned char value) {
+  capture_queue[(capture_queue_start+capture_queue_count)%CAPTURE_QUEUE] = value;
+  capture_queue_count++;
+  capture_queued_address++;
+}
+
+void hexbright::capture_bits(unsigned int value, unsigned char bits) {
+  while(bits--) {
+    capture_byte = (capture_byte<<1) | ((value>>bits) & 1);
+    if(++capture_bit_count==8) {
+      capture_queue_byte(capture_byte);
+      capture_bit_count = 0;
+    }
+  }
+}
+
+void hexbright::capture_encode(char* slot) {
+  if(slot[4]) {
+    capture_bits(0x3D00 | (unsigned char)slot[4], 14); // 111101nnnnnnnn
+  }
+  if((unsigned char)slot[3] != capture_last_tilt) {
+    capture_last_tilt = slot[3];
+    capture_bits(0x3C00 | capture_last_tilt, 14); // 111100tttttttt
+  }
+  for(int i=0; i<3; i++) {
+    char delta = slot[i]-capture_last[i];
+    if(!delta)
+      capture_bits(0, 1);
+    else if(delta==1 || delta==-1)
+      capture_bits(delta<0 ? 0x5 : 0x4, 3); // 10s
+    else if(delta>=-5 && delta<=5)
+      capture_bits(0x30 | (delta<0 ? delta+5 : delta+2), 6); // 110nnn
+    else
+      capture_bits(0x380 | (slot[i] & 0x3F), 10); // 1110vvvvvv
+    capture_last[i] = slot[i];
+  }
+}
+
+void hexbright::capture_end() {
+  capture_bits(0x3F, 6); // 111111
+  if(capture_bit_count) // pad with 1s
+    capture_bits(0xFF, 8-capture_bit_count);
+  capture_ending = true;
+}
+
+void hexbright::capture_drain() {
+  while(capture_ring_count && !capture_ending) {
+    // the +2 leaves room for the end
+    if(capture_queued_address+CAPTURE_MAX_SAMPLE+2 > CAPTURE_END) {
+      capture_end(); // full
+      return;
+    }
+    if(CAPTURE_QUEUE-capture_queue_count < CAPTURE_MAX_SAMPLE)
+      return; // EEPROM is behind
+    capture_encode(capture_ring+capture_ring_first*CAPTURE_SLOT);
+    capture_ring_first = (capture_ring_first+1)%CAPTURE_RING;
+    capture_ring_count--;
+  }
+  if(capture_stopping && !capture_ending) {
+    capture_stopping = false;
+    capture_end();
+  }
+}
+
+void hexbright::capture_sample(char* raw, unsigned char tilt_register) {
+  if(capture_state==CAPTURE_ARMED) {
+    if(capture_ring_count==CAPTURE_RING) { // forget the oldest
+      capture_ring_first = (capture_ring_first+1)%CAPTURE_RING;
+      capture_ring_count--;
+    }
+  } else if(capture_state==CAPTURE_RECORDING && !capture_stopping && !capture_ending) {
+    if(capture_ring_count==CAPTURE_RING) {
+      if(capture_dropped<255)
+        capture_dropped++;
+      return;
+    }
+  } else {
+    return;
+  }
+  char* slot = capture_ring+(capture_ring_first+capture_ring_count)%CAPTURE_RING*CAPTURE_SLOT;
+  slot[0] = raw[0];
+  slot[1] = raw[1];
+  slot[2] = raw[2];
+  slot[3] = tilt_register;
+  slot[4] = capture_dropped;
+  capture_dropped = 0;
+  capture_ring_count++;
+
+  if(capture_state==CAPTURE_ARMED) {
+    if(abs(magnitude(vector(0))-100)<=capture_threshold)
+      return;
+    // triggered!
+    capture_state = CAPTURE_RECORDING;
+    capture_address = 0;
+    capture_queued_address = 0;
+    capture_queue_start = 0;
+    capture_bit_count = 0;
+    capture_last_tilt = CAPTURE_NO_TILT;
+    capture_last[0] = capture_last[1] = capture_last[2] = 0;
+    unsigned char header[] = {'A', CAPTURE_VERSION, accel_rate, capture_ring_count,
+                              (unsigned char)loopCount, (unsigned char)(loopCount>>8),
+                              capture_threshold, 0};
+    for(int i=0; i<CAPTURE_HEADER; i++)
+      capture_queue_byte(header[i]);
+  }
+  capture_drain();
+}
+#endif // ACCEL_CAPTURE
+
 
 ///////////////////////////////////////////////
 //////////////////UTILITIES////////////////////
 ///////////////////////////////////////////////
 
-long _number = 0;
+#if (defined(LED) && defined(PRINT_NUMBER))
+// Digits are unpacked once, in print_number, into print_digits: BCD nibbles
+//  for base 10, the value's own nibbles or bits for base 16 and 2.  Digit 0
+//  is the right-most.  Each update only looks up the next digit, so no 32 bit
+//  math is done while printing.
+#define PRINT_DIGIT_BYTES 5 // 10 decimal digits, 8 hex digits or 32 bits
+// print_digit values past the end of the number
+#define PRINT_END -1 // the last digit is done
+#define PRINT_AGAIN -2 // pausing before printing the number again
+#define PRINT_DONE -3 // pausing after the last time through
+#define PRINT_ZERO 0xFF // print_flashes for a digit of 0
+
+unsigned char print_digits[PRINT_DIGIT_BYTES];
+unsigned char print_bits = 4; // bits per digit, 1 or 4
+unsigned char print_length = 0; // digits in the number
+signed char print_digit = PRINT_DONE; // the digit being printed
+unsigned char print_flashes = 0; // flashes left in this digit
+unsigned char print_times = 0; // times left to print the number, 0 = forever
+BOOL print_negative = false;
 unsigned char _color = GLED;
 int print_wait_time = 0;
 
-#if (defined(LED) && defined(PRINT_NUMBER))
+// timing, see set_print_timing
+int print_flash_on = 120;
+int print_long_on = 400;
+int print_sign_on = 500;
+unsigned char print_flash_updates = 300/update_delay;
+unsigned char print_digit_updates = 600/update_delay;
+int print_end_updates = 2500/update_delay;
+
 BOOL hexbright::printing_number() {
-  return _number || print_wait_time;
+  return print_digit!=PRINT_DONE || print_wait_time;
 }
 
 void hexbright::reset_print_number() {
-  _number = 1;
+  print_digit = PRINT_END;
+  print_times = 1;
   print_wait_time = 0;
 }
 
+void hexbright::set_print_timing(int flash_time, int digit_time, int end_time) {
+  print_flash_on = flash_time*2/5;
+  print_long_on = flash_time*4/3;
+  print_sign_on = flash_time*5/3;
+  print_flash_updates = flash_time/update_delay;
+  print_digit_updates = digit_time/update_delay;
+  print_end_updates = end_time/update_delay;
+}
+
+unsigned char hexbright::get_print_digit(unsigned char digit) {
+  unsigned char bit = digit*print_bits;
+  return (print_digits[bit/8]>>(bit%8)) & ((1<<print_bits)-1);
+}
+
+void hexbright::start_digit() {
+  print_flashes = get_print_digit(print_digit);
+  if(!print_flashes)
+    print_flashes = PRINT_ZERO;
+}
+
+void hexbright::start_number() {
+  print_digit = print_length-1;
+  start_digit();
+  // the right-most digit is always red
+  _color = print_digit%2 ? GLED : RLED;
+  if(print_negative) {
+    set_led(flip_color(_color), print_sign_on, 100, 255, LED_PRINT);
+    print_wait_time = print_digit_updates;
+  }
+}
+
 void hexbright::update_number() {
-  if(_number>0) { // we have something to do...
-#if (DEBUG==DEBUG_NUMBER)
-    static int last_printed = 0;
-    if(last_printed != _number) {
-      last_printed = _number;
-      Serial.print("number remaining (read from right to left): ");
-      Serial.println(_number);
-    }
-#endif
-    if(!print_wait_time) {
-      if(_number==1) { // minimum delay between printing numbers
-        print_wait_time = 2500/update_delay;
-        _number = 0;
-        return;
-      } else {
-        print_wait_time = 300/update_delay;
-      }
-      if(_number/10*10==_number) {
+  if(!print_wait_time) {
+    if(print_digit>=0) {
 #if (DEBUG==DEBUG_NUMBER)
-        Serial.println("zero");
+      Serial.print("digit ");
+      Serial.print((int)print_digit);
+      Serial.print(", flashes left: ");
+      Serial.println((int)print_flashes);
 #endif
-        //        print_wait_time = 500/update_delay;
-        set_led(_color, 400);
+      print_wait_time = print_flash_updates;
+      if(print_flashes==PRINT_ZERO) {
+        set_led(_color, print_long_on, 100, 255, LED_PRINT);
+        print_flashes = 0;
       } else {
-        set_led(_color, 120);
-        _number--;
+        set_led(_color, print_flash_on, 100, 255, LED_PRINT);
+        print_flashes--;
       }
-      if(_number && !(_number%10)) { // next digit?
-        print_wait_time = 600/update_delay;
+      if(!print_flashes) { // next digit
+        print_wait_time = print_digit_updates;
         _color = flip_color(_color);
-        _number = _number/10;
+        if(print_digit--)
+          start_digit();
       }
+    } else if(print_digit==PRINT_END) { // minimum delay between printing numbers
+      print_wait_time = print_end_updates;
+      if(print_times!=1) {
+        if(print_times)
+          print_times--;
+        print_digit = PRINT_AGAIN;
+      } else {
+        print_digit = PRINT_DONE;
+      }
+    } else if(print_digit==PRINT_AGAIN) {
+      start_number();
     }
   }
-  
+
   if(print_wait_time) {
     print_wait_time--;
   }
@@ -1051,24 +1833,35 @@ unsigned char hexbright::flip_color(unsigned char color) {
 }
 
 
-void hexbright::print_number(long number) {
-  // reverse number (so it prints from left to right)
-  BOOL negative = false;
-  if(number<0) {
-    number = 0-number;
-    negative = true;
-  }
-  _color = GLED;
-  _number=1; // to guarantee printing when dealing with trailing zeros (100 can't be stored as 001, use 1001)
-  do {
-    _number = _number * 10 + (number%10);
-    number = number/10;
-    _color = flip_color(_color);
-  }  while(number>0);
-  if(negative) {
-    set_led(flip_color(_color), 500);
-    print_wait_time = 600/update_delay;
+void hexbright::print_number(long number, unsigned char base, unsigned char times) {
+  print_negative = number<0;
+  // as unsigned, so -2147483648 has a magnitude
+  unsigned long magnitude = print_negative ? 0-(unsigned long)number : number;
+  unsigned char i;
+  if(base==10) {
+    print_bits = 4;
+    print_length = 0;
+    for(i=0; i<PRINT_DIGIT_BYTES; i++)
+      print_digits[i] = 0;
+    do {
+      print_digits[print_length/2] |= (magnitude%10)<<(print_length%2*4);
+      magnitude /= 10;
+      print_length++;
+    } while(magnitude);
+  } else {
+    print_bits = base==2 ? 1 : 4;
+    for(i=0; i<PRINT_DIGIT_BYTES; i++) {
+      print_digits[i] = magnitude;
+      magnitude >>= 8;
+    }
+    // drop leading zeros
+    print_length = 32/print_bits;
+    while(print_length>1 && !get_print_digit(print_length-1))
+      print_length--;
   }
+  print_times = times;
+  print_wait_time = 0;
+  start_number();
 }
 
 
@@ -1081,25 +1874,217 @@ unsigned int hexbright::get_input_digit() {
 }
 
 void hexbright::input_digit(unsigned int min_digit, unsigned int max_digit) {
-  unsigned int tmp2 = 999 - atan2(vector(0)[0], vector(0)[2])*159 - 500; // scale from 0-999, counterclockwise = higher
-  tmp2 = (tmp2*(max_digit-min_digit))/1000+min_digit;
+  // a quarter turn from straight down is 0; clockwise = higher
+  unsigned char angle = get_rotation_angle()+64;
+  unsigned int tmp2 = ((long)angle*(max_digit-min_digit))/256+min_digit;
   if(tmp2 == read_value) {
     if(!printing_number()) {
       print_number(tmp2);
     }
   } else {
     reset_print_number();
-    set_led(GLED,100);
+    set_led(GLED, 100, 100, 255, LED_PRINT);
   }
   read_value = tmp2; 
 }
 #endif // ACCELEROMETER
 #endif // (defined(LED) && defined(PRINT_NUMBER))
 
+#ifdef MORSE
+//// Morse code
+// Each code is sent from bit 0 up, 1 for a dash and 0 for a dot; the highest
+//  1 marks the end.  'A' (.-) is 0b110.
+#define MORSE_FIRST ','
+#define MORSE_LAST 'Z'
+static const unsigned char morse_codes[] PROGMEM = {
+  0x73, // , --..--
+  0x61, // - -....-
+  0x6A, // . .-.-.-
+  0x29, // / -..-.
+  0x3F, // 0 -----
+  0x3E, // 1 .----
+  0x3C, // 2 ..---
+  0x38, // 3 ...--
+  0x30, // 4 ....-
+  0x20, // 5 .....
+  0x21, // 6 -....
+  0x23, // 7 --...
+  0x27, // 8 ---..
+  0x2F, // 9 ----.
+  0x47, // : ---...
+  0x55, // ; -.-.-.
+  0,    // <
+  0x31, // = -...-
+  0,    // >
+  0x4C, // ? ..--..
+  0x56, // @ .--.-.
+  0x06, // A .-
+  0x11, // B -...
+  0x15, // C -.-.
+  0x09, // D -..
+  0x02, // E .
+  0x14, // F ..-.
+  0x0B, // G --.
+  0x10, // H ....
+  0x04, // I ..
+  0x1E, // J .---
+  0x0D, // K -.-
+  0x12, // L .-..
+  0x07, // M --
+  0x05, // N -.
+  0x0F, // O ---
+  0x16, // P .--.
+  0x1B, // Q --.-
+  0x0A, // R .-.
+  0x08, // S ...
+  0x03, // T -
+  0x0C, // U ..-
+  0x18, // V ...-
+  0x0E, // W .--
+  0x19, // X -..-
+  0x1D, // Y -.--
+  0x13, // Z --..
+};
+
+const char* morse_text = NULL; // NULL when we aren't sending
+BOOL morse_progmem;
+int morse_position; // the next character to read
+unsigned char morse_code; // what's left of this character, 0 at the start of the text
+unsigned char morse_wait = 0; // updates left in this element or gap
+BOOL morse_on = false; // in an element (dot or dash)
+unsigned char morse_dot; // in updates
+#define MORSE_MIN_WPM 4 // a word gap (6 dots) still fits in morse_wait
+#define MORSE_MAX_WPM 144 // a dot is still an update
+unsigned char morse_times;
+unsigned char morse_output_to;
+int morse_level;
+
+void hexbright::print_morse(const char* text, unsigned char output, unsigned char wpm, int level, unsigned char times) {
+  start_morse(text, false, output, wpm, level, times);
+}
+
+void hexbright::print_morse_P(const char* text, unsigned char output, unsigned char wpm, int level, unsigned char times) {
+  start_morse(text, true, output, wpm, level, times);
+}
+
+void hexbright::start_morse(const char* text, BOOL progmem, unsigned char output,
+                            unsigned char wpm, int level, unsigned char times) {
+  if(!wpm) {
+    stop_morse(); // no speed to send at
+    return;
+  }
+  morse_update = update_morse;
+  morse_text = text;
+  morse_progmem = progmem;
+  morse_output_to = output;
+  if(wpm<MORSE_MIN_WPM)
+    wpm = MORSE_MIN_WPM;
+  else if(wpm>MORSE_MAX_WPM)
+    wpm = MORSE_MAX_WPM;
+  morse_dot = 1200/update_delay/wpm;
+  morse_level = level;
+  morse_times = times;
+  morse_position = 0;
+  morse_code = 0;
+  morse_wait = 0;
+  morse_on = false;
+}
+
+BOOL hexbright::printing_morse() {
+  return morse_text!=NULL;
+}
+
+int hexbright::get_morse_position() {
+  if(!morse_text)
+    return -1;
+  // morse_position has moved past the character being sent
+  return morse_position ? morse_position-1 : 0;
+}
+
+void hexbright::stop_morse() {
+  if(morse_text) {
+    if(morse_output_to==MORSE_LIGHT)
+      set_light(0, 0, NOW);
+#ifdef LED
+    else
+      set_led(morse_output_to, 0, 0, 255, LED_PRINT); // let the layers below through
+#endif
+  }
+  morse_text = NULL;
+}
+
+void hexbright::morse_output(BOOL on, unsigned char updates) {
+  morse_wait = updates;
+  morse_on = on;
+  if(morse_output_to==MORSE_LIGHT) {
+    int level = on ? morse_level : 0;
+    set_light(level, level, NOW);
+#ifdef LED
+  } else {
+    // +1 ms, so set_led rounds back to updates.  Gaps are waits, so we keep
+    //  the led until we're done.
+    int time = updates*update_delay+1;
+    if(on)
+      set_led(morse_output_to, time, 0, 255, LED_PRINT);
+    else
+      set_led(morse_output_to, 0, time, 255, LED_PRINT);
+#endif
+  }
+}
+
+void hexbright::update_morse() {
+  if(!morse_text || (morse_wait && --morse_wait))
+    return;
+  if(morse_on) { // each element ends with a dot of silence
+    morse_output(false, morse_dot);
+    return;
+  }
+  while(morse_code<=1) { // on to the next character
+    char c = morse_progmem ? pgm_read_byte((const unsigned char*)morse_text+morse_position) : morse_text[morse_position];
+    morse_position++;
+    if(!c) { // the end: a word of silence, then maybe again
+      if(morse_times!=1) {
+        if(morse_times)
+          morse_times--;
+        morse_position = 0;
+        morse_code = 0;
+        morse_output(false, morse_dot*6);
+      } else {
+        stop_morse();
+      }
+      return;
+    }
+    if(c>='a' && c<='z')
+      c += 'A'-'a';
+    if(c==' ') { // 7 dots between words, one of which we've had
+      morse_code = 0;
+      morse_output(false, morse_dot*6);
+      return;
+    }
+    if(c>=MORSE_FIRST && c<=MORSE_LAST) {
+      unsigned char code = pgm_read_byte(&morse_codes[c-MORSE_FIRST]);
+      if(code) {
+        BOOL gap = morse_code; // 0 at the start of the text or a word
+        morse_code = code;
+        if(gap) { // 3 dots between characters
+          morse_output(false, morse_dot*2);
+          return;
+        }
+      }
+    }
+  }
+#if (DEBUG==DEBUG_MORSE)
+  Serial.print(morse_code&1 ? "-" : ".");
+#endif
+  morse_output(true, morse_code&1 ? morse_dot*3 : morse_dot);
+  morse_code >>= 1;
+}
+#endif // MORSE
+
 void hexbright::print_power() {
   print_charge(GLED);
-  if (low_voltage_state() && get_led_state(RLED) == LED_OFF) {
-    set_led(RLED,50,1000);
+  if (low_voltage_state() && get_led_state(RLED, LED_STATUS) == LED_OFF) {
+    set_led(RLED, 50, 1000, 255, LED_STATUS);
   }
 }
 
@@ -1108,60 +2093,204 @@ void hexbright::print_power() {
 ////////////////TEMPERATURE////////////////////
 ///////////////////////////////////////////////
 
+// The sensor is read every update.  Readings are summed in blocks of 64;
+//  oversampling by 4^n gives n extra bits, so a block is 3 bits better than a
+//  single reading.  Each block replaces the filtered value when it completes,
+//  so filtered readings are 533 ms behind at most.
+#define THERMAL_SAMPLE_BITS 6 // 64 readings per block; 64*1023 still fits in a word
+#define THERMAL_EXTRA_BITS 3 // half of THERMAL_SAMPLE_BITS
+
 int thermal_sensor_value = 0;
+int thermal_filtered = -1; // in 1/8ths of a reading, -1 until the first reading
+word thermal_sum = 0;
+unsigned char thermal_count = 0;
+
 void hexbright::read_thermal_sensor() {
   // do not call this directly.  Call get_temperature()
   // read temperature setting
   // device data sheet: http://ww1.microchip.com/downloads/en/devicedoc/21942a.pdf
   
   thermal_sensor_value = read_adc(APIN_TEMP);
+  if(thermal_filtered<0) // don't wait for a full block when we start
+    thermal_filtered = thermal_sensor_value<<THERMAL_EXTRA_BITS;
+  thermal_sum += thermal_sensor_value;
+  if(++thermal_count==(1<<THERMAL_SAMPLE_BITS)) {
+    thermal_filtered = thermal_sum>>(THERMAL_SAMPLE_BITS-THERMAL_EXTRA_BITS);
+    thermal_sum = 0;
+    thermal_count = 0;
+  }
 }
 
 int hexbright::get_thermal_sensor() {
   return thermal_sensor_value;
 }
 
-int hexbright::get_celsius() {
-  // 0C ice water bath for 20 minutes: 153.
-  // 40C water bath for 20 minutes (measured by medical thermometer): 275
-  // intersection with 0: 50 = (40C-0C)/(275-153)*153
-  
-  // 40.05 is to force the division to floating point.  The extra parenthesis are to
-  //  tell the compiler to pre-evaluate the expression.
-  return thermal_sensor_value * ((40.05-0)/(275-153)) - 50;
+int hexbright::get_filtered_thermal_sensor() {
+  return thermal_filtered;
+}
+
+/// calibration
+// Two points, each a filtered reading (1/8ths) and a temperature (tenths of
+//  a degree celsius).  We keep the first point and the slope, in 1/1024ths of
+//  a tenth per 1/8th, so converting is a multiply and a shift.
+#define TEMP_CALIBRATION_VERSION 1
+#define TEMP_CALIBRATION_SIZE 10
+#define TEMP_SLOPE_SHIFT 10
+// the defaults, measured on one unit (see get_celsius_tenths)
+#define TEMP_DEFAULT_READING0 (153<<THERMAL_EXTRA_BITS)
+#define TEMP_DEFAULT_TENTHS0 0
+#define TEMP_DEFAULT_READING1 (275<<THERMAL_EXTRA_BITS)
+#define TEMP_DEFAULT_TENTHS1 400
+#define TEMP_MIN_SPAN 100 // tenths of a degree between the points
+
+int temp_reading0 = TEMP_DEFAULT_READING0;
+int temp_tenths0 = TEMP_DEFAULT_TENTHS0;
+int temp_slope = 0;
+int overheat_reading = 0; // OVERHEAT_TEMPERATURE, in 1/8ths of a reading
+
+static int read_eeprom_int(int address) {
+  return eeprom_read_byte((uint8_t*)(size_t)address) | (eeprom_read_byte((uint8_t*)(size_t)(address+1))<<8);
+}
+
+static void write_eeprom_int(int address, int value) {
+  eeprom_write_byte((uint8_t*)(size_t)address, value);
+  eeprom_write_byte((uint8_t*)(size_t)(address+1), value>>8);
+}
+
+// sets up the conversion, returns false if the points are unusable
+static BOOL use_temperature_points(int reading0, int tenths0, int reading1, int tenths1) {
+  if(abs(tenths1-tenths0)<TEMP_MIN_SPAN || (reading1-reading0)*(long)(tenths1-tenths0)<=0)
+    return false;
+  temp_reading0 = reading0;
+  temp_tenths0 = tenths0;
+  temp_slope = (((long)(tenths1-tenths0)<<TEMP_SLOPE_SHIFT) + (reading1-reading0)/2)/(reading1-reading0);
+  overheat_reading = reading0 + ((long)(OVERHEAT_TEMPERATURE*10-tenths0)*(reading1-reading0))/(tenths1-tenths0);
+  return true;
+}
+
+void hexbright::load_temperature_calibration() {
+  int address = EEPROM_TEMP_CALIBRATION;
+  if(eeprom_read_byte((uint8_t*)(size_t)address)!=TEMP_CALIBRATION_VERSION ||
+     eeprom_checksum(address, TEMP_CALIBRATION_SIZE-1)!=eeprom_read_byte((uint8_t*)(size_t)(address+TEMP_CALIBRATION_SIZE-1)) ||
+     !use_temperature_points(read_eeprom_int(address+1), read_eeprom_int(address+3),
+                             read_eeprom_int(address+5), read_eeprom_int(address+7)))
+    use_temperature_points(TEMP_DEFAULT_READING0, TEMP_DEFAULT_TENTHS0,
+                           TEMP_DEFAULT_READING1, TEMP_DEFAULT_TENTHS1);
+}
+
+BOOL hexbright::calibrate_temperature(unsigned char point, int celsius_tenths) {
+  if(point>1)
+    return false; // there are only two points
+  int address = EEPROM_TEMP_CALIBRATION;
+  // start from the saved points, or the defaults
+  int points[] = {TEMP_DEFAULT_READING0, TEMP_DEFAULT_TENTHS0, TEMP_DEFAULT_READING1, TEMP_DEFAULT_TENTHS1};
+  if(eeprom_read_byte((uint8_t*)(size_t)address)==TEMP_CALIBRATION_VERSION &&
+     eeprom_checksum(address, TEMP_CALIBRATION_SIZE-1)==eeprom_read_byte((uint8_t*)(size_t)(address+TEMP_CALIBRATION_SIZE-1))) {
+    for(int i=0; i<4; i++)
+      points[i] = read_eeprom_int(address+1+i*2);
+  }
+  points[point*2] = thermal_filtered;
+  points[point*2+1] = celsius_tenths;
+  if(!use_temperature_points(points[0], points[1], points[2], points[3])) {
+    load_temperature_calibration(); // keep what we had
+    return false;
+  }
+  eeprom_write_byte((uint8_t*)(size_t)address, TEMP_CALIBRATION_VERSION);
+  for(int i=0; i<4; i++)
+    write_eeprom_int(address+1+i*2, points[i]);
+  eeprom_write_byte((uint8_t*)(size_t)(address+TEMP_CALIBRATION_SIZE-1), eeprom_checksum(address, TEMP_CALIBRATION_SIZE-1));
+  return true;
+}
+
+void hexbright::clear_temperature_calibration() {
+  eeprom_write_byte((uint8_t*)EEPROM_TEMP_CALIBRATION, 0xFF);
+  load_temperature_calibration();
 }
 
+int hexbright::get_celsius_tenths() {
+  long offset = ((long)thermal_filtered-temp_reading0)*temp_slope + (1<<(TEMP_SLOPE_SHIFT-1)); // rounded
+  return temp_tenths0 + (int)(offset>>TEMP_SLOPE_SHIFT);
+}
+
+int hexbright::get_celsius() {
+  return get_celsius_tenths()/10;
+}
 
 int hexbright::get_fahrenheit() {
-  //return get_celsius()*18/10+32;
-  // algebraic form of (get_celsius' formula)*18/10+32
-  // I was lazy and pasted (x*((40.05-0)/(275-153)) - 50)*18/10+32 into wolfram alpha
-  return .590902*thermal_sensor_value-58;
+  // tenths*18/100+32
+  return (get_celsius_tenths()*9)/50+32;
+}
+
+#ifdef THERMAL_MODEL
+// The sensor is on the board, not the LED; it takes minutes to catch up with
+//  a change in light level.  We model the sensor's rise above ambient as a
+//  first order lag of the light level: at a constant level it heads toward
+//  level*THERMAL_MODEL_RISE/MAX_LEVEL, covering 2^-THERMAL_MODEL_TAU_SHIFT of the
+//  remaining distance each update.  The rise still to come in the next
+//  THERMAL_MODEL_LOOKAHEAD updates is added to the filtered reading, so we
+//  throttle before the sensor gets there.  Because the model only supplies the rise still to
+//  come, the measured reading takes care of ambient and any modelling error.
+// The parameters are fitted from logs (see experiments/thermal_readings); the
+//  ones below are placeholders until that's been done on real units.
+#define THERMAL_MODEL_RISE 1460 // 1/8ths of a reading, at MAX_LEVEL (~60C)
+#define THERMAL_MODEL_TAU_SHIFT 14 // 2^14 updates, 137 seconds
+#define THERMAL_MODEL_LOOKAHEAD 600 // updates, 5 seconds
+#define THERMAL_MODEL_FRACTION 16 // bits below 1/8ths of a reading in thermal_model
+
+long thermal_model = 0; // the modelled rise, in 1/8ths of a reading << THERMAL_MODEL_FRACTION
+int thermal_pending = 0; // the rise still to come in the lookahead, in 1/8ths of a reading
+
+void hexbright::update_thermal_model() {
+  int level = get_max_light_level();
+  level = level < 0 ? 0 : level; // OFF_LEVEL
+  long target = (long)level*THERMAL_MODEL_RISE/MAX_LEVEL;
+  thermal_model += ((target<<THERMAL_MODEL_FRACTION)-thermal_model)>>THERMAL_MODEL_TAU_SHIFT;
+  // for lookaheads much shorter than the time constant, the lag covers
+  //  about LOOKAHEAD/TAU of the remaining distance
+  thermal_pending = ((target-(thermal_model>>THERMAL_MODEL_FRACTION))*THERMAL_MODEL_LOOKAHEAD)>>THERMAL_MODEL_TAU_SHIFT;
+  // Cooling we expect is left to the reading: counting on it would raise the
+  //  throttle threshold, and a model that's wrong would let us overheat.
+  if(thermal_pending<0)
+    thermal_pending = 0;
+}
+
+int hexbright::get_predicted_thermal_sensor() {
+  return thermal_filtered+thermal_pending;
 }
+#else
+int hexbright::get_predicted_thermal_sensor() {
+  return thermal_filtered;
+}
+#endif // THERMAL_MODEL
 
 // If the ambient temperature is above your max temp, your light is going to be pretty dim...
 
 void hexbright::detect_overheating() {
-  unsigned int temperature = get_thermal_sensor();
-  
-  max_light_level = max_light_level+(OVERHEAT_TEMPERATURE-temperature);
+#ifdef THERMAL_MODEL
+  update_thermal_model();
+#endif
+  // the filtered reading (plus what's on the way), so we don't chase noise,
+  //  against the calibrated overheat reading, so every unit throttles at the
+  //  same temperature.
+  max_light_level = max_light_level+((overheat_reading-get_predicted_thermal_sensor())>>THERMAL_EXTRA_BITS);
   // min, max levels...
   max_light_level = max_light_level > MAX_LEVEL ? MAX_LEVEL : max_light_level;
   max_light_level = max_light_level < MIN_OVERHEAT_LEVEL ? MIN_OVERHEAT_LEVEL : max_light_level;
 #if (DEBUG==DEBUG_TEMP)
-  static float printed_temperature = 0;
-  static float average_temperature = -1;
-  if(average_temperature < 0) {
-    average_temperature = temperature;
+  static int printed_temperature = -1;
+  if(printed_temperature < 0) {
     Serial.println("Have you calibrated your thermometer?");
-    Serial.println("Instructions are in get_celsius.");
+    Serial.println("Instructions are in programs/temperature_calibration.");
   }
-  average_temperature = (average_temperature*4+temperature)/5;
-  if (abs(printed_temperature-average_temperature)>1) {
-    printed_temperature = average_temperature;
+  if (abs(printed_temperature-thermal_filtered)>=(1<<THERMAL_EXTRA_BITS)) {
+    printed_temperature = thermal_filtered;
     Serial.print(millis());
-    Serial.print(" ms, average reading: ");
-    Serial.print(printed_temperature);
+    Serial.print(" ms, filtered reading: ");
+    Serial.print(thermal_filtered/(float)(1<<THERMAL_EXTRA_BITS));
+#ifdef THERMAL_MODEL
+    Serial.print(", predicted: ");
+    Serial.print(get_predicted_thermal_sensor()/(float)(1<<THERMAL_EXTRA_BITS));
+#endif
     Serial.print(" (celsius: ");
     Serial.print(get_celsius());
     Serial.print(") (fahrenheit: ");
@@ -1177,12 +2306,10 @@ void hexbright::detect_overheating() {
 ///////////////////////////////////////////////
 
 int band_gap_reading = 0;
-int lowest_band_gap_reading = 1000;
 
 void hexbright::read_avr_voltage() {
   band_gap_reading = read_adc(APIN_BAND_GAP);
-  if(get_charge_state()==BATTERY)
-    lowest_band_gap_reading = band_gap_reading < lowest_band_gap_reading ? band_gap_reading : lowest_band_gap_reading;
+  estimate_battery();
 }
 
 int hexbright::get_avr_voltage() {
@@ -1191,23 +2318,671 @@ int hexbright::get_avr_voltage() {
   return ((long)1023*1100) / band_gap_reading;
 }
 
-BOOL hexbright::low_voltage_state() {
-  static BOOL low = false;
-  // lower band gap value corresponds to a higher voltage, trigger 
-  //  low voltage state if band gap value goes too high.
-  // I have a value of 2 for this to work (with a 150 ms delay in read_adc).
-  //  tighter control means earlier detection of low battery state
-  if (band_gap_reading > lowest_band_gap_reading+2) {
-    low = true;
+
+///////////////////////////////////////////////
+//////////////////BATTERY//////////////////////
+///////////////////////////////////////////////
+
+// Current drawn by the whole light at each light level, in tenths of a
+//  milliamp, every 50 levels (0 is really level 1; level 0 is
+//  LEVEL_0_CURRENT).  Levels up to 500 are measured (experiments/power_draw);
+//  above that, the driver's high mode is scaled by pwm from 500 (LOW 255 is
+//  about HIGH 48).
+const word light_current_table[] PROGMEM = {84, 115, 182, 301, 475, 695, 977, 1325, 1751, 2238, 2830,
+                                            3017, 3524, 4184, 5021, 6057, 7316, 8821, 10594, 12658, 15037};
+#define LEVEL_0_CURRENT 54
+#define LIGHT_CURRENT_STEP 50
+
+word hexbright::light_current(int level) {
+  if(level<=0)
+    return level==0 ? LEVEL_0_CURRENT : 2; // OFF_LEVEL
+  unsigned char i = level/LIGHT_CURRENT_STEP;
+  word current = pgm_read_word(light_current_table+i);
+  if(i<sizeof(light_current_table)/sizeof(word)-1)
+    current += ((long)(pgm_read_word(light_current_table+i+1)-current)*(level%LIGHT_CURRENT_STEP))/LIGHT_CURRENT_STEP;
+  return current;
+}
+
+// The avr runs from a 3.3V regulator, so we can only see the battery once it
+//  falls below that: the last 40 mAh or so, 8 minutes at level 500.  Under
+//  load the battery sags, so we add back the sag (current*BATTERY_RESISTANCE)
+//  to get the voltage we'd see at rest, and look up the charge that's left in
+//  a discharge curve.  Both are fitted from experiments/voltage_readings: the
+//  logs run until the light dies, so we know how much charge was left at
+//  each reading (experiments/voltage_readings/discharge_analyze generates
+//  battery_tables.h from them).  The percent and minutes are of that reserve;
+//  above it, we report 100%.
+// The band gap differs by up to 10% between parts, so the voltage is
+//  measured against this unit's own reading at the regulator's ceiling
+//  (BATTERY_CEILING): the lowest band gap block we've seen.  RAM is cleared
+//  every time the light turns off, so the reference is kept in EEPROM
+//  (EEPROM_BATTERY_REFERENCE), saved when we turn off if it changed.  Until
+//  a light has once been turned off after running above the ceiling, its
+//  first block is the reference, so a light that starts on a low battery
+//  reads high.
+// The band gap is noisy, so readings are averaged over blocks of 64 updates,
+//  then smoothed; on battery, the estimate only goes down once several
+//  blocks in a row agree, and never goes back up.
+#define BATTERY_SAMPLE_BITS 6 // 64 readings per block; 64*1023 fits in a word
+#define BATTERY_SMOOTHING_BITS 3 // each block moves the estimate 1/8 of the way
+#define BATTERY_LOW_BLOCKS 4 // about 2 seconds
+// BATTERY_RESISTANCE, the curve and BATTERY_RESERVE are in battery_tables.h
+#define BATTERY_CURVE_POINTS (sizeof(battery_curve)/sizeof(battery_curve[0]))
+// The maximum level falls from MAX_LEVEL at 100% to MIN_BATTERY_LEVEL at 0%;
+//  half way, it's about where the old low voltage clamp was (500).
+#define MIN_BATTERY_LEVEL 100
+
+word battery_band_gap_sum = 0;
+word battery_reference = 0xFFFF; // the lowest block sum: the regulator's ceiling
+word battery_saved_reference = 0xFFFF; // what's in EEPROM
+unsigned char battery_low_blocks = 0;
+word battery_level_sum = 0;
+unsigned char battery_count = 0;
+int battery_voltage = 0; // mV at rest, 0 until the first block
+unsigned char battery_remaining = BATTERY_RESERVE; // mAh
+
+void hexbright::load_battery_reference() {
+  int address = EEPROM_BATTERY_REFERENCE;
+  battery_reference = 0xFFFF;
+  if(eeprom_checksum(address, 2)==eeprom_read_byte((uint8_t*)(size_t)(address+2)))
+    battery_reference = read_eeprom_int(address);
+  battery_saved_reference = battery_reference;
+}
+
+void hexbright::save_battery_reference() {
+  // it only changes while it settles, so this rarely writes anything
+  if(battery_reference==battery_saved_reference)
+    return;
+  int address = EEPROM_BATTERY_REFERENCE;
+  write_eeprom_int(address, battery_reference);
+  eeprom_write_byte((uint8_t*)(size_t)(address+2), eeprom_checksum(address, 2));
+  battery_saved_reference = battery_reference;
+}
+
+void hexbright::estimate_battery() {
+  int level = get_max_light_level();
+  battery_band_gap_sum += band_gap_reading;
+  battery_level_sum += level < 0 ? 0 : level;
+  if(++battery_count<(1<<BATTERY_SAMPLE_BITS))
+    return;
+  level = battery_level_sum>>BATTERY_SAMPLE_BITS;
+  // a lower band gap reading is a higher voltage
+  if(battery_band_gap_sum<battery_reference)
+    battery_reference = battery_band_gap_sum;
+  int voltage = ((long)BATTERY_CEILING*battery_reference)/battery_band_gap_sum;
+  voltage += ((long)light_current(level)*BATTERY_RESISTANCE)/10000;
+  battery_band_gap_sum = 0;
+  battery_level_sum = 0;
+  battery_count = 0;
+
+  if(!battery_voltage)
+    battery_voltage = voltage;
+  battery_voltage += (voltage-battery_voltage)>>BATTERY_SMOOTHING_BITS;
+
+  unsigned char remaining = BATTERY_RESERVE;
+  if(battery_voltage<BATTERY_CURVE_BOTTOM) {
+    remaining = 0;
+  } else {
+    unsigned char i = (battery_voltage-BATTERY_CURVE_BOTTOM)/BATTERY_CURVE_STEP;
+    if(i<BATTERY_CURVE_POINTS-1) {
+      unsigned char low = pgm_read_byte(battery_curve+i);
+      remaining = low + ((pgm_read_byte(battery_curve+i+1)-low)*((battery_voltage-BATTERY_CURVE_BOTTOM)%BATTERY_CURVE_STEP))/BATTERY_CURVE_STEP;
+    }
+  }
+  // voltage recovers when the load goes away, and some cells bounce around;
+  //  only a charger gives us charge back
+  if(get_charge_state()!=BATTERY) {
+    battery_remaining = remaining;
+    battery_low_blocks = 0;
+  } else if(remaining>=battery_remaining) {
+    battery_low_blocks = 0;
+  } else if(++battery_low_blocks>=BATTERY_LOW_BLOCKS) {
+    battery_remaining = remaining;
+    battery_low_blocks = 0;
   }
-  return low;
+#if (DEBUG==DEBUG_BATTERY)
+  Serial.print("Battery: ");
+  Serial.print(voltage);
+  Serial.print(" mV at rest, smoothed: ");
+  Serial.print(battery_voltage);
+  Serial.print(", ");
+  Serial.print(get_battery_percent());
+  Serial.print("%, ");
+  Serial.print(get_battery_minutes());
+  Serial.println(" minutes");
+#ifdef CHARGE_COUNTER
+  Serial.print("Charge used: ");
+  Serial.print(get_charge_used());
+  Serial.print(" mAh, ");
+  Serial.print(get_current());
+  Serial.print(" tenths of a mA, ");
+  Serial.print(get_runtime_minutes());
+  Serial.println(" minutes left");
+#endif
+#endif
+}
+
+unsigned char hexbright::get_battery_percent() {
+  return battery_remaining*100/BATTERY_RESERVE;
+}
+
+int hexbright::get_battery_minutes() {
+  // mAh*60/mA, current in tenths
+  return ((long)battery_remaining*600)/light_current(get_max_light_level());
+}
+
+BOOL hexbright::low_voltage_state() {
+  return battery_remaining<BATTERY_RESERVE;
 }
 
 void hexbright::detect_low_battery() {
-  if (low_voltage_state() == true && max_light_level>500) {
-    max_light_level = 500;
+  int level = MIN_BATTERY_LEVEL+((long)(MAX_LEVEL-MIN_BATTERY_LEVEL)*battery_remaining)/BATTERY_RESERVE;
+  if (max_light_level>level) {
+    max_light_level = level;
+  }
+}
+
+
+#ifdef SETTINGS
+///////////////////////////////////////////////
+///////////////////SETTINGS////////////////////
+///////////////////////////////////////////////
+
+// Settings are appended as records (id, value low, value high, crc) to a
+//  ring of SETTINGS_SLOTS.  The two slots after the newest record are empty
+//  (id 0xFF); the first of them is how we find our place at boot.  Each
+//  write empties the slot after those two, so the gap moves along the ring.
+//  If that slot holds the only copy of a setting, the write copies that
+//  setting to the front instead, and the slot is only emptied once the copy
+//  is complete.  So the ring only fills if every slot but two holds a
+//  different setting.
+// Writes are split into steps of one byte, done whenever EEPROM is ready:
+//  the value and crc, the id, so a record only counts once it's complete,
+//  then the slot after the gap.  If we lose power part way through, we have
+//  the previous value.
+// The library's own settings have ids after the sketch's.
+#define SETTINGS_FORMAT 0xA2 // change if the record layout changes
+#define SETTINGS_RECORD 4
+#define SETTINGS_SLOTS ((EEPROM_SETTINGS_END-EEPROM_SETTINGS-1)/SETTINGS_RECORD)
+#define SETTINGS_EMPTY 0xFF
+#define SETTINGS_ADDRESS(slot) (EEPROM_SETTINGS+1+(slot)*SETTINGS_RECORD)
+#define SETTINGS_NEXT(slot) ((slot)+1<SETTINGS_SLOTS ? (slot)+1 : 0)
+#define SETTING_CHARGE_USED SETTING_IDS // 1/16ths of a mAh (CHARGE_COUNTER)
+#define SETTINGS_STORED (SETTING_IDS+1) // ids that can have records
+
+int setting_values[SETTINGS_STORED];
+unsigned char setting_slots[SETTINGS_STORED]; // where the newest record is, SETTINGS_EMPTY if never set
+word settings_dirty = 0; // a bit for each id we need to write
+unsigned char settings_head = 0; // the empty slot we write to next
+unsigned char settings_job = SETTINGS_EMPTY; // the id we're writing
+unsigned char settings_step = 0;
+int settings_job_value;
+
+static unsigned char settings_crc(unsigned char id, int value) {
+  // crc-8 (x^8+x^2+x+1), seeded with the format
+  unsigned char crc = SETTINGS_FORMAT;
+  unsigned char bytes[] = {id, (unsigned char)value, (unsigned char)(value>>8)};
+  for(unsigned char i=0; i<sizeof(bytes); i++) {
+    crc ^= bytes[i];
+    for(unsigned char bit=0; bit<8; bit++)
+      crc = crc&0x80 ? (crc<<1)^0x07 : crc<<1;
+  }
+  return crc;
+}
+
+static unsigned char settings_read(int address) {
+  return eeprom_read_byte((uint8_t*)(size_t)address);
+}
+
+void hexbright::load_settings() {
+  for(unsigned char id=0; id<SETTINGS_STORED; id++)
+    setting_slots[id] = SETTINGS_EMPTY;
+  if(settings_read(EEPROM_SETTINGS)!=SETTINGS_FORMAT) {
+    // left over from a sketch, or an older layout; start over.  This blocks,
+    //  but only happens once.
+    for(unsigned char slot=0; slot<SETTINGS_SLOTS; slot++)
+      eeprom_write_byte((uint8_t*)(size_t)SETTINGS_ADDRESS(slot), SETTINGS_EMPTY);
+    eeprom_write_byte((uint8_t*)EEPROM_SETTINGS, SETTINGS_FORMAT);
+    settings_head = 0;
+    return;
+  }
+  // the head is the empty slot after the newest record
+  settings_head = 0;
+  unsigned char previous = settings_read(SETTINGS_ADDRESS(SETTINGS_SLOTS-1));
+  for(unsigned char slot=0; slot<SETTINGS_SLOTS; slot++) {
+    unsigned char id = settings_read(SETTINGS_ADDRESS(slot));
+    if(id==SETTINGS_EMPTY && previous!=SETTINGS_EMPTY) {
+      settings_head = slot;
+      break;
+    }
+    previous = id;
+  }
+  // if the slot after that isn't empty too, we lost power before a write
+  //  finished emptying it; it's never the only copy of a setting
+  if(settings_read(SETTINGS_ADDRESS(SETTINGS_NEXT(settings_head)))!=SETTINGS_EMPTY)
+    eeprom_write_byte((uint8_t*)(size_t)SETTINGS_ADDRESS(SETTINGS_NEXT(settings_head)), SETTINGS_EMPTY);
+  // oldest to newest, so the newest record for each id wins
+  for(unsigned char slot=SETTINGS_NEXT(settings_head); slot!=settings_head; slot=SETTINGS_NEXT(slot)) {
+    int address = SETTINGS_ADDRESS(slot);
+    unsigned char id = settings_read(address);
+    int value = (short)(settings_read(address+1) | (settings_read(address+2)<<8));
+    if(id<SETTINGS_STORED && settings_read(address+3)==settings_crc(id, value)) {
+      setting_values[id] = value;
+      setting_slots[id] = slot;
+    }
+  }
+}
+
+// any id, the library's included
+static int stored_setting(unsigned char id, int default_value) {
+  return setting_slots[id]==SETTINGS_EMPTY && !(settings_dirty&(1<<id)) ? default_value : setting_values[id];
+}
+
+static void store_setting(unsigned char id, int value) {
+  if(setting_values[id]==value && (setting_slots[id]!=SETTINGS_EMPTY || settings_dirty&(1<<id)))
+    return; // nothing changed
+  setting_values[id] = value;
+  settings_dirty |= 1<<id;
+}
+
+int hexbright::get_setting(unsigned char id, int default_value) {
+  return id<SETTING_IDS ? stored_setting(id, default_value) : default_value;
+}
+
+void hexbright::set_setting(unsigned char id, int value) {
+  if(id<SETTING_IDS)
+    store_setting(id, value);
+}
+
+BOOL hexbright::settings_saved() {
+  return !settings_dirty && settings_job==SETTINGS_EMPTY;
+}
+
+void hexbright::write_settings() {
+  if((!settings_dirty && settings_job==SETTINGS_EMPTY) || !eeprom_is_ready())
+    return;
+  unsigned char next = SETTINGS_NEXT(settings_head);
+  unsigned char after_gap = SETTINGS_NEXT(next);
+  if(settings_job==SETTINGS_EMPTY) {
+    // if the slot we're about to empty holds a setting's newest record,
+    //  copy that setting first
+    for(settings_job=0; settings_job<SETTINGS_STORED; settings_job++)
+      if(setting_slots[settings_job]==after_gap)
+        break;
+    if(settings_job==SETTINGS_STORED) {
+      for(settings_job=0; !(settings_dirty&(1<<settings_job)); settings_job++)
+        ;
+    }
+    settings_dirty &= ~(1<<settings_job);
+    settings_job_value = setting_values[settings_job];
+    settings_step = 0;
+  }
+  int address = SETTINGS_ADDRESS(settings_head);
+  switch(settings_step++) {
+  case 0:
+    eeprom_write_byte((uint8_t*)(size_t)(address+1), (unsigned char)settings_job_value);
+    break;
+  case 1:
+    eeprom_write_byte((uint8_t*)(size_t)(address+2), (unsigned char)(settings_job_value>>8));
+    break;
+  case 2:
+    eeprom_write_byte((uint8_t*)(size_t)(address+3), settings_crc(settings_job, settings_job_value));
+    break;
+  case 3:
+    // the record counts from here on, and the next slot is still empty
+    eeprom_write_byte((uint8_t*)(size_t)address, settings_job);
+    setting_slots[settings_job] = settings_head;
+    break;
+  default:
+    // nothing's newest record is here any more (a copy was just made)
+    eeprom_write_byte((uint8_t*)(size_t)SETTINGS_ADDRESS(after_gap), SETTINGS_EMPTY);
+    settings_head = next;
+    settings_job = SETTINGS_EMPTY;
+  }
+}
+
+void hexbright::flush_settings() {
+  // we're about to lose power
+  while(!settings_saved())
+    write_settings();
+}
+#endif // SETTINGS
+
+
+#ifdef CHARGE_COUNTER
+///////////////////////////////////////////////
+////////////////CHARGE USED////////////////////
+///////////////////////////////////////////////
+
+// We add up the current we expect to draw each update (experiments/power_draw):
+//  the light level (which covers DRV_MODE; high mode is above 500), the
+//  rear leds at their brightness, and the accelerometer.  Charge is kept in
+//  1/256ths of a mAh; CHARGE_UNIT is that many hundredths of a milliamp for
+//  one update (1/120th of a second).
+#define CHARGE_UNIT 168750 // 100*3600*120/256
+#define BATTERY_CAPACITY 2400 // mAh, a new cell
+#define GLED_CURRENT 990 // hundredths of a milliamp, at full brightness
+#define RLED_CURRENT 380
+#define ACCEL_CURRENT 25
+#define ACCEL_SLEEP_CURRENT 5 // 8 samples/second, from the datasheet
+
+// Kept through resets; the check tells us if RAM was cleared by a power cut.
+//  A power cut on battery only happens when we turn ourselves off, so we
+//  save to EEPROM then.  With SETTINGS, that's a record in the settings ring,
+//  so turning off doesn't keep rewriting the same bytes.
+NOINIT unsigned long charge_used; // 1/256ths of a mAh
+NOINIT unsigned long charge_used_check; // ~charge_used
+NOINIT unsigned long charge_fraction; // hundredths of a milliamp-update
+
+static unsigned long current_draw() {
+  static int level = CURRENT_LEVEL; // not a level, so we look it up
+  static word light = 0;
+  if(hexbright::get_max_light_level()!=level) {
+    level = hexbright::get_max_light_level();
+    light = hexbright::light_current(level);
+  }
+  unsigned long current = light*10L;
+#ifdef LED
+  // whichever layer is lit
+  if(BIT_CHECK(leds_lit, GLED))
+    current += ((long)GLED_CURRENT*led_brightness[led_shown[GLED]][GLED])>>8;
+  if(BIT_CHECK(leds_lit, RLED))
+    current += RLED_CURRENT*((led_brightness[led_shown[RLED]][RLED]>>6)+1)/4; // see rledMap
+#endif
+#ifdef ACCELEROMETER
+  current += hexbright::accelerometer_sleeping() ? ACCEL_SLEEP_CURRENT : ACCEL_CURRENT;
+#endif
+  return current;
+}
+
+void hexbright::load_charge_used() {
+  if(charge_used_check==~charge_used)
+    return; // a reset, we kept counting
+  charge_fraction = 0;
+#ifdef SETTINGS
+  charge_used = (unsigned long)(word)stored_setting(SETTING_CHARGE_USED, 0)<<4;
+#else
+  int address = EEPROM_CHARGE_USED;
+  charge_used = 0;
+  if(eeprom_checksum(address, 3)==eeprom_read_byte((uint8_t*)(size_t)(address+3))) {
+    for(int i=2; i>=0; i--)
+      charge_used = (charge_used<<8) | eeprom_read_byte((uint8_t*)(size_t)(address+i));
+  }
+#endif
+  charge_used_check = ~charge_used;
+}
+
+void hexbright::save_charge_used() {
+#ifdef SETTINGS
+  // written with the other settings; 1/16ths of a mAh, up to 4095 mAh
+  unsigned long used = charge_used>>4;
+  store_setting(SETTING_CHARGE_USED, (int)(used>0xFFFF ? 0xFFFF : used));
+#else
+  // only write what changed; this happens every time we turn off
+  int address = EEPROM_CHARGE_USED;
+  unsigned long used = charge_used;
+  for(int i=0; i<3; i++, used>>=8) {
+    if(eeprom_read_byte((uint8_t*)(size_t)(address+i))!=(byte)used)
+      eeprom_write_byte((uint8_t*)(size_t)(address+i), (byte)used);
+  }
+  unsigned char checksum = eeprom_checksum(address, 3);
+  if(eeprom_read_byte((uint8_t*)(size_t)(address+3))!=checksum)
+    eeprom_write_byte((uint8_t*)(size_t)(address+3), checksum);
+#endif
+}
+
+void hexbright::count_charge() {
+  unsigned char state = get_charge_state();
+  if(state==CHARGED) {
+    if(charge_used) {
+      // start over, even if we're unplugged without turning off
+      charge_used = 0;
+      charge_fraction = 0;
+      save_charge_used();
+    }
+  } else if(state==BATTERY) {
+    charge_fraction += current_draw();
+    if(charge_fraction>=CHARGE_UNIT) {
+      charge_fraction -= CHARGE_UNIT;
+      charge_used++;
+    }
   }
+  charge_used_check = ~charge_used;
+}
+
+word hexbright::get_charge_used() {
+  return charge_used>>8;
+}
+
+word hexbright::get_current() {
+  return current_draw()/10;
+}
+
+int hexbright::get_runtime_minutes() {
+  // the voltage knows better, once we can see it
+  if(low_voltage_state())
+    return get_battery_minutes();
+  long left = (long)BATTERY_CAPACITY*256-charge_used;
+  if(left<=0)
+    return 0;
+  // (left/256 mAh) * 60 / (current/100 mA)
+  return (left*375/16)/(current_draw()>0 ? current_draw() : 1);
 }
+#endif // CHARGE_COUNTER
+
+
+#ifdef USAGE_STATS
+///////////////////////////////////////////////
+/////////////////USAGE STATS///////////////////
+///////////////////////////////////////////////
+
+// How the light actually gets used: time with the light on in each quarter
+//  of the light range, how often we've overheated, run into the battery
+//  reserve and finished charging, and the hottest we've been, plus a log of
+//  the last USAGE_LOG_SIZE of those events (with the boot they happened in).
+// Counters are kept in RAM and written every USAGE_WRITE_INTERVAL, and when
+//  we turn ourselves off, a byte at a time between updates.  There are two
+//  copies with a sequence number; we write over the older one, checksum
+//  last, so losing power part way through costs at most the last interval.
+//  However busy we are, that's one copy and a few log entries per interval.
+#define USAGE_LEVELS 4 // MAX_LEVEL split into quarters
+#define USAGE_EVENTS 3
+#define USAGE_OVERHEAT 1 // log value: celsius
+#define USAGE_LOW_BATTERY 2 // log value: the light level/4
+#define USAGE_CHARGED 3 // log value: mAh used/16 (0 without CHARGE_COUNTER)
+#define USAGE_SIZE 28 // sizeof(usage_record), and a checksum
+#define USAGE_LOG (EEPROM_USAGE+2*USAGE_SIZE)
+#define USAGE_LOG_ENTRY 4 // type, value, boot (2 bytes)
+#define USAGE_LOG_SIZE ((EEPROM_SETTINGS-USAGE_LOG)/USAGE_LOG_ENTRY)
+#define USAGE_QUEUE 4 // events waiting for the next write
+#define USAGE_WRITE_INTERVAL 72000 // updates, 10 minutes
+#define USAGE_UPDATES_PER_SECOND 120
+#define USAGE_COOLDOWN (15<<THERMAL_EXTRA_BITS) // about 5C below overheating before it counts again
+#define USAGE_HOT 1
+#define USAGE_LOW 2
+
+struct usage_record {
+  uint8_t sequence; // the newer copy was written last
+  uint16_t boots;
+  uint32_t seconds[USAGE_LEVELS]; // with the light on
+  uint16_t events[USAGE_EVENTS]; // by type-1
+  int8_t max_celsius;
+  uint8_t log_head; // the next log entry to write
+} __attribute__((packed)); // the same layout on the host, for the tests
+
+usage_record usage;
+word usage_ticks[USAGE_LEVELS]; // updates with the light on, not yet counted
+unsigned char usage_queue[USAGE_QUEUE*2]; // type, value
+unsigned char usage_queued = 0;
+unsigned char usage_flags = 0; // USAGE_HOT, USAGE_LOW
+unsigned char usage_charge_state = BATTERY;
+unsigned char usage_copy = 1; // the copy written last
+BOOL usage_dirty = false;
+unsigned long usage_timer = 0; // updates since the last write
+int usage_step = -1; // the byte we're writing, -1 when we aren't
+
+void hexbright::load_usage() {
+  // the newest copy with a good checksum
+  BOOL found = false;
+  for(unsigned char copy=0; copy<2; copy++) {
+    int address = EEPROM_USAGE+copy*USAGE_SIZE;
+    if(eeprom_checksum(address, USAGE_SIZE-1)!=eeprom_read_byte((uint8_t*)(size_t)(address+USAGE_SIZE-1)))
+      continue;
+    if(found && (signed char)(eeprom_read_byte((uint8_t*)(size_t)address)-usage.sequence)<=0)
+      continue; // the first copy is newer
+    for(unsigned char i=0; i<sizeof(usage); i++)
+      ((unsigned char*)&usage)[i] = eeprom_read_byte((uint8_t*)(size_t)(address+i));
+    usage_copy = copy;
+    found = true;
+  }
+  if(usage.log_head>=USAGE_LOG_SIZE)
+    usage.log_head = 0;
+  usage.boots++;
+  usage_dirty = true;
+}
+
+static void log_usage(unsigned char type, int value) {
+  usage.events[type-1]++;
+  if(usage_queued<USAGE_QUEUE) {
+    usage_queue[usage_queued*2] = type;
+    usage_queue[usage_queued*2+1] = value<0 ? 0 : value>255 ? 255 : value;
+    usage_queued++;
+  }
+  usage_dirty = true;
+}
+
+static void count_usage_time() {
+  for(unsigned char i=0; i<USAGE_LEVELS; i++) {
+    if(usage_ticks[i]>=USAGE_UPDATES_PER_SECOND) {
+      usage.seconds[i] += usage_ticks[i]/USAGE_UPDATES_PER_SECOND;
+      usage_ticks[i] %= USAGE_UPDATES_PER_SECOND;
+      usage_dirty = true;
+    }
+  }
+}
+
+static void start_usage_write() {
+  usage.sequence++;
+  usage.log_head = (usage.log_head+usage_queued)%USAGE_LOG_SIZE;
+  usage_copy ^= 1;
+  usage_step = 0;
+}
+
+void hexbright::update_usage() {
+  int level = get_light_level();
+  if(level>0)
+    usage_ticks[(long)level*USAGE_LEVELS/(MAX_LEVEL+1)]++;
+  usage_timer++;
+  if(usage_step>=0)
+    return; // hold still while we're written; we'll catch up after
+  count_usage_time();
+
+  int reading = get_predicted_thermal_sensor();
+  if(reading>overheat_reading && !(usage_flags&USAGE_HOT)) {
+    usage_flags |= USAGE_HOT;
+    log_usage(USAGE_OVERHEAT, get_celsius());
+  } else if(reading<overheat_reading-USAGE_COOLDOWN) {
+    usage_flags &= ~USAGE_HOT;
+  }
+  if(low_voltage_state() && !(usage_flags&USAGE_LOW)) {
+    usage_flags |= USAGE_LOW;
+    log_usage(USAGE_LOW_BATTERY, level/4);
+  } else if(!low_voltage_state()) {
+    usage_flags &= ~USAGE_LOW;
+  }
+  unsigned char state = get_charge_state();
+  if(state==CHARGED && usage_charge_state==CHARGING) {
+#ifdef CHARGE_COUNTER
+    log_usage(USAGE_CHARGED, get_charge_used()/16);
+#else
+    log_usage(USAGE_CHARGED, 0);
+#endif
+  }
+  usage_charge_state = state;
+  int celsius = get_celsius();
+  if(celsius>usage.max_celsius) {
+    usage.max_celsius = celsius>127 ? 127 : celsius;
+    usage_dirty = true;
+  }
+
+  if(usage_dirty && usage_timer>=USAGE_WRITE_INTERVAL)
+    start_usage_write();
+}
+
+void hexbright::write_usage() {
+  // the log entries, then the counters, checksum last; skip what hasn't changed
+  while(usage_step>=0 && eeprom_is_ready()) {
+    int address;
+    unsigned char value;
+    int entry = usage_step/USAGE_LOG_ENTRY;
+    int record = usage_step-usage_queued*USAGE_LOG_ENTRY;
+    if(entry<usage_queued) {
+      unsigned char slot = (usage.log_head+USAGE_LOG_SIZE-usage_queued+entry)%USAGE_LOG_SIZE;
+      unsigned char i = usage_step%USAGE_LOG_ENTRY;
+      address = USAGE_LOG+slot*USAGE_LOG_ENTRY+i;
+      value = i<2 ? usage_queue[entry*2+i] : usage.boots>>(8*(i-2));
+    } else {
+      address = EEPROM_USAGE+usage_copy*USAGE_SIZE+record;
+      if(record<USAGE_SIZE-1) {
+        value = ((unsigned char*)&usage)[record];
+      } else {
+        value = eeprom_checksum(EEPROM_USAGE+usage_copy*USAGE_SIZE, USAGE_SIZE-1);
+        usage_step = -1;
+        usage_queued = 0;
+        usage_dirty = false;
+        usage_timer = 0;
+      }
+    }
+    if(usage_step>=0)
+      usage_step++;
+    if(eeprom_read_byte((uint8_t*)(size_t)address)!=value) {
+      eeprom_write_byte((uint8_t*)(size_t)address, value);
+      break;
+    }
+  }
+}
+
+void hexbright::flush_usage() {
+  // we're about to lose power
+  while(usage_step>=0)
+    write_usage();
+  count_usage_time();
+  if(usage_dirty) {
+    start_usage_write();
+    while(usage_step>=0)
+      write_usage();
+  }
+}
+
+#ifdef DEBUG_SERIAL
+// the next EEPROM address to dump, 0 when we aren't dumping
+int usage_print_address = 0;
+
+void hexbright::print_usage() {
+  Serial.println("USAGE");
+  usage_print_address = EEPROM_USAGE;
+}
+
+void hexbright::send_usage() {
+  // a line per update, so we don't overrun the serial buffer
+  if(!usage_print_address)
+    return;
+  if(usage_print_address<EEPROM_SETTINGS) {
+    for(unsigned char i=0; i<16; i++) {
+      unsigned char value = eeprom_read_byte((uint8_t*)(size_t)usage_print_address++);
+      if(value<0x10)
+        Serial.print('0');
+      Serial.print(value, HEX);
+      Serial.print(' ');
+    }
+    Serial.println();
+  } else {
+    Serial.println("DONE");
+    usage_print_address = 0;
+  }
+}
+#endif
+#endif // USAGE_STATS
 
 
 ///////////////////////////////////////////////
@@ -1247,12 +3022,357 @@ unsigned char hexbright::get_charge_state() {
 
 void hexbright::print_charge(unsigned char led) {
   unsigned char charge_state = get_charge_state();
-  if(charge_state == CHARGING && get_led_state(led) == LED_OFF) {
-    set_led(led, 350, 350);
+  if(charge_state == CHARGING && get_led_state(led, LED_STATUS) == LED_OFF) {
+    set_led(led, 350, 350, 255, LED_STATUS);
   } else if (charge_state == CHARGED) {
-    set_led(led,50);
+    set_led(led, 50, 100, 255, LED_STATUS);
+  }
+}
+
+#ifdef CLOCK
+///////////////////////////////////////////////
+////////////////////CLOCK//////////////////////
+///////////////////////////////////////////////
+
+// The clock is seconds plus microseconds into the second; updates add
+//  UPDATE_MICROS, so 120 updates are 999960 us, not a second.
+#define ALARM_OFF 0 // we check alarms as the clock ticks over, so it never matches 0
+
+unsigned long clock_seconds = 0;
+unsigned long clock_micros = 0;
+unsigned long alarm_times[CLOCK_ALARMS];
+unsigned char alarms_pending = 0; // bits, alarms that went off but haven't been reported
+unsigned char alarm_now = ALARM_NONE;
+
+void hexbright::update_clock() {
+  clock_micros += UPDATE_MICROS;
+  if(clock_micros>=1000000) {
+    clock_micros -= 1000000;
+    clock_seconds++;
+    for(unsigned char i=0; i<CLOCK_ALARMS; i++) {
+      if(alarm_times[i]==clock_seconds) {
+        alarm_times[i] = ALARM_OFF;
+        alarms_pending |= 1<<i;
+      }
+    }
   }
+  // report one alarm per update
+  alarm_now = ALARM_NONE;
+  if(alarms_pending) {
+    for(alarm_now=0; !(alarms_pending&(1<<alarm_now)); alarm_now++);
+    alarms_pending &= ~(1<<alarm_now);
+  }
+}
+
+// The clock only runs once something uses it; until then millis() has
+//  kept time since power on, so we pick up from there.
+void hexbright::start_clock() {
+  if(clock_update)
+    return;
+  unsigned long now = millis();
+  clock_seconds = now/1000;
+  clock_micros = (now%1000)*1000;
+  clock_update = update_clock;
+}
+
+void hexbright::set_clock(unsigned long seconds) {
+  clock_update = update_clock;
+  clock_seconds = seconds;
+  clock_micros = 0;
+}
+
+unsigned long hexbright::get_clock() {
+  start_clock();
+  return clock_seconds;
+}
+
+word hexbright::get_clock_millis() {
+  start_clock();
+  return clock_micros/1000;
+}
+
+void hexbright::set_alarm(unsigned char alarm, unsigned long at) {
+  start_clock();
+  alarm_times[alarm] = at;
+}
+
+void hexbright::set_alarm_in(unsigned char alarm, unsigned long seconds) {
+  start_clock();
+  if(seconds)
+    alarm_times[alarm] = clock_seconds+seconds;
+  else
+    alarms_pending |= 1<<alarm; // now, on the next update
+}
+
+void hexbright::clear_alarm(unsigned char alarm) {
+  alarm_times[alarm] = ALARM_OFF;
+  alarms_pending &= ~(1<<alarm);
+}
+
+unsigned long hexbright::get_alarm_remaining(unsigned char alarm) {
+  if(alarm_times[alarm]==ALARM_OFF)
+    return 0;
+  return alarm_times[alarm]-clock_seconds;
+}
+
+unsigned char hexbright::get_alarm() {
+  return alarm_now;
+}
+#endif // CLOCK
+
+#ifdef MODES
+///////////////////////////////////////////////
+////////////////////MODES//////////////////////
+///////////////////////////////////////////////
+
+#ifndef pgm_read_ptr // avr-libc before 1.8.1
+#define pgm_read_ptr(address) ((void*)pgm_read_word(address))
+#endif
+
+#define MODE_HELD 1 // EVENT_HOLD has happened for this press
+#define MODE_LONG_HELD 2
+#define MODE_TIMED_OUT 4
+
+const mode_state* modes_states;
+const mode_transition* modes_transitions;
+word modes_hold_time;
+word modes_long_hold_time;
+unsigned char modes_current = 0;
+unsigned char modes_previous = 0;
+unsigned char modes_event = EVENT_NONE;
+unsigned char modes_flags = 0;
+unsigned long modes_entered = 0;
+
+void hexbright::set_modes(const mode_state* states, const mode_transition* transitions,
+                          word hold_time, word long_hold_time) {
+  modes_states = states;
+  modes_transitions = transitions;
+  modes_hold_time = hold_time;
+  modes_long_hold_time = long_hold_time;
+  modes_update = update_modes;
+#ifdef ACCEL_EVENTS
+  motion_update = detect_motion; // for EVENT_DROP and EVENT_TWIST
+#endif
+  // we're already on; don't apply mode 0's level (OFF_LEVEL would power us down)
+  modes_current = modes_previous = 0;
+  modes_entered = millis();
+}
+
+void hexbright::set_mode(unsigned char mode) {
+  mode_handler exit = (mode_handler)pgm_read_ptr(&modes_states[modes_current].exit);
+  if(exit)
+    exit();
+  modes_previous = modes_current;
+  enter_mode(mode);
+}
+
+void hexbright::enter_mode(unsigned char mode) {
+  const mode_state* state = &modes_states[mode];
+  modes_current = mode;
+  modes_entered = millis();
+  modes_flags &= ~MODE_TIMED_OUT;
+  int level = pgm_read_word((const word*)&state->level);
+  if(level!=CURRENT_LEVEL)
+    set_light(CURRENT_LEVEL, level, pgm_read_word((const word*)&state->change_time));
+  mode_handler enter = (mode_handler)pgm_read_ptr(&state->enter);
+  if(enter)
+    enter();
+}
+
+unsigned char hexbright::get_mode() {
+  return modes_current;
+}
+
+unsigned char hexbright::get_mode_event() {
+  return modes_event;
+}
+
+unsigned long hexbright::get_mode_time() {
+  return millis()-modes_entered;
+}
+
+unsigned char hexbright::next_mode_event() {
+  // click_count has to see every update
+  char clicks = max_click_time ? click_count() : 0;
+  if(button_just_pressed()) {
+    modes_flags &= ~(MODE_HELD|MODE_LONG_HELD);
+    return EVENT_PRESS;
+  }
+  if(button_just_released()) {
+    word held = button_pressed_time();
+    return held<modes_hold_time ? EVENT_CLICK : held<modes_long_hold_time ? EVENT_RELEASE : EVENT_LONG_RELEASE;
+  }
+  if(button_pressed()) {
+    word held = button_pressed_time();
+    if(!(modes_flags&MODE_HELD) && held>=modes_hold_time) {
+      modes_flags |= MODE_HELD;
+      return EVENT_HOLD;
+    }
+    if(!(modes_flags&MODE_LONG_HELD) && held>=modes_long_hold_time) {
+      modes_flags |= MODE_LONG_HELD;
+      return EVENT_LONG_HOLD;
+    }
+  }
+  if(clicks>0)
+    return EVENT_CLICKS+clicks;
+#ifdef CLOCK
+  if(alarm_now!=ALARM_NONE)
+    return EVENT_ALARM;
+#endif
+  word timeout = pgm_read_word(&modes_states[modes_current].timeout);
+  if(timeout && !(modes_flags&MODE_TIMED_OUT) && get_mode_time()>=timeout) {
+    modes_flags |= MODE_TIMED_OUT;
+    return EVENT_TIMEOUT;
+  }
+#ifdef ACCEL_EVENTS
+  // a motion event lasts until the next sample; take it on the last update
+  //  before then, so we only see it once
+  if(!accel_countdown) {
+    switch(get_motion_event()) {
+    case ACCEL_DROP:
+      return EVENT_DROP;
+    case ACCEL_IMPACT:
+      return EVENT_IMPACT;
+    case ACCEL_TWIST:
+      return EVENT_TWIST;
+    }
+  }
+#endif
+  return EVENT_NONE;
+}
+
+void hexbright::handle_mode_event(unsigned char event) {
+  modes_event = event;
+  if(event==EVENT_NONE)
+    return;
+  for(const mode_transition* transition=modes_transitions; ; transition++) {
+    unsigned char from = pgm_read_byte(&transition->from);
+    if(from==MODE_END)
+      return;
+    if((from==modes_current || from==MODE_ANY) && pgm_read_byte(&transition->event)==event) {
+      unsigned char to = pgm_read_byte(&transition->to);
+      set_mode(to==MODE_PREVIOUS ? modes_previous : to);
+      return;
+    }
+  }
+}
+
+void hexbright::update_modes() {
+  unsigned char event = next_mode_event();
+#ifdef CLOCK
+  // an alarm that came with another event goes off again next update
+  if(alarm_now!=ALARM_NONE && event!=EVENT_ALARM)
+    alarms_pending |= 1<<alarm_now;
+#endif
+  handle_mode_event(event);
+  const mode_state* state = &modes_states[modes_current];
+#ifdef LED
+  unsigned char flags = pgm_read_byte(&state->flags);
+  if(flags&MODE_PRINT_POWER)
+    print_power();
+  else if(flags&MODE_PRINT_CHARGE)
+    print_charge(GLED);
+#endif
+  mode_handler tick = (mode_handler)pgm_read_ptr(&state->tick);
+  if(tick)
+    tick();
+}
+#endif // MODES
+
+#ifdef TELEMETRY
+///////////////////////////////////////////////
+///////////////////TELEMETRY///////////////////
+///////////////////////////////////////////////
+
+// Frames go into a ring buffer that the uart's data register empty interrupt
+//  drains, a byte per interrupt, so update() never waits on the uart.  At
+//  TELEMETRY_BAUD a full frame takes under a millisecond to send.
+
+unsigned char telemetry_fields = TELEMETRY_ALL;
+
+void hexbright::set_telemetry(unsigned char fields) {
+  telemetry_fields = fields;
+}
+
+static unsigned char telemetry_put(unsigned char* frame, unsigned char length, int value) {
+  frame[length++] = value;
+  frame[length++] = value>>8;
+  return length;
+}
+
+unsigned char hexbright::telemetry_frame(unsigned char* frame) {
+  unsigned char fields = telemetry_fields;
+#ifndef ACCELEROMETER
+  fields &= ~TELEMETRY_ACCEL;
+#endif
+  unsigned char length = 0;
+  frame[length++] = TELEMETRY_SYNC;
+  frame[length++] = fields;
+  if(fields&TELEMETRY_TICK)
+    length = telemetry_put(frame, length, loopCount);
+  if(fields&TELEMETRY_LEVEL)
+    length = telemetry_put(frame, length, get_light_level());
+  if(fields&TELEMETRY_MAX_LEVEL)
+    length = telemetry_put(frame, length, max_light_level);
+  if(fields&TELEMETRY_TEMPERATURE)
+    length = telemetry_put(frame, length, thermal_sensor_value);
+  if(fields&TELEMETRY_BAND_GAP)
+    length = telemetry_put(frame, length, band_gap_reading);
+  if(fields&TELEMETRY_CHARGE)
+    frame[length++] = get_charge_state();
+#ifdef ACCELEROMETER
+  if(fields&TELEMETRY_ACCEL) {
+    for(unsigned char i=0; i<3; i++)
+      length = telemetry_put(frame, length, vector(0)[i]);
+  }
+#endif
+  if(fields&TELEMETRY_BUTTON)
+    frame[length++] = button_state;
+  unsigned char sum = 0;
+  for(unsigned char i=1; i<length; i++)
+    sum += frame[i];
+  frame[length++] = sum;
+  return length;
+}
+
+#ifdef __AVR
+volatile unsigned char telemetry_buffer[TELEMETRY_BUFFER];
+volatile unsigned char telemetry_head = 0; // written by update()
+volatile unsigned char telemetry_tail = 0; // written by the interrupt
+
+void hexbright::init_telemetry() {
+  // double speed: F_CPU/8 per bit, rounded
+  UCSR0A = 1<<U2X0;
+  UBRR0 = (F_CPU/4/TELEMETRY_BAUD-1)/2;
+  UCSR0C = 3<<UCSZ00; // 8N1
+  UCSR0B = 1<<TXEN0;
+}
+
+void hexbright::send_telemetry() {
+  unsigned char frame[TELEMETRY_FRAME_MAX];
+  unsigned char length = telemetry_frame(frame);
+  unsigned char head = telemetry_head;
+  // the whole frame or nothing, so the decoder doesn't see half of one
+  if(((telemetry_tail-head-1)&(TELEMETRY_BUFFER-1)) < length)
+    return;
+  for(unsigned char i=0; i<length; i++) {
+    telemetry_buffer[head] = frame[i];
+    head = (head+1)&(TELEMETRY_BUFFER-1);
+  }
+  telemetry_head = head;
+  UCSR0B |= 1<<UDRIE0;
+}
+
+ISR(USART_UDRE_vect) {
+  unsigned char tail = telemetry_tail;
+  UDR0 = telemetry_buffer[tail];
+  tail = (tail+1)&(TELEMETRY_BUFFER-1);
+  telemetry_tail = tail;
+  if(tail==telemetry_head)
+    UCSR0B &= ~(1<<UDRIE0);
 }
+#endif // __AVR
+#endif // TELEMETRY
 
 ///////////////////////////////////////////////
 //KLUDGE BECAUSE ARDUINO DOESN'T SUPPORT CLASS VARIABLES/INSTANTIATION
@@ -1261,7 +3381,7 @@ void hexbright::print_charge(unsigned char led) {
 void hexbright::fake_read_accelerometer(int* new_vector) {
   next_vector();
   for(int i=0; i<3; i++) {
-    vector(0)[i] = stdev_filter3(vector(1)[i], new_vector[i]);
+    vector(0)[i] = filter_reading(vector(1)[i], new_vector[i]);
     //vector(0)[i] = new_vector[i];
   }
 }
@@ -34,14 +34,25 @@ either expressed or implied, of the FreeBSD Project.
 #define BOOL boolean
 #else
 #define BOOL bool
+typedef unsigned char byte;
+typedef unsigned int word;
 #endif
 
 /// Some space-saving options
 #define LED // comment out save 786 bytes if you don't use the rear LEDs
 #define PRINT_NUMBER // comment out to save 626 bytes if you don't need to print numbers (but need the LEDs)
 #define ACCELEROMETER //comment out to save 1500 bytes if you don't need the accelerometer
+#define ACCEL_EVENTS // comment out if you don't need drop, impact or twist events (requires ACCELEROMETER; costs nothing unless you ask for one or call set_modes)
 #define FLASH_CHECKSUM // comment out to save 56 bytes when in debug mode
 #define FREE_RAM // comment out to save 146 bytes when in debug mode
+//#define THERMAL_MODEL // uncomment to throttle ahead of the measured temperature (fit it first, see experiments/thermal_readings)
+//#define CHARGE_COUNTER // uncomment to track charge used and projected runtime (claims EEPROM 504-507, or a settings record with SETTINGS)
+//#define SETTINGS // uncomment to use get_setting/set_setting (claims EEPROM 352-479, see below)
+//#define USAGE_STATS // uncomment to keep usage counters and an event log in EEPROM (256-351)
+#define MODES // comment out if you don't use set_modes (costs nothing unless you call it)
+#define CLOCK // comment out if you don't need the clock or alarms (costs nothing unless you use them)
+#define MORSE // comment out if you don't send text in morse code (costs nothing unless you call print_morse)
+//#define ACCEL_CAPTURE // uncomment to record raw accelerometer samples to EEPROM (requires ACCELEROMETER)
 //#define STROBE // comment out to save 260 bytes (strobe is designed for higher-precision
 //               //  stroboscope code, not general periodic flashing)
 
@@ -49,6 +60,20 @@ either expressed or implied, of the FreeBSD Project.
 // The above #defines can help if you are running out of flash.  If you are having weird lockups,
 //  you may be running out of ram.  See freeRam's definition for additional information.
 
+#ifndef __AVR // host builds (the tests) include everything we can test
+#define ACCEL_CAPTURE
+#define THERMAL_MODEL
+#define SETTINGS
+#define USAGE_STATS
+#define CHARGE_COUNTER
+#define TELEMETRY // frames are built, there's just no uart to send them
+#endif
+
+#ifndef ACCELEROMETER
+#undef ACCEL_EVENTS
+#undef ACCEL_CAPTURE
+#endif
+
 
 #ifdef ACCELEROMETER
 #define DPIN_ACC_INT 3
@@ -58,16 +83,74 @@ either expressed or implied, of the FreeBSD Project.
 #define ACC_REG_YOUT            1
 #define ACC_REG_ZOUT            2
 #define ACC_REG_TILT            3
+#define ACC_REG_SPCNT           5
 #define ACC_REG_INTS            6
 #define ACC_REG_MODE            7
+#define ACC_REG_SR              8
+
+// sample rates for set_accelerometer_rate (samples per second)
+#define ACC_RATE_120 0
+#define ACC_RATE_64  1
+#define ACC_RATE_32  2
+#define ACC_RATE_16  3
+#define ACC_RATE_8   4
+#define ACC_RATE_4   5
+#define ACC_RATE_2   6
+#define ACC_RATE_1   7
+
+// return values for calibrate_accelerometer (0-6 are orientations captured so far)
+#define CALIBRATION_SAVED 7
+#define CALIBRATION_FAILED 8 // the readings don't make sense, start over
 
 // return values for get_tilt_orientation
 #define TILT_UNKNOWN 0
 #define TILT_UP 1
 #define TILT_DOWN 2
 #define TILT_HORIZONTAL 3
+
+// return values for get_motion_event
+#define ACCEL_NONE   0 // nothing
+#define ACCEL_TWIST  1 // return degrees - light axis remains constant
+#define ACCEL_TURN   2 // return degrees - light axis changes (not yet implemented)
+#define ACCEL_DROP   3 // a period of no acceleration (free-fall) has started
+#define ACCEL_TAP    4 // return change of velocity - acceleration before impact (not yet implemented)
+#define ACCEL_IMPACT 5 // return peak acceleration - we hit something after a drop
+
+// return values for get_capture_state
+#define CAPTURE_OFF 0
+#define CAPTURE_ARMED 1 // waiting for the trigger
+#define CAPTURE_RECORDING 2
+#define CAPTURE_DONE 3 // everything has been written to EEPROM
+
+// filters for run_filter
+#define FILTER_NONE     0
+#define FILTER_LOW_PASS 1
+#define FILTER_STDEV    2
+#define FILTER_STDEV2   3
+#define FILTER_STDEV3   4 // the filter we use
+#define FILTER_STEP     5
 #endif
 
+// EEPROM used by the library
+// Per-unit calibration and state lives at the top of EEPROM; sketches should
+//  stay below EEPROM_CALIBRATION.  Each block ends with a checksum (see
+//  eeprom_checksum).
+// Settings (SETTINGS, see set_setting) are kept in a ring just below; with
+//  SETTINGS on, sketches should stay below EEPROM_SETTINGS.  The ring is
+//  formatted at boot if it isn't already, erasing whatever was there.
+// Usage statistics (USAGE_STATS) are below the settings; with USAGE_STATS
+//  on, sketches should stay below EEPROM_USAGE.  In DEBUG builds, call
+//  print_usage() to dump them over serial, and decode the dump with
+//  experiments/accelerometer_readings/test_program/usage_decode.
+#define EEPROM_USAGE 256 // two copies of the counters (28 bytes each), then a 10 entry event log
+#define EEPROM_SETTINGS 352 // a format byte, then 4 byte records...
+#define EEPROM_SETTINGS_END 480 // ...up to here (31 records)
+#define EEPROM_CALIBRATION 480 // 32 bytes, to the end of EEPROM (511)
+#define EEPROM_TEMP_CALIBRATION 480 // 10 bytes: version, two readings and temperatures, checksum
+#define EEPROM_BATTERY_REFERENCE 490 // 3 bytes: band gap block sum at the regulator's ceiling, checksum
+#define EEPROM_ACCEL_CALIBRATION 496 // 8 bytes: version, x/y/z offset, x/y/z gain, checksum
+#define EEPROM_CHARGE_USED 504 // 4 bytes: mAh used since the last full charge, 1/256ths, checksum (in the settings ring with SETTINGS)
+
 // debugging related definitions
 // Some debug modes set the light.  Your control code may reset it, causing weird flashes at startup.
 #define DEBUG_OFF 0 // no extra code is compiled in
@@ -82,6 +165,9 @@ either expressed or implied, of the FreeBSD Project.
 #define DEBUG_NUMBER 9 // number printing utility
 #define DEBUG_CHARGE 10 // charge state
 #define DEBUG_PROGRAM 11 // use this to enable/disable print statements in the program rather than the library
+#define DEBUG_BATTERY 12 // battery estimate
+#define DEBUG_MORSE 13 // morse code elements as they are sent
+#define DEBUG_TELEMETRY 14 // binary frames of readings every update (see set_telemetry); no Serial
 
 // You'll probably want to set your debug mode here.
 // In order to allow DEBUG from *.ino files to matter,
@@ -90,10 +176,42 @@ either expressed or implied, of the FreeBSD Project.
 #define DEBUG DEBUG_OFF
 #endif
 
+// the debug modes that print through Serial
+#if (DEBUG!=DEBUG_OFF && DEBUG!=DEBUG_TELEMETRY)
+#define DEBUG_SERIAL
+#endif
+
+#if (DEBUG==DEBUG_TELEMETRY)
+#define TELEMETRY
+#endif
+
+#ifdef TELEMETRY
+// Telemetry has the uart to itself, so sketches can't use Serial with it.
+//  Capture it on a pc with something like:
+//   stty -F /dev/ttyUSB0 250000 raw; cat /dev/ttyUSB0 > telemetry.bin
+//  and turn it into csv with experiments/accelerometer_readings/test_program/telemetry_decode.
+#define TELEMETRY_BAUD 250000 // no baud rate error at 8 MHz, and room for every field at 120 Hz
+#define TELEMETRY_BUFFER 64 // bytes, a power of 2
+// A frame is TELEMETRY_SYNC, the fields byte, the fields in the order below
+//  (little-endian), and the sum of the bytes after the sync.
+#define TELEMETRY_SYNC 0xA5
+#define TELEMETRY_TICK 0x01 // 2 bytes, update count
+#define TELEMETRY_LEVEL 0x02 // 2 bytes, get_light_level()
+#define TELEMETRY_MAX_LEVEL 0x04 // 2 bytes, the overheat/low battery limit
+#define TELEMETRY_TEMPERATURE 0x08 // 2 bytes, get_thermal_sensor()
+#define TELEMETRY_BAND_GAP 0x10 // 2 bytes, raw band gap reading (see get_avr_voltage)
+#define TELEMETRY_CHARGE 0x20 // 1 byte, get_charge_state()
+#define TELEMETRY_ACCEL 0x40 // 6 bytes, vector(0)
+#define TELEMETRY_BUTTON 0x80 // 1 byte, the debounced button history
+#define TELEMETRY_ALL 0xFF
+#define TELEMETRY_FRAME_MAX 21
+#endif
+
+// in degrees celsius; see programs/temperature_calibration
 #if (DEBUG==DEBUG_TEMP)
-#define OVERHEAT_TEMPERATURE 265 // something lower, to more easily verify algorithms
+#define OVERHEAT_TEMPERATURE 37 // something lower, to more easily verify algorithms
 #else
-#define OVERHEAT_TEMPERATURE 320 // 340 in original code, 320 = 130* fahrenheit/55* celsius (with calibration)
+#define OVERHEAT_TEMPERATURE 55 // 130* fahrenheit (a reading of 320 uncalibrated, 340 in original code)
 #endif
 
 
@@ -111,6 +229,9 @@ either expressed or implied, of the FreeBSD Project.
 
 #define NOW 1
 
+// settings ids are 0 to SETTING_IDS-1
+#define SETTING_IDS 8
+
 // turn off strobe... (aka max unsigned long)
 // this is only valid for STROBE, which is disabled by default (see above)
 #define STROBE_OFF -1
@@ -123,6 +244,17 @@ either expressed or implied, of the FreeBSD Project.
 #define LED_WAIT 1
 #define LED_ON 2
 
+// led layers, lowest priority first (see set_led)
+#define LED_STATUS 0 // print_charge and print_power
+#define LED_SKETCH 1 // set_led, unless you ask for another layer
+#define LED_PRINT 2 // print_number, input_digit and print_morse
+#define LED_LAYERS 3
+
+#ifdef MORSE
+// send morse code through the main light instead of RLED or GLED
+#define MORSE_LIGHT 2
+#endif
+
 // charging constants
 #define CHARGING 1
 #define BATTERY 7
@@ -134,6 +266,54 @@ either expressed or implied, of the FreeBSD Project.
 #define BIT_CLEAR(reg,bit) reg &= ~(1<<bit)
 #define BIT_TOGGLE(reg,bit) reg ^= (1<<bit)
 
+#ifdef CLOCK
+#define CLOCK_ALARMS 2 // alarms that can be set at once (4 bytes of ram each)
+#define ALARM_NONE 0xFF
+#endif
+
+#ifdef MODES
+// A mode, for set_modes.  Keep the table in flash (PROGMEM).
+typedef void (*mode_handler)();
+struct mode_state {
+  int level; // the light level to change to on entry, CURRENT_LEVEL to leave it
+  int change_time; // ms, for the change to level (NOW)
+  word timeout; // ms in this mode before EVENT_TIMEOUT, 0 for never
+  unsigned char flags; // MODE_PRINT_*
+  mode_handler enter; // after the level change; any handler can be NULL
+  mode_handler tick; // every update, after transitions
+  mode_handler exit;
+};
+// The first transition that matches an event is taken; the table ends with {MODE_END, EVENT_NONE, MODE_END}.
+struct mode_transition {
+  unsigned char from; // a mode, or MODE_ANY
+  unsigned char event; // EVENT_*
+  unsigned char to; // a mode, or MODE_PREVIOUS (it's fine to go to the mode we're in)
+};
+#define MODE_ANY 0xFF
+#define MODE_PREVIOUS 0xFE // the mode we came from
+#define MODE_END 0xFD
+
+// mode_state flags, done before tick unless we're printing a number
+#define MODE_PRINT_CHARGE 1 // print_charge(GLED)
+#define MODE_PRINT_POWER 2 // print_power()
+
+// mode events, at most one per update.  A press ends with exactly one of
+//  EVENT_CLICK, EVENT_RELEASE or EVENT_LONG_RELEASE.
+#define EVENT_NONE 0
+#define EVENT_PRESS 1 // the button was just pressed
+#define EVENT_CLICK 2 // released before the hold time
+#define EVENT_HOLD 3 // still pressed at the hold time
+#define EVENT_RELEASE 4 // released after EVENT_HOLD, before the long hold time
+#define EVENT_LONG_HOLD 5 // still pressed at the long hold time
+#define EVENT_LONG_RELEASE 6 // released after EVENT_LONG_HOLD
+#define EVENT_TIMEOUT 7 // we've been in the mode for its timeout
+#define EVENT_DROP 8 // get_motion_event()s, with ACCEL_EVENTS
+#define EVENT_IMPACT 9
+#define EVENT_TWIST 10
+#define EVENT_ALARM 11 // an alarm went off (get_alarm says which), with CLOCK
+#define EVENT_CLICKS 16 // EVENT_CLICKS+n: a click_count of n (after config_click_count)
+#endif // MODES
+
 class hexbright {
  public:
   // This is the constructor, it is called when you create a hexbright object.
@@ -257,35 +437,107 @@ class hexbright {
   //   Defaults to 100 ms.
   // brightness (0-255) = brightness of rear led. note that rled brightness only has 2 bits of resolution and has visible flicker at the lowest setting.
   //   Defaults to 255 (full brightness)
+  // layer = LED_STATUS, LED_SKETCH or LED_PRINT.  Each layer has its own
+  //   countdowns; each update, each led shows the highest layer that isn't
+  //   LED_OFF (a layer in LED_WAIT keeps the led dark).  While a number is
+  //   printing, LED_PRINT holds both leds, so charge and power indications
+  //   don't need to wait for printing_number().
+  //   Defaults to LED_SKETCH.
   // Takes up 16 bytes.
-  static void set_led(unsigned char led, int on_time, int wait_time=100, unsigned char brightness=255);
+  static void set_led(unsigned char led, int on_time, int wait_time=100, unsigned char brightness=255,
+                      unsigned char layer=LED_SKETCH);
   // led = GLED or RLED
-  // returns LED_OFF, LED_WAIT, or LED_ON
+  // returns LED_OFF, LED_WAIT, or LED_ON for that layer (whether it's shown or not)
   // Takes up 54 bytes.
-  static unsigned char get_led_state(unsigned char led);
+  static unsigned char get_led_state(unsigned char led, unsigned char layer=LED_SKETCH);
   // returns the opposite color from the one passed in
   // Takes up 12 bytes.
   static unsigned char flip_color(unsigned char color);
   
   
-  // Get the raw thermal sensor reading. Takes up 18 bytes.
+  // Get the raw thermal sensor reading (from this update). Takes up 18 bytes.
   static int get_thermal_sensor();
-  // Get the degrees in celsius. I suggest calibrating your sensor, as described
-  //  in programs/temperature_calibration. Takes up 60 bytes
+  // Get the thermal sensor reading averaged over 64 updates, in 1/8ths of a
+  //  raw reading.  Noise is much lower, and it's at most 533 ms behind.
+  //  Overheat protection uses this.
+  static int get_filtered_thermal_sensor();
+  // The filtered reading we expect a few seconds from now, given the light
+  //  levels we've been running at (see THERMAL_MODEL).  Same units as above;
+  //  overheat protection uses this instead of the filtered reading.
+  static int get_predicted_thermal_sensor();
+  // Get the degrees in celsius (from the filtered reading). I suggest
+  //  calibrating your sensor, as described in programs/temperature_calibration.
   static int get_celsius();
-  // Get the degrees in fahrenheit. After calibrating your sensor, you'll need to
-  //  modify this as well. Takes up 60 bytes
+  // the same, in tenths of a degree
+  static int get_celsius_tenths();
+  // Get the degrees in fahrenheit.
   static int get_fahrenheit();
+  
+  // Two-point temperature calibration.  Uncalibrated, we use one unit's
+  //  readings (153 at 0C, 275 at 40C).  Each unit differs a little, and
+  //  overheat protection is in real degrees, so calibrate yours.
+  // Let the light settle at a known temperature (an ice bath is 0C, see
+  //  programs/temperature_calibration), then save the current filtered
+  //  reading as point 0 or 1.  The points must be at least 10 degrees apart.
+  //  They can be saved at different times; each is kept in EEPROM.
+  // Returns false if the point isn't 0 or 1, or would make the calibration
+  //  unusable.
+  static BOOL calibrate_temperature(unsigned char point, int celsius_tenths);
+  // forget the calibration, and go back to the default points
+  static void clear_temperature_calibration();
+
+#ifdef SETTINGS
+  // Settings that survive power off, by id (0 to SETTING_IDS-1; other ids
+  //  are ignored).  Values are cached in RAM, so reading is cheap.  Setting a
+  //  value queues it; it's written between updates, a byte at a time,
+  //  without blocking (and all at once if we turn off first).  Each change
+  //  is a new record in a ring, so writes are spread over the whole ring
+  //  instead of wearing out one cell.
+  static int get_setting(unsigned char id, int default_value);
+  static void set_setting(unsigned char id, int value);
+  // true if every setting has been written to EEPROM
+  static BOOL settings_saved();
+#endif
+
+#if defined(USAGE_STATS) && defined(DEBUG_SERIAL)
+  // Dumps the usage statistics over serial, a line per update ("USAGE", hex
+  //  lines, then "DONE").  Nothing is read from serial, so call this from
+  //  your own command handling.
+  static void print_usage();
+#endif
 
   // returns the raw avr voltage.  
   //  This is not equivalent to the battery voltage, and should be stable unless the 
   //  battery is very low or the voltage regulator is having problems.
   static int get_avr_voltage();
-  // returns true if we are in a low voltage state (unable to go to max brightness)
-  //  This triggers based on irregular power, which should only occur if we're
-  //  out of juice (due to voltage regulation)
+  // returns true if we are in a low voltage state (the battery is into its
+  //  reserve, get_battery_percent()<100, and max brightness is stepping down).
   //  This may be useful if you want your light to flash when running low on power
   static BOOL low_voltage_state();
+  // Battery left, in percent of the reserve: the voltage regulator hides the
+  //  battery until it's nearly empty (the last 40 mAh or so), so this stays
+  //  at 100 until then.  The estimate corrects for sag under load.  As it
+  //  falls, the maximum light level steps down smoothly (1000 at 100%, 550
+  //  at 50%, 100 at 0%).
+  static unsigned char get_battery_percent();
+  // Minutes of reserve left at the current light level (at least this many
+  //  while get_battery_percent() is 100).
+  static int get_battery_minutes();
+  // The current the light draws at a light level, in tenths of a milliamp
+  //  (rear leds not included).  See experiments/power_draw.
+  static word light_current(int level);
+#ifdef CHARGE_COUNTER
+  // Charge used since the battery was last fully charged, in mAh.  Every
+  //  update on battery adds the current we expect at the light level, plus
+  //  the rear leds and the accelerometer.  It survives resets, and is saved
+  //  to EEPROM when the light turns itself off.  CHARGED starts it over.
+  static word get_charge_used();
+  // The current we're drawing, in tenths of a milliamp
+  static word get_current();
+  // Minutes left at the current draw, from BATTERY_CAPACITY and the charge
+  //  used; once the battery is into its reserve, from get_battery_minutes().
+  static int get_runtime_minutes();
+#endif
 
 
   
@@ -293,12 +545,8 @@ class hexbright {
   //  CHARGING = 350 ms on, 350 ms off.
   //  CHARGED = solid on
   //  BATTERY = nothing.
-  // If you are using print_number, call it before this function if possible.
-  // I recommend the following (if using print_number()):
-  //  ...code that may call print number...
-  //  if(!printing_number())
-  //    print_charge(GLED);
-  //  ...end of loop...
+  // This uses the LED_STATUS layer, so numbers being printed and your own
+  //  set_led calls show over it.  Call it every loop.
   // See also: print_power
   static void print_charge(unsigned char led);
   // returns CHARGING, CHARGED, or BATTERY
@@ -307,13 +555,19 @@ class hexbright {
   
   // prints a number through the rear leds
   // 120 = 1 red flashes, 2 green flashes, one long red flash (0), 2 second delay.
-  // the largest printable value is +/-999,999,999, as the left-most digit is reserved.
-  // negative numbers begin with a leading long flash.
-  static void print_number(long number);
+  // any long can be printed; negative numbers begin with a leading long flash.
+  // base is 10, 16 (digits up to 15 flashes) or 2 (one flash or a long flash per bit).
+  // times is how many times to print it, 0 = until reset_print_number or the next print_number.
+  static void print_number(long number, unsigned char base=10, unsigned char times=1);
   // currently printing a number
   static BOOL printing_number();
   // reset printing; this immediately terminates the currently printing number.
   static void reset_print_number();
+  // the time (ms) from one flash to the next within a digit (default 300, max 2125),
+  //  from the last flash of a digit to the next digit (default 600, max 2125), and
+  //  the pause after the number (default 2500).  Flashes are on for 2/5 of
+  //  flash_time, zeros for 4/3 of it, and the negative sign for 5/3.
+  static void set_print_timing(int flash_time, int digit_time, int end_time);
 
   // reads a value between min_digit to max_digit-1, see hb-examples/numeric_input
   //  Twist the light to change the value.  When the current value changes, 
@@ -326,17 +580,89 @@ class hexbright {
   // grab the value that is currently selected (based on twist orientation)
   static unsigned int get_input_digit();
 
+#ifdef TELEMETRY
+  // Choose the readings sent each update, TELEMETRY_* bits (the default is
+  //  TELEMETRY_ALL).  Frames are queued for the uart's interrupt and never
+  //  wait; one that doesn't fit in the buffer is dropped (see the tick).
+  static void set_telemetry(unsigned char fields);
+#endif
+
+#ifdef MORSE
+  // Sends text in morse code through RLED, GLED or MORSE_LIGHT (the main
+  //  light, at level), at wpm words per minute (a dot is 1200/wpm ms; 8 wpm
+  //  is a 150 ms dot).  Below 4 wpm it's sent at 4, above 144 (a dot of one
+  //  update) at 144, and 0 sends nothing.
+  //  Letters, digits and , - . / : ; = ? @ are sent, spaces are gaps
+  //  between words, anything else is skipped.  The text is
+  //  read as it is sent, so it must stay around until printing_morse() is
+  //  false.  times is how many times to send it, 0 = until stop_morse.
+  // eg: hb.print_morse("SOS", MORSE_LIGHT, 8, MAX_LEVEL, 0);
+  static void print_morse(const char* text, unsigned char output, unsigned char wpm=12,
+                          int level=MAX_LEVEL, unsigned char times=1);
+  // the same, for text in flash: hb.print_morse_P(PSTR("CQ"), RLED);
+  static void print_morse_P(const char* text, unsigned char output, unsigned char wpm=12,
+                            int level=MAX_LEVEL, unsigned char times=1);
+  static BOOL printing_morse();
+  // the character being sent (an index into the text), -1 when we're done
+  static int get_morse_position();
+  // stops sending; the main light is left off (level 0)
+  static void stop_morse();
+#endif
+
   // prints charge state (using print_charge).
   //  if in a low battery state, flashes red for 50 ms, followed by a 1 second delay
-  // If you are using print_number, call it before this function if possible.
-  // I recommend the following (if using print_number()):
-  //  ...code that may call print number...
-  //  if(!printing_number())
-  //    print_power(GLED);
-  //  ...end of loop...
-  // see also print_charge for usage
+  // Like print_charge, this is on the LED_STATUS layer.
   static void print_power();
 
+#ifdef MODES
+  // Table-driven modes: describe each mode once (its light level, handlers,
+  //  timeout) and the events that move between modes, instead of a switch
+  //  over mode constants in loop().  Once this is called, each update()
+  //  finds this update's event (button, click count, timeout or motion),
+  //  takes the first transition that matches it, and runs the mode's tick.
+  //  Changing modes runs the old mode's exit, then the new mode's level
+  //  change and enter.  We start in mode 0 without its level change or
+  //  enter; call set_mode from setup to enter a mode properly.
+  // Both tables should be in flash (PROGMEM); transitions ends with {MODE_END, EVENT_NONE, MODE_END}.
+  //  hold_time and long_hold_time are in ms.  See programs/tactical.
+  static void set_modes(const mode_state* states, const mode_transition* transitions,
+                        word hold_time=300, word long_hold_time=1000);
+  // change modes now, as a transition would (handlers can call this)
+  static void set_mode(unsigned char mode);
+  static unsigned char get_mode();
+  // the event being handled this update (EVENT_NONE if there isn't one)
+  static unsigned char get_mode_event();
+  // milliseconds since we entered this mode
+  static unsigned long get_mode_time();
+#endif
+
+#ifdef CLOCK
+  // The clock counts seconds from power on (or set_clock), driven by update().
+  //  Each update adds the microseconds it really took (8333, not 8.3333 ms),
+  //  so the count doesn't drift from the crystal, and an update that runs
+  //  late is still counted.  Use it for countdowns instead of millis() or
+  //  TimeLib.
+  static void set_clock(unsigned long seconds);
+  static unsigned long get_clock();
+  // milliseconds into the current second
+  static word get_clock_millis();
+
+  // Alarms go off as the clock reaches their time, once.  get_alarm reports
+  //  it for one update (or EVENT_ALARM, with set_modes; if another event
+  //  takes that update, the alarm is reported again on the next).  Alarms
+  //  that go off together are reported on consecutive updates.
+  // alarm is 0 to CLOCK_ALARMS-1; at is a clock time in the future
+  static void set_alarm(unsigned char alarm, unsigned long at);
+  // seconds from now (up to a second less: the clock is mid-second); 0 goes
+  //  off on the next update
+  static void set_alarm_in(unsigned char alarm, unsigned long seconds);
+  static void clear_alarm(unsigned char alarm);
+  // seconds until the alarm goes off, 0 if it's not set (or has gone off)
+  static unsigned long get_alarm_remaining(unsigned char alarm);
+  // the alarm that went off this update, or ALARM_NONE
+  static unsigned char get_alarm();
+#endif
+
 
 #ifdef ACCELEROMETER
   // accepts things like ACC_REG_TILT
@@ -344,6 +670,53 @@ class hexbright {
   // using this may cause synchronization errors?
   static unsigned char read_accelerometer(unsigned char acc_reg);
   
+  /// sensor power management
+  // The accelerometer samples at 120 Hz by default, in lock-step with update().
+  //  Lower rates save sensor current and bus traffic; we only read the sensor
+  //  when it has a new sample.  Vector history, down and the motion events
+  //  are all kept in samples, so vector(1) is always the previous sample.
+  //  At 32 Hz and below, readings are no longer filtered (the filter assumes
+  //  consecutive readings are close together) and down is averaged over fewer
+  //  vectors.  Rates below 16 Hz are too slow for drop detection.
+  // rate = ACC_RATE_120, ACC_RATE_64, ... ACC_RATE_1
+  static void set_accelerometer_rate(unsigned char rate);
+  static unsigned char get_accelerometer_rate();
+  // Put the accelerometer to sleep after this many samples without a shake,
+  //  tap or orientation change; it then samples at 8 Hz until it senses
+  //  motion, and wakes to the active rate.  0 (the default) disables sleep.
+  //  We mirror the sensor's sleep state, and only read it at 8 Hz while asleep.
+  static void set_accelerometer_sleep(unsigned char samples);
+  // returns true if the accelerometer is sleeping (see set_accelerometer_sleep)
+  static BOOL accelerometer_sleeping();
+  // samples we couldn't read (up to 255) after a few tries; the previous
+  //  vector is repeated for them.  Anything but 0 means a bus or sensor problem.
+  static unsigned char get_accelerometer_errors();
+  
+  /// calibration
+  // Readings are scaled from counts (21.3 = 1G) to 1/100ths of a G using a
+  //  per-axis offset and gain.  Uncalibrated, every unit uses the data sheet's
+  //  nominal values; real parts are off by a count or two, which shows up as
+  //  a magnitude that isn't 100 at rest.
+  // To calibrate (see programs/accelerometer_calibration), call
+  //  start_accelerometer_calibration, then calibrate_accelerometer once per
+  //  update.  Set the light down on each of its six sides (tail up, tail down,
+  //  and on four sides, a quarter turn apart), holding it still for a second
+  //  each.  The order doesn't matter.
+  // calibrate_accelerometer returns the number of sides captured (0-6), then
+  //  CALIBRATION_SAVED once the calibration is in EEPROM and in use, or
+  //  CALIBRATION_FAILED if the results are out of range.
+  static void start_accelerometer_calibration();
+  static unsigned char calibrate_accelerometer();
+  // forget the calibration, and go back to nominal values
+  static void clear_accelerometer_calibration();
+  
+  /// filters
+  // Runs one of the reading filters (FILTER_NONE, FILTER_LOW_PASS, ...) on a
+  //  single axis, for benchmarks.  Compare them with filter_bench in
+  //  experiments/accelerometer_readings/test_program, and time them with
+  //  tests/filter_benchmark.  Unused, this costs nothing.
+  static int run_filter(unsigned char filter, int last_estimate, int current_reading);
+  
   /// interface with the tilt register
   // look at the datasheet page 15 for more details
   //  // http://cache.freescale.com/files/sensors/doc/data_sheet/MMA7660FC.pdf
@@ -377,11 +750,28 @@ class hexbright {
   //  than .5Gs of acceleration.
   static BOOL moved(int tolerance=50);
   
-  // returns a value from 100 to -100. 0 is no movement.
-  //  This returns lots of noise if we're pointing up or down.
-  //  It does have issues if spun too fast or too slow.  I've
-  //  found it works well if rotated one-handed.
+  /// rotation around the light axis
+  // Tracked on every new vector, in 1/256ths of a turn (clockwise is positive),
+  //  using the acceleration perpendicular to the light axis.  While pointing
+  //  up or down (or falling) there's too little of it, and tracking pauses;
+  //  after a pause of more than 50 ms, rotation during the pause is lost.
+  //  Rotation aliases when the angle moves half a turn between readings:
+  //  across a pause, or in a hard flick, where the reading is mostly the
+  //  flick's own acceleration (the sensor saturates at 1.5 Gs) rather than
+  //  gravity.  A flick's direction can't be trusted.
+  // returns rotation during the last update, in 1/256ths of a turn.
+  //  0 when there was no new vector or tracking is paused.  Add it up over
+  //  time for a knob (see programs/spin_level).
   static char get_spin();
+  // total rotation since reset_rotation, in 1/256ths of a turn (+/- 127 turns)
+  static int get_rotation();
+  static void reset_rotation();
+  // rotation rate in degrees per second, averaged over about 8 samples
+  static int get_rotation_rate();
+  // the current (or last trackable) angle, 0-255
+  static unsigned char get_rotation_angle();
+  // true if the last vector could be tracked
+  static BOOL rotation_tracking();
   //returns the angle between straight down and our current vector
   // returns a value from 0 to 1. 0 == down, 1 == straight up.
   // Multiply by 180 to get degrees.  Expect noise of about .1 (15-20 degrees).
@@ -390,6 +780,26 @@ class hexbright {
   // noise varies partially based on sample rate, which is not currently configurable
   static double angle_change();
   
+#ifdef ACCEL_EVENTS
+  /// motion events, detected during update() from each new vector
+  // returns the event detected during the last update, or ACCEL_NONE:
+  //  ACCEL_DROP: we have been in free-fall for about 50 ms.
+  //  ACCEL_IMPACT: we hit something within half a second of a free-fall.
+  //  ACCEL_TWIST: we rotated around the light axis (at least 45 degrees)
+  //   and have since stopped rotating.
+  static unsigned char get_motion_event();
+  // returns the value for the last event (0 for ACCEL_NONE and ACCEL_DROP).
+  //  ACCEL_IMPACT: the peak acceleration in 1/100ths of Gs.  The sensor saturates
+  //   at 1.5G per axis, so expect at most 260.
+  //  ACCEL_TWIST: degrees of rotation, positive is clockwise (looking down the beam).
+  static int get_motion_value();
+  // returns true while we are in free-fall.  If you want to cut the light
+  //  before it hits the ground, check this every loop:
+  //   if(hb.falling())
+  //     hb.set_light(CURRENT_LEVEL, 0, NOW);
+  static BOOL falling();
+#endif // ACCEL_EVENTS
+  
   // returns how much acceleration is occurring on a vector, ignoring down.
   //  If no acceleration is occurring, the vector should be close to {0,0,0}.
   static void absolute_vector(int* out_vector, int* in_vector);
@@ -424,7 +834,31 @@ class hexbright {
   
   static void print_vector(int* vector, const char* label);
   
+#ifdef ACCEL_CAPTURE
+  /// raw capture to EEPROM
+  // Records raw 6-bit samples (and tilt register changes) to EEPROM,
+  //  overwriting all of it below EEPROM_USAGE (or the next block up, without
+  //  USAGE_STATS).  Samples are delta and variable-length encoded, so a still
+  //  light costs 3 bits per sample and a moving light 10-20.
+  //  That's about 4 seconds at rest, or 1.5 seconds of constant motion.
+  // Once armed, recording starts when acceleration deviates from 1G by more
+  //  than threshold (in 1/100ths of Gs), beginning with the 100 ms before the
+  //  trigger, and ends when EEPROM is full or stop_capture is called.
+  // EEPROM is written between updates without blocking.  If we get too far
+  //  ahead of it, samples are dropped (and the gap is recorded).
+  // Decode the dump with experiments/accelerometer_readings/test_program/capture_decode,
+  //  see tests/accelerometer_capture for a sketch that prints it.
+  static void start_capture(unsigned char threshold);
+  // ends the recording once buffered samples are queued (or disarms the capture)
+  static void stop_capture();
+  // returns CAPTURE_OFF, CAPTURE_ARMED, CAPTURE_RECORDING or CAPTURE_DONE
+  static unsigned char get_capture_state();
+#endif // ACCEL_CAPTURE
+  
  private: // internal to the library
+#ifndef __AVR
+ public: // the tests drive these directly
+#endif
   // good documentation:
   // http://cache.freescale.com/files/sensors/doc/app_note/AN3461.pdf
   // http://cache.freescale.com/files/sensors/doc/data_sheet/MMA7660FC.pdf
@@ -432,49 +866,143 @@ class hexbright {
   // reads the x,y,z axes + the tilt register.
   static void read_accelerometer();
   
+  // writes the rate, sleep and interrupt configuration, then activates the sensor
   static void enable_accelerometer();
+  // updates between accelerometer samples at the current rate
+  static unsigned char accelerometer_ticks();
+  // true once every accelerometer_ticks() updates
+  static BOOL accelerometer_sample_due();
+  // mirrors the sensor's auto-sleep counter
+  static void track_accelerometer_sleep();
+  // converts a count of 120 Hz samples to the current rate (at least 1)
+  static unsigned char samples_at_rate(unsigned char samples);
+  
+  // reads the calibration from EEPROM (or uses nominal values)
+  static void load_accelerometer_calibration();
+  // solves for offset and gain from the six sides, and saves them
+  static unsigned char save_accelerometer_calibration();
   
   // advances the current vector to the next (a place for more data)
   static void next_vector();
   
-#ifndef __AVR
- public:
-#endif
   // Recalculate down.  If there has been lots of movement, this could easily
   //  be off. But not recalculating down in such cases costs more work, and
   //  even then, we're just guessing.  Overall, a windowed average works fairly
   //  well.
   static void find_down();
+  // updates the rotation around the light axis from vector(0)
+  static void track_rotation();
+  // atan2 in 1/256ths of a turn, without floating point
+  static unsigned char binary_atan2(int y, int x);
+#ifdef ACCEL_EVENTS
+  // runs the drop, impact and twist detectors on vector(0)
+  static void detect_motion();
+#endif
+#ifdef ACCEL_CAPTURE
+  // adds a raw sample (6-bit, sign extended) to the capture
+  static void capture_sample(char* raw, unsigned char tilt_register);
+  // writes the next queued byte, if EEPROM is ready for it
+  static void capture_write();
+  static void capture_bits(unsigned int value, unsigned char bits);
+  // encodes a ring slot (x, y, z, tilt, dropped)
+  static void capture_encode(char* slot);
+  static void capture_end();
+  // moves samples from the ring to the EEPROM queue, as room allows
+  static void capture_drain();
+#endif
 
   static int low_pass_filter(int last_estimate, int current_reading);
   static int stdev_filter(int last_estimate, int current_reading);
   static int stdev_filter2(int last_estimate, int current_reading);
   static int stdev_filter3(int last_estimate, int current_reading);
+  static int step_filter(int last_estimate, int current_reading);
+  // the filter used on new readings (depends on the sample rate)
+  static int filter_reading(int last_estimate, int current_reading);
   
 #endif // ACCELEROMETER
   
  private:
+#ifndef __AVR
+ public: // the tests drive these directly
+#endif
   static void adjust_light();
   static void set_light_level(unsigned long level);
   static void apply_max_light_level();
   static void detect_overheating();
+#ifdef THERMAL_MODEL
+  static void update_thermal_model();
+#endif
   static void detect_low_battery();
+  static void estimate_battery();
+  static void load_battery_reference();
+  static void save_battery_reference();
+#ifdef SETTINGS
+  static void load_settings();
+  static void write_settings();
+  static void flush_settings();
+#endif
+#ifdef MODES
+  static void update_modes();
+  static unsigned char next_mode_event();
+  static void handle_mode_event(unsigned char event);
+  static void enter_mode(unsigned char mode);
+#endif
+#ifdef USAGE_STATS
+  static void load_usage();
+  static void update_usage();
+  static void write_usage();
+  static void flush_usage();
+#ifdef DEBUG_SERIAL
+  static void send_usage();
+#endif
+#endif
+#ifdef CLOCK
+  static void start_clock();
+  static void update_clock();
+#endif
+#ifdef TELEMETRY
+  static void init_telemetry();
+  // fills frame (TELEMETRY_FRAME_MAX bytes), returns its length
+  static unsigned char telemetry_frame(unsigned char* frame);
+  static void send_telemetry();
+#endif
+#ifdef CHARGE_COUNTER
+  static void load_charge_used();
+  static void save_charge_used();
+  static void count_charge();
+#endif
   
   static void update_number();
+#ifdef MORSE
+  static void update_morse();
+  static void start_morse(const char* text, BOOL progmem, unsigned char output,
+                          unsigned char wpm, int level, unsigned char times);
+  static void morse_output(BOOL on, unsigned char updates);
+#endif
+  static void start_number();
+  static void start_digit();
+  // digit 0 is the right-most digit of the number being printed
+  static unsigned char get_print_digit(unsigned char digit);
   
   // controls actual led hardware set.
   //  As such, state = HIGH or LOW
   static void _set_led(unsigned char led, unsigned char state);
-  static void _led_on(unsigned char led);
+  static void _led_on(unsigned char led, unsigned char brightness);
   static void _led_off(unsigned char led);
   static void adjust_leds();
   
   static void read_thermal_sensor();
+  // reads the temperature calibration from EEPROM (or uses the defaults)
+  static void load_temperature_calibration();
   static void read_charge_state();
   static void read_avr_voltage();
 
   static void read_button();
   
+  // checksum of length bytes of EEPROM, to be stored after them.
+  //  Erased (all 0xFF) or zeroed blocks never match.
+  static unsigned char eeprom_checksum(int address, unsigned char length);
+  
 #ifdef FLASH_CHECKSUM
   // read through flash, return the checksum
   static int flash_checksum();
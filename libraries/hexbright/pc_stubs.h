@@ -6,6 +6,8 @@
 */
 
 #include <cstdlib>
+#include <stdint.h>
+#include <stddef.h>
 #include <math.h>
 
 #define INPUT 0
@@ -20,6 +22,15 @@ int* __brkval=&__heap_start;
 int pgm_read_byte(int i) {
   return 0;
 }
+// tables in flash are ordinary arrays here
+#define PROGMEM
+int pgm_read_byte(const unsigned char* address) {
+  return *address;
+}
+unsigned int pgm_read_word(const unsigned int* address) {
+  return *address;
+}
+#define pgm_read_ptr(address) ((void*)*(address))
 
 // functions pinMode through analogRead cost us 850 bytes in total.  
 //  Implementing these in avr-c may be ideal.
@@ -45,6 +56,20 @@ void analogWrite(unsigned char pin, unsigned char lh) {
   return 0;
   }*/
 unsigned int read_adc(unsigned char pin) {
+  return 0;
+}
+
+// EEPROM, from avr/eeprom.h.  Writes complete immediately.
+#define E2END 511
+unsigned char eeprom_data[E2END+1];
+unsigned long eeprom_writes[E2END+1]; // for wear tests
+#define eeprom_is_ready() true
+void eeprom_write_byte(uint8_t* address, uint8_t value) {
+  eeprom_data[(size_t)address] = value;
+  eeprom_writes[(size_t)address]++;
+}
+uint8_t eeprom_read_byte(const uint8_t* address) {
+  return eeprom_data[(size_t)address];
 }
 
 // costs us 80 bytes
@@ -55,8 +80,9 @@ unsigned long micros() {
 void delayMicroseconds(int time) {
   return;
 }
+unsigned long stub_millis = 0; // the tests move time along
 unsigned long millis() {
-  return 0;
+  return stub_millis;
 }
 
 
@@ -122,3 +148,15 @@ class WireClass {
 
 WireClass Wire;
 
+
+// twi.c is avr-only.  The accelerometer is fed through fake_read_accelerometer,
+//  or, for raw readings, by setting twi_data before read_accelerometer.
+unsigned char twi_data[6];
+unsigned char twi_readRegisters(unsigned char address, unsigned char reg, unsigned char* data, unsigned char length) {
+  for(int i=0; i<length && i<(int)sizeof(twi_data); i++)
+    data[i] = twi_data[i];
+  return length;
+}
+unsigned char twi_writeTo(unsigned char address, unsigned char* data, unsigned char length, unsigned char wait, unsigned char sendStop) {
+  return 0;
+}
@@ -17,6 +17,8 @@
   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
   Modified 2012 by Todd Krein (todd@krein.org) to implement repeated starts
+  Modified for hexbright: combined register reads, reads straight into the
+  caller's buffer, settable SCL frequency, bus timeout and recovery
 */
 
 #include <math.h>
@@ -43,10 +45,13 @@ static volatile uint8_t twi_slarw;
 static volatile uint8_t twi_sendStop;			// should the transaction end with a stop
 static volatile uint8_t twi_inRepStart;			// in the middle of a repeated start
 
-static uint8_t twi_masterBuffer[TWI_BUFFER_LENGTH];
+static uint8_t twi_masterBuffer[TWI_BUFFER_LENGTH];	// transmit only
 static volatile uint8_t twi_masterBufferIndex;
 static volatile uint8_t twi_masterBufferLength;
 
+static uint8_t* volatile twi_rxBuffer;			// the caller's buffer, read into directly
+static volatile uint8_t twi_rxLength;			// bytes to read after the write (twi_readRegisters)
+
 static volatile uint8_t twi_error;
 
 /* 
@@ -61,6 +66,7 @@ void twi_init(void)
   twi_state = TWI_READY;
   twi_sendStop = true;		// default value
   twi_inRepStart = false;
+  twi_rxLength = 0;
   
   // activate internal pullups for twi.
   digitalWrite(SDA, 1);
@@ -69,15 +75,72 @@ void twi_init(void)
   // initialize twi prescaler and bit rate
   cbi(TWSR, TWPS0);
   cbi(TWSR, TWPS1);
-  TWBR = ((F_CPU / TWI_FREQ) - 16) / 2;
+  twi_setFrequency(TWI_FREQ);
+
+  // enable twi module, acks, and twi interrupt
+  TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA);
+}
+
+/* 
+ * Function twi_setFrequency
+ * Desc     sets the SCL frequency (the prescaler is left at 1)
+ * Input    frequency: in Hz; 400000 is fast mode (the MMA7660 supports it)
+ * Output   none
+ */
+void twi_setFrequency(uint32_t frequency)
+{
+  TWBR = ((F_CPU / frequency) - 16) / 2;
 
   /* twi bit rate formula from atmega128 manual pg 204
   SCL Frequency = CPU Clock Frequency / (16 + (2 * TWBR))
   note: TWBR should be 10 or higher for master mode
-  It is 72 for a 16mhz Wiring board with 100kHz TWI */
+  It is 72 for a 16mhz Wiring board with 100kHz TWI.
+  The atmega168 manual drops the limit; at 8mhz, 400kHz is a TWBR of 2. */
+}
 
-  // enable twi module, acks, and twi interrupt
-  TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA);
+/* 
+ * Function twi_recover
+ * Desc     gives up on a transaction that's taken too long: lets go of the
+ *          bus, clocks out whatever byte a slave is stuck sending (it holds
+ *          SDA low until it's done), and starts over
+ * Input    none
+ * Output   none
+ */
+static void twi_recover(void)
+{
+  uint8_t i;
+
+  TWCR = 0; // disable twi, the pins are ours again
+
+  // SCL is driven low or left to the pullup, like the bus would
+  pinMode(SDA, INPUT);
+  digitalWrite(SDA, 1);
+  pinMode(SCL, INPUT);
+  for(i = 0; i < 9 && !digitalRead(SDA); i++){
+    digitalWrite(SCL, 0);
+    pinMode(SCL, OUTPUT);
+    delayMicroseconds(5);
+    pinMode(SCL, INPUT);
+    digitalWrite(SCL, 1);
+    delayMicroseconds(5);
+  }
+
+  twi_init();
+}
+
+/* 
+ * Function twi_timedOut
+ * Desc     checks a wait against TWI_TIMEOUT, recovering the bus if it's over
+ * Input    start: micros() when the wait started
+ * Output   true if we gave up
+ */
+static uint8_t twi_timedOut(unsigned long start)
+{
+  if(micros() - start < TWI_TIMEOUT){
+    return false;
+  }
+  twi_recover();
+  return true;
 }
 
 /* 
@@ -104,23 +167,21 @@ void twi_setAddress(uint8_t address)
  */
 uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length, uint8_t sendStop)
 {
-  uint8_t i;
-
-  // ensure data will fit into buffer
-  if(TWI_BUFFER_LENGTH < length){
-    return 0;
-  }
+  unsigned long start = micros();
 
   // wait until twi is ready, become master receiver
   while(TWI_READY != twi_state){
-    continue;
+    if(twi_timedOut(start)){
+      return 0;
+    }
   }
   twi_state = TWI_MRX;
   twi_sendStop = sendStop;
   // reset error state (0xFF.. no error occured)
   twi_error = 0xFF;
 
-  // initialize buffer iteration vars
+  // initialize buffer iteration vars; the ISR reads straight into data
+  twi_rxBuffer = data;
   twi_masterBufferIndex = 0;
   twi_masterBufferLength = length-1;  // This is not intuitive, read on...
   // On receive, the previously configured ACK/NACK setting is transmitted in
@@ -150,20 +211,75 @@ uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length, uint8_t sen
 
   // wait for read operation to complete
   while(TWI_MRX == twi_state){
-    continue;
+    if(twi_timedOut(start)){
+      return 0;
+    }
   }
 
   if (twi_masterBufferIndex < length)
     length = twi_masterBufferIndex;
 
-  // copy twi buffer to data
-  for(i = 0; i < length; ++i){
-    data[i] = twi_masterBuffer[i];
-  }
-	
   return length;
 }
 
+/* 
+ * Function twi_readRegisters
+ * Desc     reads a series of registers in one transaction: the register
+ *          address is written, then a repeated start turns the bus around
+ *          for the read, all from the ISR.  The bus is ours throughout.
+ * Input    address: 7bit i2c device address
+ *          reg: the first register to read
+ *          data: pointer to byte array, read into directly
+ *          length: number of bytes to read into array
+ * Output   number of bytes read, 0 on any error or a timeout
+ */
+uint8_t twi_readRegisters(uint8_t address, uint8_t reg, uint8_t* data, uint8_t length)
+{
+  unsigned long start = micros();
+
+  // wait until twi is ready, become master transmitter (then receiver)
+  while(TWI_READY != twi_state){
+    if(twi_timedOut(start)){
+      return 0;
+    }
+  }
+  twi_state = TWI_MTX;
+  twi_sendStop = true;
+  // reset error state (0xFF.. no error occured)
+  twi_error = 0xFF;
+
+  twi_masterBuffer[0] = reg;
+  twi_masterBufferIndex = 0;
+  twi_masterBufferLength = 1;
+  twi_rxBuffer = data;
+  twi_rxLength = length;
+
+  // build sla+w, slave device address + w bit
+  twi_slarw = TW_WRITE;
+  twi_slarw |= address << 1;
+
+  if (true == twi_inRepStart) {
+    // as in twi_writeTo
+    twi_inRepStart = false;
+    TWDR = twi_slarw;
+    TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWEN) | _BV(TWIE);	// enable INTs, but not START
+  }
+  else
+    // send start condition
+    TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWEN) | _BV(TWIE) | _BV(TWSTA);	// enable INTs
+
+  // wait for the write, repeated start and read to complete
+  while(TWI_READY != twi_state){
+    if(twi_timedOut(start)){
+      return 0;
+    }
+  }
+
+  if (twi_error != 0xFF)
+    return 0;
+  return twi_masterBufferIndex;
+}
+
 /* 
  * Function twi_writeTo
  * Desc     attempts to become twi bus master and write a
@@ -178,10 +294,12 @@ uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length, uint8_t sen
  *          2 .. address send, NACK received
  *          3 .. data send, NACK received
  *          4 .. other twi error (lost bus arbitration, bus error, ..)
+ *          5 .. timeout, the bus was reset
  */
 uint8_t twi_writeTo(uint8_t address, uint8_t* data, uint8_t length, uint8_t wait, uint8_t sendStop)
 {
   uint8_t i;
+  unsigned long start = micros();
 
   // ensure data will fit into buffer
   if(TWI_BUFFER_LENGTH < length){
@@ -190,7 +308,9 @@ uint8_t twi_writeTo(uint8_t address, uint8_t* data, uint8_t length, uint8_t wait
 
   // wait until twi is ready, become master transmitter
   while(TWI_READY != twi_state){
-    continue;
+    if(twi_timedOut(start)){
+      return 5;
+    }
   }
   twi_state = TWI_MTX;
   twi_sendStop = sendStop;
@@ -200,6 +320,7 @@ uint8_t twi_writeTo(uint8_t address, uint8_t* data, uint8_t length, uint8_t wait
   // initialize buffer iteration vars
   twi_masterBufferIndex = 0;
   twi_masterBufferLength = length;
+  twi_rxLength = 0;
   
   // copy data to twi buffer
   for(i = 0; i < length; ++i){
@@ -230,7 +351,9 @@ uint8_t twi_writeTo(uint8_t address, uint8_t* data, uint8_t length, uint8_t wait
 
   // wait for write operation to complete
   while(wait && (TWI_MTX == twi_state)){
-    continue;
+    if(twi_timedOut(start)){
+      return 5;
+    }
   }
   
   if (twi_error == 0xFF)
@@ -267,12 +390,16 @@ void twi_reply(uint8_t ack)
  */
 void twi_stop(void)
 {
+  uint8_t tries = 0;
+
   // send stop condition
   TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTO);
 
   // wait for stop condition to be exectued on bus
   // TWINT is not set after a stop condition!
-  while(TWCR & _BV(TWSTO)){
+  // (this runs in the ISR, so it can't wait on micros; a stuck bus gives
+  //  up after 256 tries, and the next transaction times out and resets it)
+  while((TWCR & _BV(TWSTO)) && --tries){
     continue;
   }
 
@@ -314,6 +441,15 @@ ISR(TWI_vect)
         // copy data to output register and ack
         TWDR = twi_masterBuffer[twi_masterBufferIndex++];
         twi_reply(1);
+      }else if(twi_rxLength){
+        // twi_readRegisters: turn the bus around with a repeated start,
+        //  and handle it here (TW_REP_START sends the new sla+r)
+        twi_slarw |= TW_READ;
+        twi_masterBufferIndex = 0;
+        twi_masterBufferLength = twi_rxLength-1; // see twi_readFrom
+        twi_rxLength = 0;
+        twi_state = TWI_MRX;
+        TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN) | _BV(TWIE) | _BV(TWEA);
       }else{
 	if (twi_sendStop)
           twi_stop();
@@ -343,7 +479,7 @@ ISR(TWI_vect)
     // Master Receiver
     case TW_MR_DATA_ACK: // data received, ack sent
       // put byte into buffer
-      twi_masterBuffer[twi_masterBufferIndex++] = TWDR;
+      twi_rxBuffer[twi_masterBufferIndex++] = TWDR;
     case TW_MR_SLA_ACK:  // address sent, ack received
       // ack if more bytes are expected, otherwise nack
       if(twi_masterBufferIndex < twi_masterBufferLength){
@@ -354,7 +490,7 @@ ISR(TWI_vect)
       break;
     case TW_MR_DATA_NACK: // data received, nack sent
       // put final byte into buffer
-      twi_masterBuffer[twi_masterBufferIndex++] = TWDR;
+      twi_rxBuffer[twi_masterBufferIndex++] = TWDR;
 	if (twi_sendStop)
           twi_stop();
 	else {
@@ -367,6 +503,7 @@ ISR(TWI_vect)
 	}    
 	break;
     case TW_MR_SLA_NACK: // address sent, nack received
+      twi_error = TW_MR_SLA_NACK;
       twi_stop();
       break;
     // TW_MR_ARB_LOST handled by TW_MT_ARB_LOST case
@@ -34,7 +34,11 @@ extern "C"
   #endif
 
   #ifndef TWI_BUFFER_LENGTH
-  #define TWI_BUFFER_LENGTH 6 // for hexbright, our maximum rx/tx buffer size is 6
+  #define TWI_BUFFER_LENGTH 6 // for hexbright, our maximum tx size is 6 (reads go straight to the caller's buffer)
+  #endif
+
+  #ifndef TWI_TIMEOUT
+  #define TWI_TIMEOUT 2000 // microseconds a transaction can take before we reset the bus
   #endif
 
   #define TWI_READY 0
@@ -45,7 +49,9 @@ extern "C"
   
   void twi_init(void);
   void twi_setAddress(uint8_t);
+  void twi_setFrequency(uint32_t);
   uint8_t twi_readFrom(uint8_t, uint8_t*, uint8_t, uint8_t);
+  uint8_t twi_readRegisters(uint8_t, uint8_t, uint8_t*, uint8_t);
   uint8_t twi_writeTo(uint8_t, uint8_t*, uint8_t, uint8_t, uint8_t);
   uint8_t twi_transmit(const uint8_t*, uint8_t);
   void twi_attachSlaveRxEvent( void (*)(uint8_t*, int) );
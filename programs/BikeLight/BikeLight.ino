@@ -29,77 +29,74 @@ either expressed or implied, of the FreeBSD Project.
 
 #include <hexbright.h>
 
-#define OFF_MODE 0
-#define BLINKY_MODE 1
-#define CYCLE_MODE 2
 #define OFF_TIME 650 // milliseconds before going off on the next normal button press
-#define BRIGHTNESS_OFF 0
-
-unsigned long short_press_time = 0;
-
-
-int mode = 0;
 
+// A click within OFF_TIME of the last one toggles the level; once the
+//  level has settled, a click turns us off.
+#define MODE_OFF 0
+#define MODE_CYCLE 1
+#define MODE_CYCLE_SETTLED 2
+#define MODE_BLINKY 3
 
 hexbright hb;
 
-void setup() {
-  hb.init_hardware();
-} 
+int brightness_level = 1;
 
-void loop() {
-  hb.update();
-  static int brightness_level = 1;
-  randomSeed(analogRead(0));
+void off_enter() {
+  // in case we are under usb power, reset state
+  brightness_level = 1;
+}
+
+void cycle_enter() {
   int levels[] = {500,1000};
+  brightness_level = (brightness_level+1)%2;
+  hb.set_light(CURRENT_LEVEL, levels[brightness_level], 150);
+}
 
-  //// Button actions to recognize, one-time actions to take as a result
-  if(hb.button_just_released()) {
-    if(hb.button_pressed_time()<300) { //<300 milliseconds
-    
-      if(short_press_time+OFF_TIME<millis() && mode!=OFF_MODE) {
-        // it's been a while since our last button press, turn off
-        mode = OFF_MODE;
-        hb.set_light(CURRENT_LEVEL, OFF_LEVEL, NOW);
-        // in case we are under usb power, reset state
-        brightness_level = 1;
-      } else {
-        short_press_time = millis();
-        mode = CYCLE_MODE;
-        brightness_level = (brightness_level+1)%2;
-        hb.set_light(CURRENT_LEVEL, levels[brightness_level], 150);
-      }      
-      
-    } else if (hb.button_pressed_time() < 1000) {
-      mode = BLINKY_MODE;
-    }
+void cycle_tick() { // print the current flashlight temperature
+  if(!hb.printing_number()) {
+    hb.print_number(hb.get_fahrenheit());
   }
-  if(hb.button_pressed_time()>1000) { // if held for over 1000 milliseconds (whether or not it's been released), go to OFF mode
-    mode = OFF_MODE;
-    hb.set_light(CURRENT_LEVEL, OFF_LEVEL, NOW);
-    // in case we are under usb power, reset state
-    brightness_level = 1;
+}
+
+void blinky_tick() { // random blink
+  static unsigned long flash_time = 0;
+  static int wait = 0;
+  if(flash_time+wait<millis()) {
+    flash_time = millis();
+    // fade from max to 0 over a random time btwn 30 and 350 milliseconds (length flash "on")
+    hb.set_light(MAX_LEVEL,0,random(30,350));
+    // only light up again after 50 - 500 ms (length flash "off")
+    wait = random(50,500);
   }
+}
 
+const mode_state modes[] PROGMEM = {
+  // level        change time  timeout   flags              enter        tick         exit
+  {OFF_LEVEL,     NOW,         0,        MODE_PRINT_CHARGE, off_enter,   NULL,        NULL}, // MODE_OFF
+  {CURRENT_LEVEL, NOW,         OFF_TIME, 0,                 cycle_enter, cycle_tick,  NULL}, // MODE_CYCLE
+  {CURRENT_LEVEL, NOW,         0,        0,                 NULL,        cycle_tick,  NULL}, // MODE_CYCLE_SETTLED
+  {CURRENT_LEVEL, NOW,         0,        0,                 NULL,        blinky_tick, NULL}, // MODE_BLINKY
+};
+
+const mode_transition transitions[] PROGMEM = {
+  // from        event            to
+  {MODE_OFF,     EVENT_CLICK,     MODE_CYCLE},
+  {MODE_CYCLE,   EVENT_CLICK,     MODE_CYCLE},
+  {MODE_CYCLE,   EVENT_TIMEOUT,   MODE_CYCLE_SETTLED},
+  {MODE_ANY,     EVENT_CLICK,     MODE_OFF}, // it's been a while since our last button press
+  {MODE_ANY,     EVENT_RELEASE,   MODE_BLINKY}, // <1000 milliseconds
+  // held for 1000 milliseconds (whether or not it's been released)
+  {MODE_ANY,     EVENT_LONG_HOLD, MODE_OFF},
+  {MODE_END, EVENT_NONE, MODE_END}
+};
 
-  //// Actions over time for a given mode
-  if(mode == BLINKY_MODE) { // random blink
-    static int i = 0;
-    if(!i) {     
-     // fade from max to 0 over a random time btwn 30 and 350 milliseconds (length flash "on") 
-      hb.set_light(MAX_LEVEL,0,random(30,350)); 
-      // only light up every random number of times btwn 6 and 60 through
-      // which should equate to 50 - 500 ms (length flash "off")
-      i=random(50,500)/8.3333; 
-    }
-    i--;
-  } else if (mode == CYCLE_MODE) { // print the current flashlight temperature
-    if(!hb.printing_number()) {
-      hb.print_number(hb.get_fahrenheit());
-    }
-  } else if (mode == OFF_MODE) { // charging, or turning off
-    if(!hb.printing_number()) {
-      hb.print_charge(GLED);
-    }
-  }
+void setup() {
+  hb.init_hardware();
+  randomSeed(analogRead(0));
+  hb.set_modes(modes, transitions, 300, 1000);
+}
+
+void loop() {
+  hb.update();
 }
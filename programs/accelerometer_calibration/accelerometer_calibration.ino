@@ -0,0 +1,78 @@
+/*
+Copyright (c) 2012, "David Hilton" <dhiltonp@gmail.com>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met: 
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer. 
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution. 
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those
+of the authors and should not be interpreted as representing official policies, 
+either expressed or implied, of the FreeBSD Project.
+*/
+
+#include <hexbright.h>
+
+// Usage notes are in the readme file in this same directory.
+hexbright hb;
+
+unsigned char sides = 0;
+BOOL cleared = false; // once per hold
+
+void setup() {
+  hb.init_hardware();
+  hb.set_light(0,0,NOW); // stay on until we're done
+  hb.start_accelerometer_calibration();
+}
+
+void loop() {
+  hb.update();
+
+  // hold the button for two seconds to forget the calibration
+  if(hb.button_just_pressed())
+    cleared = false;
+  if(!cleared && hb.button_pressed() && hb.button_pressed_time()>2000) {
+    cleared = true;
+    hb.clear_accelerometer_calibration();
+    hb.start_accelerometer_calibration();
+    sides = 0;
+    hb.set_led(RLED, 1000);
+  }
+
+  unsigned char result = hb.calibrate_accelerometer();
+  if(result==CALIBRATION_SAVED) {
+    // show we're done, then turn off
+    if(sides!=CALIBRATION_SAVED)
+      hb.set_led(GLED, 2000);
+    else if(hb.get_led_state(GLED)==LED_OFF)
+      hb.set_light(CURRENT_LEVEL, OFF_LEVEL, NOW);
+  } else if(result==CALIBRATION_FAILED) {
+    // something moved while we were capturing; start over
+    hb.set_led(RLED, 2000);
+    hb.start_accelerometer_calibration();
+    result = 0;
+  } else if(result>sides) {
+    hb.set_led(GLED, 300); // got this side
+  } else if(hb.get_led_state(GLED)==LED_OFF) {
+    // blink the number of sides we have
+    if(!hb.printing_number())
+      hb.print_number(result);
+  }
+  sides = result;
+}
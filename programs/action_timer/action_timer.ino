@@ -28,22 +28,19 @@ either expressed or implied, of the FreeBSD Project.
 */
 
 #include <hexbright.h>
-#include <TimeLib.h>
 
 hexbright hb;
 
-void setup() {
-  hb.init_hardware();
-}
+// Modes
+#define MODE_WAIT 0
+#define MODE_DARK 1 // MODE_WAIT, after turning the light off
+#define MODE_SECOND_PRESS_WAIT 2
+#define MODE_SECOND_PRESS 3
+#define MODE_LIGHT_SELECT 4
+#define MODE_SET_ACTION 5
 
 #define WAIT_MODE 0
 #define OFF_MODE 1
-#define LIGHT_SELECT_MODE 2
-#define SECOND_PRESS_WAIT_MODE 3
-#define SET_ACTION_MODE 4
-
-// primary mode can be wait, light_select, or set_action
-int primary_mode = WAIT_MODE;
 
 // action mode can be wait or off
 int action_mode = OFF_MODE;
@@ -57,115 +54,136 @@ int action_light_level = 0;
 
 int brightness_level = 0;
 
+#define ACTION_ALARM 0
 
-void loop() {
-  hb.update();
-  // primary mode selections:
-  switch (primary_mode) {
-  case WAIT_MODE:
-    // handle action_mode
-    if(action_mode == OFF_MODE && hb.light_change_remaining() == 0 && hb.get_light_level() <= 0 && !hb.button_pressed()) {
-      // nothing's happening, turn off
-      hb.set_light(CURRENT_LEVEL, OFF_LEVEL, NOW);
-      // or print charge state if we're plugged in
+int action_time_remaining() { // in HHMM, rounded up to the minute
+  unsigned long minutes = (hb.get_alarm_remaining(ACTION_ALARM)+59)/60;
+  return (minutes/60)*100 + minutes%60;
+}
+
+void wait_tick() {
+  // handle action_mode
+  if(action_mode == OFF_MODE && hb.light_change_remaining() == 0 && hb.get_light_level() <= 0 && !hb.button_pressed()) {
+    // nothing's happening, turn off
+    hb.set_light(CURRENT_LEVEL, OFF_LEVEL, NOW);
+    // or print charge state if we're plugged in
+    hb.print_charge(GLED);
+  } else if (action_mode == WAIT_MODE) {
+    // we are waiting to do something
+    // the alarm has gone off (get_alarm only says so for one update, and
+    //  we may have been selecting the light level then)
+    if(!hb.get_alarm_remaining(ACTION_ALARM)) {
+      hb.set_light(CURRENT_LEVEL, action_light_level, 12000);
+      action_mode=OFF_MODE;
+    } else {
+      // display our current wait time...
       if(!hb.printing_number()) {
-        hb.print_charge(GLED);
-      }
-    } else if (action_mode == WAIT_MODE) {
-      // we are waiting to do something
-      if(action_time_remaining(action_time) == 0) {
-        hb.set_light(CURRENT_LEVEL, action_light_level, 12000);
-        action_mode=OFF_MODE;
-      } else {
-        // display our current wait time...
-        if(!hb.printing_number()) {
-          // print hours and minutes remaining
-          hb.print_number(action_time_remaining(action_time));
-        }
-      }
-    }
-    
-    // change mode?
-    if(hb.button_just_released() && hb.button_pressed_time() < 300) {
-      Serial.println(hb.get_light_level());
-      if(hb.get_light_level() <= 0) {
-        // make sure we don't turn off.  This should be modified in the api to be cleaner.
-        hb.set_light(0,0,NOW); 
+        // print hours and minutes remaining
+        hb.print_number(action_time_remaining());
       }
-      primary_mode = SECOND_PRESS_WAIT_MODE; 
-    } else if (hb.button_pressed() && hb.button_pressed_time() > 3000) {
-      primary_mode = WAIT_MODE;
-      action_mode = OFF_MODE;
-    } else if (hb.button_pressed() && hb.button_pressed_time() > 300) {
-      brightness_level = 0;
-      hb.set_light(CURRENT_LEVEL, 0, 100);
-      primary_mode = WAIT_MODE;
-    }
-    break;
-  case SECOND_PRESS_WAIT_MODE:
-    if(hb.button_just_released() && hb.button_pressed_time() < 300 && hb.button_released_time() < 500) {
-      primary_mode = SET_ACTION_MODE;
-      action_mode = OFF_MODE;
-      place = 0;
-      previous_action_time = action_time;
-      action_time = 0;
-      action_light_level = brightness_level;
-    } else if (hb.button_released_time() > 500) {
-      // enter this mode after 500 ms of not being pressed
-      primary_mode = LIGHT_SELECT_MODE; 
     }
-    break;
-  case LIGHT_SELECT_MODE:
-    if(abs(hb.difference_from_down()-.5)<.35) { // not pointing up or down
-      char spin = hb.get_spin();
-      brightness_level = brightness_level + spin;
-      brightness_level = brightness_level>1000 ? 1000 : brightness_level;
-      brightness_level = brightness_level<1 ? 1 : brightness_level;
-      hb.set_light(CURRENT_LEVEL, brightness_level, 100);
+  }
+  if(hb.get_mode_event() == EVENT_LONG_HOLD) {
+    // held for 3 seconds, turn off the timer too
+    action_mode = OFF_MODE;
+  }
+}
 
-    }
-    if(hb.button_just_released()) {
-      primary_mode = WAIT_MODE; 
-    }
+void dark_enter() {
+  brightness_level = 0;
+}
+
+void second_press_wait_enter() {
+  if(hb.get_light_level() <= 0) {
+    // make sure we don't turn off.  This should be modified in the api to be cleaner.
+    hb.set_light(0,0,NOW); 
+  }
+}
+
+void light_select_tick() {
+  // spin is 0 while pointing up or down, where the angle is mostly noise.
+  //  A turn changes the level by 256.
+  if(hb.get_spin()) {
+    brightness_level = brightness_level + hb.get_spin();
+    brightness_level = brightness_level>1000 ? 1000 : brightness_level;
+    brightness_level = brightness_level<1 ? 1 : brightness_level;
+    hb.set_light(CURRENT_LEVEL, brightness_level, 100);
+  }
+}
+
+void set_action_enter() {
+  action_mode = OFF_MODE;
+  place = 0;
+  previous_action_time = action_time;
+  action_time = 0;
+  action_light_level = brightness_level;
+}
+
+void set_action_tick() {
+  hb.input_digit(action_time*10, action_time*10+time[place]);
+  switch(hb.get_mode_event()) {
+  case EVENT_RELEASE:
+  case EVENT_LONG_RELEASE:
+    action_time = hb.get_input_digit();
+    place++;
     break;
-  case SET_ACTION_MODE:
-    hb.input_digit(action_time*10, action_time*10+time[place]);
-    if(hb.button_just_released() && hb.button_pressed_time()>300) {
-      action_time = hb.get_input_digit();
-      place++;
-    } else if (hb.button_just_released() && hb.button_pressed_time()<300) {
-      // use the value from the last timer (0 on the first run)
-      switch(place) {
-      case 0: // hours
-        action_time = (previous_action_time/100)*100;
-        break;
-      case 1: // greater minutes
-        action_time += (previous_action_time/10)*10 % 100;
-        break;
-      case 2: // lesser minutes
-        action_time += previous_action_time % 10;
-        break;
-      }
-      
-      place++;
-    }
-    if(place==PLACES) {
-      primary_mode = WAIT_MODE;
-      action_mode = WAIT_MODE;
-      // reset the time, for easy comparison
-      setTime(0);
+  case EVENT_CLICK:
+    // use the value from the last timer (0 on the first run)
+    switch(place) {
+    case 0: // hours
+      action_time = (previous_action_time/100)*100;
+      break;
+    case 1: // greater minutes
+      action_time += (previous_action_time/10)*10 % 100;
+      break;
+    case 2: // lesser minutes
+      action_time += previous_action_time % 10;
+      break;
     }
+    place++;
     break;
   }
-  
+  if(place==PLACES) {
+    action_mode = WAIT_MODE;
+    hb.set_alarm_in(ACTION_ALARM, (action_time/100)*3600L + (action_time%100)*60L);
+    hb.set_mode(MODE_WAIT);
+  }
 }
 
-int action_time_remaining(int action_time) {
-  char minutes_remaining = action_time%100 - minute();
-  int hours_remaining = action_time/100 - hour();
-  if(minutes_remaining<0) {
-    hours_remaining--;
-    minutes_remaining+=60;
-  }
-  return hours_remaining*100+minutes_remaining;
+const mode_state modes[] PROGMEM = {
+  // level        change time  timeout  flags  enter                    tick               exit
+  {CURRENT_LEVEL, NOW,         0,       0,     NULL,                    wait_tick,         NULL}, // MODE_WAIT
+  {0,             100,         0,       0,     dark_enter,              wait_tick,         NULL}, // MODE_DARK
+  {CURRENT_LEVEL, NOW,         500,     0,     second_press_wait_enter, NULL,              NULL}, // MODE_SECOND_PRESS_WAIT
+  {CURRENT_LEVEL, NOW,         0,       0,     NULL,                    NULL,              NULL}, // MODE_SECOND_PRESS
+  {CURRENT_LEVEL, NOW,         0,       0,     NULL,                    light_select_tick, NULL}, // MODE_LIGHT_SELECT
+  {CURRENT_LEVEL, NOW,         0,       0,     set_action_enter,        set_action_tick,   NULL}, // MODE_SET_ACTION
+};
+
+// press and hold for 300 ms to turn off the light, 3 seconds to turn off the timer
+const mode_transition transitions[] PROGMEM = {
+  // from                  event               to
+  {MODE_WAIT,              EVENT_CLICK,        MODE_SECOND_PRESS_WAIT},
+  {MODE_WAIT,              EVENT_HOLD,         MODE_DARK},
+  {MODE_DARK,              EVENT_CLICK,        MODE_SECOND_PRESS_WAIT},
+  {MODE_DARK,              EVENT_HOLD,         MODE_DARK}, // the timer may have turned the light on
+  // a short click within 500 ms sets the timer, otherwise we select the light level
+  {MODE_SECOND_PRESS_WAIT, EVENT_PRESS,        MODE_SECOND_PRESS},
+  {MODE_SECOND_PRESS_WAIT, EVENT_TIMEOUT,      MODE_LIGHT_SELECT},
+  {MODE_SECOND_PRESS,      EVENT_CLICK,        MODE_SET_ACTION},
+  {MODE_SECOND_PRESS,      EVENT_RELEASE,      MODE_SECOND_PRESS_WAIT},
+  {MODE_SECOND_PRESS,      EVENT_LONG_RELEASE, MODE_SECOND_PRESS_WAIT},
+  {MODE_LIGHT_SELECT,      EVENT_CLICK,        MODE_WAIT},
+  {MODE_LIGHT_SELECT,      EVENT_RELEASE,      MODE_WAIT},
+  {MODE_LIGHT_SELECT,      EVENT_LONG_RELEASE, MODE_WAIT},
+  {MODE_END, EVENT_NONE, MODE_END}
+};
+
+void setup() {
+  hb.init_hardware();
+  hb.set_modes(modes, transitions, 300, 3000);
+}
+
+void loop() {
+  hb.update();
 }
@@ -29,57 +29,60 @@ either expressed or implied, of the FreeBSD Project.
 
 #include <hexbright.h>
 
-#define OFF_MODE 0
-#define BLINKY_MODE 1
-#define CYCLE_MODE 2
+#define MODE_OFF 0
+#define MODE_CYCLE 1
+#define MODE_BLINKY 2
 
-int mode = 0;
+hexbright hb;
 
+int brightness_level = 4;
 
-hexbright hb;
+void off_enter() {
+  // in case we are under usb power, reset state
+  brightness_level = 4;
+}
 
-void setup() {
-  hb.init_hardware();
-} 
+void cycle_enter() {
+  int levels[] = {1,250,500,750,1000};
+  brightness_level = (brightness_level+1)%5;
+  hb.set_light(CURRENT_LEVEL, levels[brightness_level], 150);
+}
 
-void loop() {
-  hb.update();
-  static int brightness_level = 4;
-
-  //// Button actions to recognize, one-time actions to take as a result
-  if(hb.button_just_released()) {
-    if(hb.button_pressed_time()<300) { //<300 milliseconds
-      mode = CYCLE_MODE;
-      int levels[] = {1,250,500,750,1000};
-      brightness_level = (brightness_level+1)%5;
-      hb.set_light(CURRENT_LEVEL, levels[brightness_level], 150);
-    } else if (hb.button_pressed_time() < 700) {
-      mode = BLINKY_MODE;
-    }
+void cycle_tick() { // print the current flashlight temperature
+  if(!hb.printing_number()) {
+    hb.print_number(hb.get_fahrenheit());
   }
-  if(hb.button_pressed_time()>700) { // if held for over 700 milliseconds (whether or not it's been released), go to OFF mode
-    mode = OFF_MODE;
-    hb.set_light(CURRENT_LEVEL, OFF_LEVEL, NOW);
-    // in case we are under usb power, reset state
-    brightness_level = 4;
+}
+
+void blinky_tick() { // just blink
+  static unsigned long flash_time = 0;
+  if(flash_time+400<millis()) {
+    flash_time = millis();
+    hb.set_light(MAX_LOW_LEVEL,0,30); // fade from 500 to 0 over 30 milliseconds
   }
+}
 
+const mode_state modes[] PROGMEM = {
+  // level        change time  timeout  flags              enter        tick         exit
+  {OFF_LEVEL,     NOW,         0,       MODE_PRINT_CHARGE, off_enter,   NULL,        NULL}, // MODE_OFF
+  {CURRENT_LEVEL, NOW,         0,       0,                 cycle_enter, cycle_tick,  NULL}, // MODE_CYCLE
+  {CURRENT_LEVEL, NOW,         0,       0,                 NULL,        blinky_tick, NULL}, // MODE_BLINKY
+};
 
-  //// Actions over time for a given mode
-  if(mode == BLINKY_MODE) { // just blink
-    static int i = 0;
-    if(!i) {
-      hb.set_light(MAX_LOW_LEVEL,0,30); // fade from 500 to 0 over 30 milliseconds
-      i=400/8.3333; // every fifty times through; currently the library is locked at 8.333 milliseconds
-    }
-    i--;
-  } else if (mode == CYCLE_MODE) { // print the current flashlight temperature
-    if(!hb.printing_number()) {
-      hb.print_number(hb.get_fahrenheit());
-    }
-  } else if (mode == OFF_MODE) { // charging, or turning off
-    if(!hb.printing_number()) {
-      hb.print_charge(GLED);
-    }
-  }
-}
+const mode_transition transitions[] PROGMEM = {
+  // from    event            to
+  {MODE_ANY, EVENT_CLICK,     MODE_CYCLE}, // <300 milliseconds
+  {MODE_ANY, EVENT_RELEASE,   MODE_BLINKY}, // <700 milliseconds
+  // held for 700 milliseconds (whether or not it's been released)
+  {MODE_ANY, EVENT_LONG_HOLD, MODE_OFF},
+  {MODE_END, EVENT_NONE, MODE_END}
+};
+
+void setup() {
+  hb.init_hardware();
+  hb.set_modes(modes, transitions, 300, 700);
+}
+
+void loop() {
+  hb.update();
+}
@@ -50,7 +50,6 @@ Changes and modifications are Copyright (c) 2014, "Matthew Sargent" <matthew.c.s
  */
 
 #include <hexbright.h>
-#include <EEPROM.h>
 
 #if (DEBUG==DEBUG_PROGRAM)
 #define DBG(a) a
@@ -58,10 +57,10 @@ Changes and modifications are Copyright (c) 2014, "Matthew Sargent" <matthew.c.s
 #define DBG(a)
 #endif
 
-#define EEPROM_LOCKED 0
-#define EEPROM_NIGHTLIGHT_BRIGHTNESS 1
-#define EEPROM_STORED_BRIGHTNESS 2
-#define EEPROM_SIGNATURE_LOC 3
+// Settings (see remember)
+#define SETTING_LOCKED 0
+#define SETTING_NIGHTLIGHT_BRIGHTNESS 1
+#define SETTING_STORED_BRIGHTNESS 2
 
 // Modes
 #define MODE_OFF        0
@@ -69,32 +68,25 @@ Changes and modifications are Copyright (c) 2014, "Matthew Sargent" <matthew.c.s
 #define MODE_BLINK      2
 #define MODE_NIGHTLIGHT 3
 #define MODE_SOS        4
-#define MODE_LOCKED     5
+#define MODE_LOCKED     5 // off, and locked
 
 // Constants
 static const int glow_mode_time = 3000;
 static const int click = 350; // maximum time for a "short" click
 static const int nightlight_timeout = 5000; // timeout before nightlight powers down after any movement
 static const unsigned char nightlight_sensitivity = 20; // measured in 100's of a G.
-static const byte sos_pattern[] = {
-  0xA8, 0xEE, 0xE2, 0xA0};
-static const int singleMorseBeat = 150;
+static const unsigned char sos_wpm = 8; // a 150 ms dot
 static const word blink_freq_map[] = { 70, 650, 10000}; // in ms
 static const unsigned GLOW_MODE=0;
 static const unsigned GLOW_MODE_JUST_CHANGED=1;
 static const unsigned QUICKSTROBE=2;
 
-// EEPROM signature used to verify EEPROM has been initialize
-static const char* EEPROM_Signature = "Set_and_Remember";
-
 // State
 static unsigned long treg1=0; 
 
 // Submode Storage
 static int bitreg=0;
 
-static char mode     = MODE_OFF;
-static char new_mode = MODE_OFF;  
 static unsigned tailflashesLeft = 0;
 static unsigned shutdowndelay = 250; //prevent an immediate shutdown when the unit starts up...
 
@@ -104,11 +96,26 @@ static word stored_brightness;
 static word blink_frequency; // in ms;
 
 static byte locked = false;
-static int sos_cursor = 0;
 unsigned long time;
 
 hexbright hb;
 
+// Settings are kept in EEPROM with SETTINGS uncommented in hexbright.h;
+//  without it we start from the defaults each time we're turned on.
+int recall(unsigned char setting, int default_value) {
+#ifdef SETTINGS
+  return hb.get_setting(setting, default_value);
+#else
+  return default_value;
+#endif
+}
+
+void remember(unsigned char setting, int value) {
+#ifdef SETTINGS
+  hb.set_setting(setting, value);
+#endif
+}
+
 int adjustLED() {
   if(hb.button_pressed() && hb.button_pressed_time()>click) {
     double d = hb.difference_from_down(); // (0,1)
@@ -124,338 +131,237 @@ int adjustLED() {
   return -1;
 }
 
-//Write the bytes contained in the parameter array to the location in 
-//EEPROM starting at startAddr. Write numBytes number of bytes.
-void writebytesEEPROM(int startAddr, const byte* array, int numBytes) {
-  int i;
-  for (i = 0; i < numBytes; i++) {
-    updateEEPROM(startAddr+i,array[i]);
+/////////////////////////////////////////////////////////////////
+// Mode switching activities.  The light is turned off right away
+// on entering MODE_OFF or MODE_LOCKED; if a shutdown is needed it
+// is done in off_tick.
+/////////////////////////////////////////////////////////////////
+
+void off_enter() {
+  if(locked) {
+    // 5 clicks while locked
+    locked = false;
+    remember(SETTING_LOCKED, locked); //remember if we are locked or not.
+    //Setup the tail light to flash...
+    tailflashesLeft = 3;
   }
 }
 
-//Update the EEPROM, but check to make sure we actually need to update it first.
-//This saves writing to the EEPROM when it is not necessary (important).
-byte updateEEPROM(word location, byte value) {
-  byte c = EEPROM.read(location);
-  if(c!=value) {
-    DBG(Serial.print("Write to EEPROM:"); Serial.print(value); Serial.print(" to loc: "); Serial.println(location));
-    EEPROM.write(location, value);
-  }
-  return value;
+void off_exit() {
+  //The user might have switched to a new mode while the tail was flashing so 
+  //it may not yet be zeroed so clear them out
+  tailflashesLeft = 0;
 }
 
-//Check the EEPROM to see if the signature has been written, if found, return true
-boolean checkEEPROMInited(word location) {
-  //read starting at location and look for the signature.
-  int i = 0;
-  for (i = 0; i < strlen(EEPROM_Signature); i++) {
-    if (EEPROM_Signature[i] != EEPROM.read(location+i))
-      return false; //EEPROM does not match Signature, so EEPROM not initialized
+void locked_enter() {
+  if(hb.get_mode_event()==EVENT_NONE)
+    return; // locked at power on, from setup
+  if(!locked) {
+    locked = true;
+    remember(SETTING_LOCKED, locked);
+    tailflashesLeft = 3;
+  } else {
+    //The light stays off and locked, unless 5 clicks were received.
+    //Flash the tailcap 2 times to indicate the light is locked.
+    DBG(Serial.println("Locked, flash tailcap 2 times."));
+    tailflashesLeft = 2;
   }
-  return true; //The signature was found, so the EEPROM is initialized...
 }
 
-void setup() {
+void level_enter() {
+  //Just turn on the light to the saved level
+  hb.set_light(CURRENT_LEVEL, stored_brightness, NOW); 
+}
 
-  // We just powered on!  That means either we got plugged
-  // into USB, or the user is pressing the power button.
-  hb = hexbright();
-  hb.init_hardware();
+void nightlight_enter() {
+  DBG(Serial.print("Nightlight Brightness: "); Serial.println(nightlight_brightness));
+  hb.set_led(GLED, 100, 0, 64);
+}
 
-  //The following code detects if the EEPROM has been initialized
-  //If it has not, initialize it.
-  if(!checkEEPROMInited(EEPROM_SIGNATURE_LOC)) {
+void sos_enter() {
+  // the international distress signal, until we leave the mode
+  hb.print_morse_P(PSTR("SOS"), MORSE_LIGHT, sos_wpm, stored_brightness, 0);
+}
 
-    updateEEPROM(EEPROM_LOCKED,0);  
-    updateEEPROM(EEPROM_NIGHTLIGHT_BRIGHTNESS, 100);
-    updateEEPROM(EEPROM_STORED_BRIGHTNESS, 150);
+void sos_exit() {
+  hb.stop_morse();
+}
 
-    //now store the signature so we know the EEPROM has been initialized
-    int length = strlen(EEPROM_Signature) + 1; //this will cause the nul to be written too.
-    writebytesEEPROM(EEPROM_SIGNATURE_LOC,(const byte*)EEPROM_Signature, length);
+void blink_enter() {
+  double d = hb.difference_from_down();
+  blink_frequency = blink_freq_map[0];
+  if(d <= 0.40) {
+    if(d <= 0.10)
+      blink_frequency = blink_freq_map[2];
+    else
+      blink_frequency = blink_freq_map[1];
   }
+  hb.set_light(MAX_LEVEL, 0, 20);
+}
 
-  //Initialize variables using the values stored in the EEPROM  
-  //DBG(Serial.println("Reading defaults from EEPROM"));
-  locked = EEPROM.read(EEPROM_LOCKED);
-  //DBG(Serial.print("Locked: "); Serial.println(locked));
-  nightlight_brightness = EEPROM.read(EEPROM_NIGHTLIGHT_BRIGHTNESS)*4;
-  nightlight_brightness = nightlight_brightness==0 ? 1000 : nightlight_brightness;
-  //DBG(Serial.print("Nightlight Brightness: "); Serial.println(nightlight_brightness));
-
-  //Fetch the stored brightness from EEPROM and use it when turning on.
-  stored_brightness = EEPROM.read(EEPROM_STORED_BRIGHTNESS)*4;
-  stored_brightness = stored_brightness==0 ? 1000 : stored_brightness; //If zero, default to 1000
-  //DBG(Serial.print("Stored Brightness: "); Serial.println(stored_brightness));
-
-  DBG(Serial.println("Powered up!"));
-
-  hb.config_click_count(click);
-} 
-
-void loop() {
-  time = millis();
-
-  hb.update();
-
-#ifdef PRINTING_NUMBER:
-  if(!hb.printing_number()) 
-#endif
-  {
-    // Charging
-    hb.print_charge(GLED);
-
-    // Low battery <NOTE fix for tailflashes>
-    if(mode != MODE_OFF && hb.low_voltage_state())
-      if(hb.get_led_state(RLED)==LED_OFF) 
-        hb.set_led(RLED,50,1000,1);
+/////////////////////////////////////////////////////////////////
+// The stuff that we do while in a mode.
+/////////////////////////////////////////////////////////////////
+
+void off_tick() {
+  if (tailflashesLeft > 0) { //flashing tail
+    hb.set_light(CURRENT_LEVEL, 0, NOW);
+    if (hb.get_led_state(locked?RLED:GLED)==LED_OFF) {
+      tailflashesLeft--;
+      hb.set_led(locked?RLED:GLED, 300, 300, 255);
+      DBG(Serial.print("Tail Flashed"); Serial.println());        
+    }
+  } 
+  else if(BIT_CHECK(bitreg,GLOW_MODE)) { //glow mode
+    hb.set_led(GLED, 100, 100, 64);
+    hb.set_light(CURRENT_LEVEL, 0, NOW);
+    DBG(Serial.print("Glow Mode - light off, processor on"); Serial.println());
+  } 
+  else if (shutdowndelay > 0) { //This is the delay that lets the device run for a little while...
+    shutdowndelay--;
   }
+  else { //Do the shutdown now...
+    DBG(Serial.print("Nightlight Brightness Saved: "); Serial.println(nightlight_brightness));
+    remember(SETTING_NIGHTLIGHT_BRIGHTNESS, nightlight_brightness);
 
+    //Save the stored_brightness so we can use it next time
+    DBG(Serial.print("Brightness Saved: "); 
+    Serial.println(stored_brightness));
+    remember(SETTING_STORED_BRIGHTNESS, stored_brightness);
 
-  /////////////////////////////////////////////////////////////////
-  // Check for the requested new mode and do the mode switching activities
-  /////////////////////////////////////////////////////////////////
-  // Get the click count
-  new_mode = hb.click_count();
-
-  //if the new mode is good...
-  if(new_mode>=MODE_OFF) {
-    DBG(Serial.print("New mode: "); 
-    Serial.println((int)new_mode));
-
-    //If the light is on now, any new mode request is a MODE_OFF.
-    //i.e. while the light is on, you can not switch it into another mode, it just goes off. 
-    if(mode!=MODE_OFF) {
-      DBG(Serial.println("Forcing MODE_OFF"));
-      new_mode=MODE_OFF;
-
-      //If the light is currently off, the following keeps the light off and locked, 
-      //unless the locked mode was received.
-      //Flash the tailcap 2 times to indicate the light is locked.
-    } else if (locked && new_mode!=MODE_LOCKED){
-      new_mode=MODE_OFF;
-      DBG(Serial.println("Locked, flash tailcap 2 times."));
-      tailflashesLeft = 2;
-    }
+    DBG(Serial.print("Light off, processor off"); Serial.println());
+    hb.set_light(CURRENT_LEVEL, OFF_LEVEL, NOW);
   }
 
-  //Process if this is really a mode change.
-  if(new_mode>=MODE_OFF && new_mode!=mode) { 
-    double d;
-
-    //The user might have switched to a new mode while the tail was flashing so 
-    //it may not yet be zeroed so clear them out
-    if (new_mode != MODE_OFF)
-      tailflashesLeft = 0;
-
-    // Do the preliminary work when switching to a new mode first
-    switch(new_mode) {
-
-    case MODE_LOCKED:
-      locked=!locked;//toggle the locked mode
-      updateEEPROM(EEPROM_LOCKED,locked); //remember if we are locked or not.
-      new_mode=MODE_OFF; //keep the light off when entering or exiting lock mode.
-      //Setup the tail light to flash...
-      tailflashesLeft = 3;
-      break;
-
-    case MODE_OFF:
-      //Turn the light off right away, if a shutdown is needed it will be done inthe mode maint.
-      hb.set_light(CURRENT_LEVEL, 0, NOW); 
-      break;
-
-    case MODE_LEVEL: 
-      //Just turn on the light to the saved level
-      hb.set_light(CURRENT_LEVEL, stored_brightness, NOW); 
-      break;
-
-    case MODE_NIGHTLIGHT:
-      DBG(Serial.print("Nightlight Brightness: "); Serial.println(nightlight_brightness));
-#ifdef PRINTING_NUMBER:
-      if(!hb.printing_number())
-#endif
-        hb.set_led(GLED, 100, 0, 64);
-      break;
-
-    case MODE_SOS:
-      //Entering SOS mode, so set the cursor at the beginning of the pattern
-      sos_cursor = 0;
-
-      //Give a light change command with time of NOW so it finishes right away 
-      //making the SOS pattern start without much delay.
-      hb.set_light(0, 0, NOW); 
-      break;
-
-    case MODE_BLINK:
-      d = hb.difference_from_down();
-      blink_frequency = blink_freq_map[0];
-      if(d <= 0.40) {
-        if(d <= 0.10)
-          blink_frequency = blink_freq_map[2];
-        else
-          blink_frequency = blink_freq_map[1];
+  // holding the button
+  if(hb.button_pressed() && !locked) {
+    double d = hb.difference_from_down();
+    if(BIT_CHECK(bitreg,QUICKSTROBE) 
+      || (hb.button_pressed_time() > click 
+      && d > 0.10 )) {   
+      BIT_SET(bitreg,QUICKSTROBE);
+      if(treg1+blink_freq_map[0] < time) { 
+        treg1 = time; 
+        hb.set_light(MAX_LEVEL, 0, 20); 
       }
-      hb.set_light(MAX_LEVEL, 0, 20);
-      break;
     }
-    mode=new_mode;
-  } 
-
-  /////////////////////////////////////////////////////////////////
-  // Done with new mode activities. Now do the 
-  // stuff that we do while in a mode.
-  /////////////////////////////////////////////////////////////////
-  int i;
-
-  switch(mode) {
-
-  case MODE_OFF:
-    if (tailflashesLeft > 0) { //flashing tail
-      hb.set_light(CURRENT_LEVEL, 0, NOW);
-      if (hb.get_led_state(locked?RLED:GLED)==LED_OFF) {
-        tailflashesLeft--;
-        hb.set_led(locked?RLED:GLED, 300, 300, 255);
-        DBG(Serial.print("Tail Flashed"); Serial.println());        
-      }
-    } 
-    else if(BIT_CHECK(bitreg,GLOW_MODE)) { //glow mode
-      hb.set_led(GLED, 100, 100, 64);
-      hb.set_light(CURRENT_LEVEL, 0, NOW);
-      DBG(Serial.print("Glow Mode - light off, processor on"); Serial.println());
+    if(hb.button_pressed_time() >= glow_mode_time 
+      &&d <= 0.1 
+      && !BIT_CHECK(bitreg,GLOW_MODE_JUST_CHANGED) 
+      && !BIT_CHECK(bitreg,QUICKSTROBE) ) {
+      BIT_TOGGLE(bitreg,GLOW_MODE);
+      BIT_SET(bitreg,GLOW_MODE_JUST_CHANGED);
     } 
-    else if (shutdowndelay > 0) { //This is the delay that lets the device run for a little while...
-      shutdowndelay--;
-    }
-    else { //Do the shutdown now...
-      DBG(Serial.print("Nightlight Brightness Saved: "); Serial.println(nightlight_brightness));
-      updateEEPROM(EEPROM_NIGHTLIGHT_BRIGHTNESS, nightlight_brightness/4);
+  }
+  if(hb.button_just_released()) {
+    BIT_CLEAR(bitreg,GLOW_MODE_JUST_CHANGED);
+    BIT_CLEAR(bitreg,QUICKSTROBE);
+  }
+}
 
-      //Save the stored_brightness in the EEPROM so we can use it next time
-      DBG(Serial.print("Brightness Saved: "); 
-      Serial.println(stored_brightness));
-      updateEEPROM(EEPROM_STORED_BRIGHTNESS, stored_brightness/4);
+void level_tick() {
+  int i = adjustLED(); //Adjust the led and save it
+  if(i>0) {
+    DBG(Serial.print("New Stored Brightness: "); Serial.println(i));
+    stored_brightness = i;
+  }
+}
 
-      DBG(Serial.print("Light off, processor off"); Serial.println());
-      hb.set_light(CURRENT_LEVEL, OFF_LEVEL, NOW);
-    }
+void nightlight_tick() {
+  if(hb.moved(nightlight_sensitivity)) {
+    DBG(Serial.println("Nightlight Moved"));
+    treg1 = time;
+    hb.set_light(CURRENT_LEVEL, nightlight_brightness, 1000);
+    hb.set_led(GLED, 0, 0, 0); //turn off the LED while the light is on...
+  } 
+  else if(time > treg1 + nightlight_timeout) {
+    hb.set_light(CURRENT_LEVEL, 0, 1000);
+    hb.set_led(GLED, 1000, 0, 64);
+  }
 
-    // holding the button
-    if(hb.button_pressed() && !locked) {
+  int i = adjustLED();
+  if(i>0) {
+    DBG(Serial.print("Nightlight Brightness: "); Serial.println(i));
+    nightlight_brightness = i;
+  }
+}
+
+void blink_tick() {
+  if(hb.button_pressed()) {
+    if( hb.button_pressed_time()> click) {
       double d = hb.difference_from_down();
-      if(BIT_CHECK(bitreg,QUICKSTROBE) 
-        || (hb.button_pressed_time() > click 
-        && d > 0.10 )) {   
-        BIT_SET(bitreg,QUICKSTROBE);
-        if(treg1+blink_freq_map[0] < time) { 
-          treg1 = time; 
-          hb.set_light(MAX_LEVEL, 0, 20); 
+      if(d>=0 && d<=0.99) {
+        if(d>=0.25) {
+          d = d>0.5 ? 0.5 : d;
+          blink_frequency = blink_freq_map[0] + (word)((blink_freq_map[1] - blink_freq_map[0]) * 4 * (0.5-d));
+        } 
+        else {
+          blink_frequency = blink_freq_map[1] + (word)((blink_freq_map[2] - blink_freq_map[1]) * 4 * (0.25-d));
         }
+        DBG(Serial.print("Blink Freq: "); Serial.println(blink_frequency));
       }
-      if(hb.button_pressed_time() >= glow_mode_time 
-        &&d <= 0.1 
-        && !BIT_CHECK(bitreg,GLOW_MODE_JUST_CHANGED) 
-        && !BIT_CHECK(bitreg,QUICKSTROBE) ) {
-        BIT_TOGGLE(bitreg,GLOW_MODE);
-        BIT_SET(bitreg,GLOW_MODE_JUST_CHANGED);
-      } 
-    }
-    if(hb.button_just_released()) {
-      BIT_CLEAR(bitreg,GLOW_MODE_JUST_CHANGED);
-      BIT_CLEAR(bitreg,QUICKSTROBE);
     }
-    
-    break;
+  }
+  if(treg1+blink_frequency < time) { 
+    treg1 = time;
+    hb.set_light(MAX_LEVEL, 0, 20); 
+  }
+}
 
+const mode_state modes[] PROGMEM = {
+  // level        change time  timeout  flags              enter             tick             exit
+  {0,             NOW,         0,       MODE_PRINT_CHARGE, off_enter,        off_tick,        off_exit}, // MODE_OFF
+  {CURRENT_LEVEL, NOW,         0,       MODE_PRINT_POWER,  level_enter,      level_tick,      NULL},     // MODE_LEVEL
+  {CURRENT_LEVEL, NOW,         0,       MODE_PRINT_POWER,  blink_enter,      blink_tick,      NULL},     // MODE_BLINK
+  {CURRENT_LEVEL, NOW,         0,       MODE_PRINT_POWER,  nightlight_enter, nightlight_tick, NULL},     // MODE_NIGHTLIGHT
+  {0,             NOW,         0,       MODE_PRINT_POWER,  sos_enter,        NULL,            sos_exit}, // MODE_SOS
+  {0,             NOW,         0,       MODE_PRINT_CHARGE, locked_enter,     off_tick,        off_exit}, // MODE_LOCKED
+};
+
+//While the light is on, you can not switch it into another mode, it just goes off. 
+const mode_transition transitions[] PROGMEM = {
+  // from       event            to
+  {MODE_OFF,    EVENT_CLICKS+1,  MODE_LEVEL},
+  {MODE_OFF,    EVENT_CLICKS+2,  MODE_BLINK},
+  {MODE_OFF,    EVENT_CLICKS+3,  MODE_NIGHTLIGHT},
+  {MODE_OFF,    EVENT_CLICKS+4,  MODE_SOS},
+  {MODE_OFF,    EVENT_CLICKS+5,  MODE_LOCKED},
+  {MODE_LOCKED, EVENT_CLICKS+5,  MODE_OFF}, // unlock
+  {MODE_LOCKED, EVENT_CLICKS+1,  MODE_LOCKED}, // flash the tail to show we're locked
+  {MODE_LOCKED, EVENT_CLICKS+2,  MODE_LOCKED},
+  {MODE_LOCKED, EVENT_CLICKS+3,  MODE_LOCKED},
+  {MODE_LOCKED, EVENT_CLICKS+4,  MODE_LOCKED},
+  {MODE_ANY,    EVENT_CLICKS+1,  MODE_OFF},
+  {MODE_ANY,    EVENT_CLICKS+2,  MODE_OFF},
+  {MODE_ANY,    EVENT_CLICKS+3,  MODE_OFF},
+  {MODE_ANY,    EVENT_CLICKS+4,  MODE_OFF},
+  {MODE_ANY,    EVENT_CLICKS+5,  MODE_OFF},
+  {MODE_END, EVENT_NONE, MODE_END}
+};
 
-  case MODE_LEVEL:
-    i = adjustLED(); //Adjust the led and save it
-    if(i>0) {
-      DBG(Serial.print("New Stored Brightness: "); Serial.println(i));
-      stored_brightness = i;
-    }
-    break;
-
-  case MODE_NIGHTLIGHT: 
-      if(hb.moved(nightlight_sensitivity)) {
-        DBG(Serial.println("Nightlight Moved"));
-        treg1 = time;
-        hb.set_light(CURRENT_LEVEL, nightlight_brightness, 1000);
-        hb.set_led(GLED, 0, 0, 0); //turn off the LED while the light is on...
-      } 
-      else if(time > treg1 + nightlight_timeout) {
-        hb.set_light(CURRENT_LEVEL, 0, 1000);
-        hb.set_led(GLED, 1000, 0, 64);
-      }
+void setup() {
 
-      i = adjustLED();
-      if(i>0) {
-        DBG(Serial.print("Nightlight Brightness: "); Serial.println(i));
-        nightlight_brightness = i;
-      }
-      break; 
-
-  case MODE_BLINK:
-    if(hb.button_pressed()) {
-      if( hb.button_pressed_time()> click) {
-        double d = hb.difference_from_down();
-        if(d>=0 && d<=0.99) {
-          if(d>=0.25) {
-            d = d>0.5 ? 0.5 : d;
-            blink_frequency = blink_freq_map[0] + (word)((blink_freq_map[1] - blink_freq_map[0]) * 4 * (0.5-d));
-          } 
-          else {
-            blink_frequency = blink_freq_map[1] + (word)((blink_freq_map[2] - blink_freq_map[1]) * 4 * (0.25-d));
-          }
-          DBG(Serial.print("Blink Freq: "); Serial.println(blink_frequency));
-        }
-      }
-    }
-    if(treg1+blink_frequency < time) { 
-      treg1 = time;
-      hb.set_light(MAX_LEVEL, 0, 20); 
-    }
-    break;
-
-  case MODE_SOS:
-    //Send the international distress signal.  
-    //... --- ...   ... --- ...
-    //Dit  150 = 1 beat
-    //Dah  450 = 3 beats
-    //Inter dit/dah  = 1 beat
-    //Inter character = 3 beats = <ic>
-    //Inter word  = 7 beats = <iw>
-
-    //From left to right, the pattern is encoded with bits, each bit being
-    //a singleMorseBeat long (except the last one, as in:
-    //<-S-> <inter-char> <----O----> <inter-char> <-S-> <-inter word->
-    //10101     000      11101110111      000     10101  0xxx
-    //
-    //10101000 11101110 11100010 1010xxxx
-    //    0xA8     0xEE     0xE2     0xA0     
-
-    //At the end of each completed light change, move to the next bit.
-    //In this case the light change will be from ON to ON or from Off to Off, so
-    //that is how we get our flashing. This should happen every singleMorseBeat, except 
-    //on the last bit where we cause the delay to be longer (x7) to mark the between word space
-    if(hb.light_change_remaining()==0){
-      int whichByte = sos_cursor/8; //0/8 = 0 1/8=0...
-      int whichBit = 7 - sos_cursor%8; //7 - 0%8 = 7; 7-30%8 = 6
-      int onOffAmount = BIT_CHECK(sos_pattern[whichByte],whichBit)?stored_brightness:0;
-
-      //if this is the last bit, then make the delay an interword amount (x7)
-      int onOrOffTime = sos_cursor<27?singleMorseBeat:singleMorseBeat*7; 
-
-      hb.set_light(onOffAmount,onOffAmount, onOrOffTime);
-
-      DBG(Serial.print("SOS Data; byte#/bit#: "); Serial.print(whichByte); Serial.print("/"); Serial.println(whichBit));
-      DBG(Serial.print("SOS Data; onOffAmount#: "); Serial.println(onOffAmount));
-      DBG(Serial.print("SOS Data; onOrOffTime: "); Serial.println(onOrOffTime));
-      sos_cursor++;
-
-      if (sos_cursor>27 || sos_cursor<0) {
-        sos_cursor = 0;
-      }
-    }
-    break;
-  }  
+  // We just powered on!  That means either we got plugged
+  // into USB, or the user is pressing the power button.
+  hb = hexbright();
+  hb.init_hardware();
+
+  //Initialize variables using the saved settings, or the defaults if they
+  //have never been saved.
+  locked = recall(SETTING_LOCKED, false);
+  nightlight_brightness = recall(SETTING_NIGHTLIGHT_BRIGHTNESS, 400);
+  stored_brightness = recall(SETTING_STORED_BRIGHTNESS, 600);
+
+  DBG(Serial.println("Powered up!"));
+
+  hb.config_click_count(click);
+  hb.set_modes(modes, transitions);
+  if(locked)
+    hb.set_mode(MODE_LOCKED);
 } 
+
+void loop() {
+  time = millis();
+
+  hb.update();
+}
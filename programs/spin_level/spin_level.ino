@@ -65,8 +65,10 @@ void loop() {
   }
 
   if(mode==SPIN_LEVEL_MODE) {
-    if(abs(hb.difference_from_down()-.5)<.35) { // acceleration is not along the light axis, where noise causes random fluctuations.
-      char spin = hb.get_spin();
+    // spin is 0 while pointing up or down, where the angle is mostly noise.
+    //  A turn changes the level by 256.
+    char spin = hb.get_spin();
+    if(spin) {
       brightness_level = brightness_level + spin;
       brightness_level = brightness_level>1000 ? 1000 : brightness_level;
       brightness_level = brightness_level<1 ? 1 : brightness_level;
@@ -33,46 +33,63 @@ hexbright hb;
 
 #define HOLD_TIME 250 // milliseconds before going to strobe
 #define OFF_TIME 650 // milliseconds before going off on the next normal button press
+#define CHANGE_TIME 50
 
-#define BRIGHTNESS_COUNT 4
-#define BRIGHTNESS_OFF BRIGHTNESS_COUNT-1
-int brightness[BRIGHTNESS_COUNT] = {300, 600, 1000, OFF_LEVEL};
-int current_brightness = BRIGHTNESS_OFF; // start on the last mode (off)
+// Modes.  Each level is picked by a click within OFF_TIME of the last one;
+//  after that the level is settled, and the next click turns us off.
+#define MODE_OFF 0
+#define MODE_LOW 1
+#define MODE_MEDIUM 2
+#define MODE_HIGH 3
+#define MODE_LOW_SETTLED 4
+#define MODE_MEDIUM_SETTLED 5
+#define MODE_HIGH_SETTLED 6
+#define MODE_STROBE 7
 
-unsigned long short_press_time = 0;
+void strobe() {
+  static unsigned long flash_time = 0;
+  if(flash_time+70<millis()) { // flash every 70 milliseconds
+    flash_time = millis(); // reset flash_time
+    hb.set_light(MAX_LEVEL, 0, 20); // and pulse (going from max to min over 20 milliseconds)
+    // actually, because of the refresh rate, it's more like 'go from max brightness on high
+    //  to max brightness on low to off.
+  }
+}
+
+const mode_state modes[] PROGMEM = {
+  // level        change time  timeout   flags             enter tick    exit
+  {OFF_LEVEL,     CHANGE_TIME, 0,        MODE_PRINT_POWER, NULL, NULL,   NULL}, // MODE_OFF
+  {300,           CHANGE_TIME, OFF_TIME, MODE_PRINT_POWER, NULL, NULL,   NULL}, // MODE_LOW
+  {600,           CHANGE_TIME, OFF_TIME, MODE_PRINT_POWER, NULL, NULL,   NULL}, // MODE_MEDIUM
+  {1000,          CHANGE_TIME, OFF_TIME, MODE_PRINT_POWER, NULL, NULL,   NULL}, // MODE_HIGH
+  {300,           CHANGE_TIME, 0,        MODE_PRINT_POWER, NULL, NULL,   NULL}, // MODE_LOW_SETTLED
+  {600,           CHANGE_TIME, 0,        MODE_PRINT_POWER, NULL, NULL,   NULL}, // MODE_MEDIUM_SETTLED
+  {1000,          CHANGE_TIME, 0,        MODE_PRINT_POWER, NULL, NULL,   NULL}, // MODE_HIGH_SETTLED
+  {CURRENT_LEVEL, NOW,         0,        MODE_PRINT_POWER, NULL, strobe, NULL}, // MODE_STROBE
+};
+
+const mode_transition transitions[] PROGMEM = {
+  // from          event               to
+  {MODE_OFF,       EVENT_CLICK,        MODE_LOW},
+  {MODE_LOW,       EVENT_CLICK,        MODE_MEDIUM},
+  {MODE_MEDIUM,    EVENT_CLICK,        MODE_HIGH},
+  {MODE_HIGH,      EVENT_CLICK,        MODE_OFF},
+  {MODE_LOW,       EVENT_TIMEOUT,      MODE_LOW_SETTLED},
+  {MODE_MEDIUM,    EVENT_TIMEOUT,      MODE_MEDIUM_SETTLED},
+  {MODE_HIGH,      EVENT_TIMEOUT,      MODE_HIGH_SETTLED},
+  {MODE_ANY,       EVENT_CLICK,        MODE_OFF}, // settled
+  {MODE_ANY,       EVENT_HOLD,         MODE_STROBE},
+  // back to whatever we were doing (MODE_OFF turns us off)
+  {MODE_STROBE,    EVENT_RELEASE,      MODE_PREVIOUS},
+  {MODE_STROBE,    EVENT_LONG_RELEASE, MODE_PREVIOUS},
+  {MODE_END, EVENT_NONE, MODE_END}
+};
 
 void setup() {
   hb.init_hardware(); 
+  hb.set_modes(modes, transitions, HOLD_TIME);
 }
 
 void loop() {
   hb.update();
-  if(hb.button_just_released()) {
-    
-    if(hb.button_pressed_time()<HOLD_TIME) {
-      // we just had a normal duration press
-      if(short_press_time+OFF_TIME<millis() && current_brightness!=BRIGHTNESS_OFF) {
-        // it's been a while since our last button press, turn off
-        current_brightness = BRIGHTNESS_OFF;
-      } else {
-        short_press_time = millis();
-        current_brightness = (current_brightness+1)%BRIGHTNESS_COUNT;
-      }
-    } else {
-      // we have been doing strobe, set light at the previous light level (do nothing to current_brightness)
-    }
-    // actually change the brightness
-    hb.set_light(CURRENT_LEVEL, brightness[current_brightness], 50);
-  } else if (hb.button_pressed() && hb.button_pressed_time()>HOLD_TIME) {
-    // held for over HOLD_TIME ms, go to strobe
-    static unsigned long flash_time = millis();
-    if(flash_time+70<millis()) { // flash every 70 milliseconds
-      flash_time = millis(); // reset flash_time
-      hb.set_light(MAX_LEVEL, 0, 20); // and pulse (going from max to min over 20 milliseconds)
-      // actually, because of the refresh rate, it's more like 'go from max brightness on high
-      //  to max brightness on low to off.
-    }
-  } 
-  hb.print_power();
 }
-
@@ -32,6 +32,10 @@ either expressed or implied, of the FreeBSD Project.
 // Usage notes are in the readme file in this same directory.
 hexbright hb;
 
+#define SHOW_MODE 0 // print the temperature
+#define SET_MODE 1 // choose the temperature we're at
+int mode = SHOW_MODE;
+
 void setup() {
   hb.init_hardware();
   hb.set_light(0,0,NOW); // stay on, because we want the temperature output
@@ -42,14 +46,34 @@ int brightness = 0;
 void loop() {
   hb.update();
 
-  if(hb.button_just_released()) { 
-    brightness = brightness==0 ? 1000 : 0;
-    hb.set_light(CURRENT_LEVEL, brightness, 50);
-  }
-  
-  if(!hb.printing_number()) {
-    hb.print_number(hb.get_thermal_sensor());
-//    hb.print_number(hb.get_fahrenheit());
+  switch(mode) {
+  case SHOW_MODE:
+    if(hb.button_just_released()) {
+      if(hb.button_pressed_time()>2000) {
+        mode = SET_MODE;
+      } else {
+        // heat the light up, to see overheat protection at work
+        brightness = brightness==0 ? 1000 : 0;
+        hb.set_light(CURRENT_LEVEL, brightness, 50);
+      }
+    }
+    if(!hb.printing_number()) {
+      hb.print_number(hb.get_celsius());
+    }
+    break;
+  case SET_MODE:
+    // twist to choose the temperature (in celsius) the light is sitting at
+    hb.input_digit(0, 100);
+    if(hb.button_just_released()) {
+      int celsius = hb.get_input_digit();
+      // the ice bath is point 0, the warm one point 1
+      if(hb.calibrate_temperature(celsius<25 ? 0 : 1, celsius*10))
+        hb.set_led(GLED, 1000);
+      else
+        hb.set_led(RLED, 1000);
+      hb.reset_print_number();
+      mode = SHOW_MODE;
+    }
+    break;
   }
 }
-
@@ -0,0 +1,78 @@
+#include <hexbright.h>
+#include <EEPROM.h>
+
+hexbright hb;
+
+/*
+  Like accelerometer_record, but stores raw, compressed samples (see
+   start_capture in hexbright.h), so we get several seconds instead of 1.4.
+  Uncomment ACCEL_CAPTURE in hexbright.h before uploading.
+
+  When plugged in:
+    Print the contents of EEPROM as hex, then "DONE".  Decode it with:
+     experiments/accelerometer_readings/test_program/capture_decode.bin < dump > sampleNN
+
+  When unplugged:
+    button press: arm the capture (low light).  A significant change starts
+     the recording, which turns the light up for the duration.
+     When EEPROM is full, turn off.  A button press during a recording stops it.
+*/
+
+#define OFF_MODE 0
+#define WAIT_MODE 1
+#define RECORD_MODE 2
+#define PRINT_MODE 3
+int mode = OFF_MODE;
+
+#define CAPTURE_THRESHOLD 15 // .15 Gs
+int address = 0;
+
+void setup() {
+  hb.init_hardware();
+  if(hb.get_charge_state()!=BATTERY) {
+    // we're plugged in, print
+    mode = PRINT_MODE;
+  }
+}
+
+void loop() {
+  hb.update();
+  switch (mode) {
+  case OFF_MODE:
+    if(hb.button_just_released()) {
+      hb.set_light(100, 100, NOW);
+      hb.start_capture(CAPTURE_THRESHOLD);
+      mode = WAIT_MODE;
+    }
+    break;
+  case WAIT_MODE:
+    if(hb.get_capture_state()==CAPTURE_RECORDING) {
+      hb.set_light(500, 500, NOW);
+      mode = RECORD_MODE;
+    }
+    break;
+  case RECORD_MODE:
+    if(hb.button_just_released())
+      hb.stop_capture();
+    if(hb.get_capture_state()==CAPTURE_DONE) {
+      hb.set_light(0, 0, NOW);
+      mode = OFF_MODE;
+    }
+    break;
+  case PRINT_MODE:
+    // a line per update, so we don't overrun the serial buffer
+    if(address<=E2END) {
+      for(int i=0; i<16; i++) {
+        byte value = EEPROM.read(address++);
+        if(value<0x10)
+          Serial.print('0');
+        Serial.print(value, HEX);
+        Serial.print(' ');
+      }
+      Serial.println();
+    } else {
+      Serial.println("DONE");
+      mode = OFF_MODE;
+    }
+  }
+}
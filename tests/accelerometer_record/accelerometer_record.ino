@@ -20,7 +20,15 @@ hexbright hb;
 #define PRINT_MODE 3
 int mode = OFF_MODE;
 
-#define EEPROM_SIZE 510 // last two bytes can't fit a whole vector...
+// stay below the EEPROM the library uses (see EEPROM_CALIBRATION in hexbright.h)
+#if defined(USAGE_STATS)
+#define EEPROM_END EEPROM_USAGE
+#elif defined(SETTINGS)
+#define EEPROM_END EEPROM_SETTINGS
+#else
+#define EEPROM_END EEPROM_CALIBRATION
+#endif
+#define EEPROM_SIZE (EEPROM_END-EEPROM_END%3) // whole vectors only
 int address = EEPROM_SIZE;
 
 void setup() {
@@ -105,4 +113,4 @@ void read_vector(int * vector) {
       vector[i] = tmp*(100/21.3);
     }
   }  
-}
+}
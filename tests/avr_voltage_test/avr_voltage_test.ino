@@ -80,8 +80,6 @@ void loop() {
       hb.print_number(hb.get_avr_voltage());
     }
   } else if (mode == OFF_MODE) { // charging, or turning off
-    if(!hb.printing_number()) {
-      hb.print_charge(GLED);
-    }
+    hb.print_charge(GLED);
   }
-}
+}
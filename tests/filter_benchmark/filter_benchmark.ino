@@ -0,0 +1,70 @@
+#include <hexbright.h>
+
+hexbright hb;
+
+/*
+  Times each accelerometer reading filter (see run_filter in hexbright.h)
+   over a recorded stretch of readings, and prints the cost in cycles.
+  Requires DEBUG (for Serial) in hexbright.h; keep DEBUG_PRINT so timing
+   isn't disturbed by other debug output.
+
+  The numbers go in the filter table in
+   experiments/accelerometer_readings/Readme.md, next to the host scores
+   from filter_bench.
+*/
+
+#define FILTER_COUNT 6
+#define PASSES 20
+
+const char* names[FILTER_COUNT] = {"none", "low_pass_filter", "stdev_filter",
+                                   "stdev_filter2", "stdev_filter3", "step_filter"};
+
+// x axis of a spin, a fall and some time at rest, from the recordings
+const int readings[] = {89, 84, 89, 93, 98, 103, 98, 89, 75, 61, 42, 23,
+                        4, -14, -28, -42, -56, -61, -70, -75, -70, -65, -56, -42,
+                        9, 4, 4, 0, 0, 4, 0, -4, 0, 0, 4, 9,
+                        93, 98, 93, 93, 98, 93, 93, 93, 98, 98, 93, 93};
+#define READING_COUNT (sizeof(readings)/sizeof(readings[0]))
+
+volatile int sink;
+int filter = -1; // -1 is the loop overhead
+
+unsigned long time_filter(int id) {
+  unsigned long start = micros();
+  for(int pass=0; pass<PASSES; pass++) {
+    int estimate = readings[0];
+    for(unsigned char i=1; i<READING_COUNT; i++) {
+      if(id>=0)
+        estimate = hb.run_filter(id, estimate, readings[i]);
+      else
+        estimate = readings[i];
+      sink = estimate;
+    }
+  }
+  return micros()-start;
+}
+
+unsigned long overhead;
+
+void setup() {
+  hb.init_hardware();
+}
+
+void loop() {
+  hb.update();
+  if(filter<FILTER_COUNT) {
+    // interrupts (millis, our own update timing) add a little noise
+    unsigned long elapsed = time_filter(filter);
+    if(filter<0) {
+      overhead = elapsed;
+      Serial.println("filter: cycles per call");
+    } else {
+      // 8 cycles per microsecond
+      unsigned long cycles = (elapsed-overhead)*8/(PASSES*(READING_COUNT-1));
+      Serial.print(names[filter]);
+      Serial.print(": ");
+      Serial.println(cycles);
+    }
+    filter++;
+  }
+}
@@ -37,8 +37,8 @@ void setup() {
   hb.set_light(0,0,NOW); // stay on when unplugged
 }
 
-#define COUNT 7
-long numbers[COUNT] = {-101, -1, 0, 3, 23, 100, 1000000};
+#define COUNT 8
+long numbers[COUNT] = {-101, -1, 0, 3, 23, 100, 1000000, -2147483648L};
 int number = 0;
 
 void loop() {
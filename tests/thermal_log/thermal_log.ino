@@ -0,0 +1,83 @@
+#include <hexbright.h>
+
+hexbright hb;
+
+/*
+  Logs the light level and the thermal sensor while running through a set
+   of levels, for fitting the thermal model (see THERMAL_MODEL in
+   hexbright.cpp).
+  Requires DEBUG (for Serial) in hexbright.h; DEBUG_PRINT is enough.
+
+  Start with the light at room temperature and plugged in, and log the
+   serial port to a file.  Click to start, hold to stop.  Every half second
+   we print:
+    milliseconds, average level, filtered reading, predicted reading
+   The level is what we actually ran at, after overheat protection.
+  The whole profile takes 20 minutes.  Feed the log to fit_thermal in
+   experiments/thermal_readings.
+*/
+
+#define LOG_UPDATES 60 // half a second
+
+// level, seconds
+const int profile[][2] = {{1000, 180}, {0, 180}, {500, 120}, {1000, 60},
+                          {250, 240}, {0, 420}};
+#define PROFILE_STEPS (sizeof(profile)/sizeof(profile[0]))
+
+int step = -1; // -1 when we aren't running
+long step_updates = 0;
+long level_sum = 0;
+unsigned char logged_updates = 0;
+
+void setup() {
+  hb.init_hardware();
+}
+
+void start_step() {
+  hb.set_light(CURRENT_LEVEL, profile[step][0], 1000);
+  step_updates = (long)profile[step][1]*1000/8.333;
+}
+
+void loop() {
+  hb.update();
+  if(hb.button_pressed_time()>700) {
+    if(step>=0)
+      Serial.println("STOPPED");
+    step = -1;
+    hb.set_light(CURRENT_LEVEL, OFF_LEVEL, NOW);
+    return;
+  }
+  if(step<0) {
+    if(hb.button_just_released()) {
+      Serial.println("ms, level, filtered, predicted");
+      step = 0;
+      level_sum = 0;
+      logged_updates = 0;
+      start_step();
+    }
+    return;
+  }
+
+  level_sum += hb.get_max_light_level();
+  if(++logged_updates==LOG_UPDATES) {
+    Serial.print(millis());
+    Serial.print(", ");
+    Serial.print(level_sum/LOG_UPDATES);
+    Serial.print(", ");
+    Serial.print(hb.get_filtered_thermal_sensor());
+    Serial.print(", ");
+    Serial.println(hb.get_predicted_thermal_sensor());
+    level_sum = 0;
+    logged_updates = 0;
+  }
+
+  if(!--step_updates) {
+    if(++step==PROFILE_STEPS) {
+      Serial.println("DONE");
+      step = -1;
+      hb.set_light(CURRENT_LEVEL, OFF_LEVEL, NOW);
+    } else {
+      start_step();
+    }
+  }
+}